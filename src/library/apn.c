@@ -36,6 +36,9 @@
 #include "apn_strerror.h"
 #include "apn_log.h"
 #include "apn_ssl.h"
+#include "apn_poll.h"
+#include "apn_engine_private.h"
+#include "apn_token_source_private.h"
 
 #ifdef APN_HAVE_FCNTL_H
 #include <fcntl.h>
@@ -57,19 +60,6 @@
 #include <netdb.h>
 #endif
 
-typedef enum __apn_apple_errors {
-    APN_APNS_ERR_PROCESSING_ERROR = 1,
-    APN_APNS_ERR_MISSING_DEVICE_TOKEN,
-    APN_APNS_ERR_MISSING_TOPIC,
-    APN_APNS_ERR_MISSING_PAYLOAD,
-    APN_APNS_ERR_INVALID_TOKEN_SIZE,
-    APN_APNS_ERR_INVALID_TOPIC_SIZE,
-    APN_APNS_ERR_INVALID_PAYLOAD_SIZE,
-    APN_APNS_ERR_INVALID_TOKEN,
-    APN_APNS_ERR_SERVICE_SHUTDOWN = 10,
-    APN_APNS_ERR_NONE = 255
-} apn_apple_errors;
-
 struct __apn_apple_server {
     char *host;
     uint16_t port;
@@ -82,18 +72,13 @@ static struct __apn_apple_server __apn_apple_servers[4] = {
         {"feedback.push.apple.com",         2196}
 };
 
-static apn_return __apn_send_binary_message(const apn_ctx_t *const ctx,
-                                            apn_binary_message_t *const binary_message,
-                                            apn_array_t *tokens,
-                                            uint32_t token_index,
-                                            uint8_t *apple_error_code,
-                                            uint32_t *invalid_token_index);
 static apn_return __apn_connect(apn_ctx_t *const ctx, struct __apn_apple_server server);
-static void __apn_parse_apns_error(char *apns_error, uint8_t *apns_error_code, uint32_t *id);
+static apn_return __apn_connect_begin(apn_ctx_t *const ctx, struct __apn_apple_server server);
+static apn_return __apn_connect_next_address(apn_ctx_t *const ctx);
 static apn_binary_message_t *__apn_payload_to_binary_message(const apn_ctx_t *const ctx,
                                                              const apn_payload_t *const payload);
-static int __apn_convert_apple_error(uint8_t apple_error_code);
-static void __apn_invalid_token_dtor(char *const token);
+static apn_return __apn_send_confirm_pending(apn_ctx_t *const ctx);
+static apn_return __apn_send_wait(apn_ctx_t *const ctx, apn_array_t **invalid_tokens, apn_token_set_t **invalid_token_set);
 
 apn_return apn_library_init() {
     static uint8_t library_initialized = 0;
@@ -129,6 +114,11 @@ apn_ctx_t *apn_init() {
         return NULL;
     }
     ctx->sock = -1;
+    ctx->connection_id = 0;
+    ctx->connect_phase = APN_CONNECT_PHASE_NONE;
+    ctx->connect_started = 0;
+    ctx->addrinfo = NULL;
+    ctx->addrinfo_next = NULL;
     ctx->ssl = NULL;
     ctx->certificate_file = NULL;
     ctx->private_key_file = NULL;
@@ -140,12 +130,28 @@ apn_ctx_t *apn_init() {
     ctx->log_callback = NULL;
     ctx->log_level = APN_LOG_LEVEL_ERROR;
     ctx->invalid_token_callback = NULL;
+    ctx->suppression = NULL;
+    ctx->options = 0;
+    ctx->send_buffer_size = APN_SEND_BUFFER_SIZE_DEFAULT;
+    ctx->replay_buffer_size = APN_REPLAY_BUFFER_SIZE_DEFAULT;
+    ctx->replay_window = APN_REPLAY_WINDOW_DEFAULT;
+    ctx->drain_timeout = APN_DRAIN_TIMEOUT_DEFAULT;
+    ctx->reconnect_delay = APN_RECONNECT_DELAY_DEFAULT;
+    ctx->reconnect_max_delay = APN_RECONNECT_MAX_DELAY_DEFAULT;
+    ctx->reconnect_max_attempts = APN_RECONNECT_MAX_ATTEMPTS_DEFAULT;
+    ctx->feedback_timeout = APN_FEEDBACK_TIMEOUT_DEFAULT;
+    ctx->inflight_limit = 0;
+    apn_rate_limiter_init(&ctx->rate_limiter, 0, 0);
+    ctx->shared_rate_limiter = NULL;
+    ctx->rtt = 0;
+    apn_engine_init(&ctx->engine);
     return ctx;
 }
 
 void apn_free(apn_ctx_t *ctx) {
     if (ctx) {
         apn_close(ctx);
+        apn_engine_free(&ctx->engine);
         apn_mem_free(ctx->certificate_file);
         apn_mem_free(ctx->private_key_file);
         apn_mem_free(ctx->private_key_pass);
@@ -157,6 +163,12 @@ void apn_free(apn_ctx_t *ctx) {
 
 void apn_close(apn_ctx_t *const ctx) {
     assert(ctx);
+    if (ctx->addrinfo) {
+        freeaddrinfo(ctx->addrinfo);
+        ctx->addrinfo = NULL;
+        ctx->addrinfo_next = NULL;
+    }
+    ctx->connect_phase = APN_CONNECT_PHASE_NONE;
     if(-1 == ctx->sock) {
         return;
     }
@@ -225,6 +237,61 @@ void apn_set_behavior(apn_ctx_t * const ctx, uint32_t options) {
     ctx->options = options;
 }
 
+void apn_set_send_buffer_size(apn_ctx_t *const ctx, uint32_t size) {
+    assert(ctx);
+    ctx->send_buffer_size = size;
+}
+
+void apn_set_replay_buffer_size(apn_ctx_t *const ctx, uint32_t size) {
+    assert(ctx);
+    ctx->replay_buffer_size = size;
+}
+
+void apn_set_replay_window(apn_ctx_t *const ctx, uint32_t window) {
+    assert(ctx);
+    ctx->replay_window = window;
+}
+
+void apn_set_drain_timeout(apn_ctx_t *const ctx, uint32_t timeout) {
+    assert(ctx);
+    ctx->drain_timeout = timeout;
+}
+
+void apn_set_reconnect_delay(apn_ctx_t *const ctx, uint32_t delay) {
+    assert(ctx);
+    ctx->reconnect_delay = delay;
+}
+
+void apn_set_reconnect_max_delay(apn_ctx_t *const ctx, uint32_t delay) {
+    assert(ctx);
+    ctx->reconnect_max_delay = delay;
+}
+
+void apn_set_reconnect_max_attempts(apn_ctx_t *const ctx, uint32_t attempts) {
+    assert(ctx);
+    ctx->reconnect_max_attempts = attempts;
+}
+
+void apn_set_feedback_timeout(apn_ctx_t *const ctx, uint32_t timeout) {
+    assert(ctx);
+    ctx->feedback_timeout = timeout;
+}
+
+void apn_set_rate_limit(apn_ctx_t *const ctx, uint32_t notifications_per_second, uint32_t bytes_per_second) {
+    assert(ctx);
+    apn_rate_limiter_init(&ctx->rate_limiter, notifications_per_second, bytes_per_second);
+}
+
+void apn_set_suppression_list(apn_ctx_t *const ctx, apn_suppression_t *const suppression) {
+    assert(ctx);
+    ctx->suppression = suppression;
+}
+
+void apn_set_inflight_limit(apn_ctx_t *const ctx, uint32_t size) {
+    assert(ctx);
+    ctx->inflight_limit = size;
+}
+
 void apn_set_log_level(apn_ctx_t *const ctx, uint16_t level) {
     assert(ctx);
     ctx->log_level = level;
@@ -255,6 +322,66 @@ uint32_t apn_behavior(const apn_ctx_t *const ctx) {
     return ctx->options;
 }
 
+uint32_t apn_send_buffer_size(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->send_buffer_size;
+}
+
+uint32_t apn_replay_buffer_size(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->replay_buffer_size;
+}
+
+uint32_t apn_replay_window(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->replay_window;
+}
+
+uint32_t apn_drain_timeout(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->drain_timeout;
+}
+
+uint32_t apn_reconnect_delay(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->reconnect_delay;
+}
+
+uint32_t apn_reconnect_max_delay(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->reconnect_max_delay;
+}
+
+uint32_t apn_reconnect_max_attempts(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->reconnect_max_attempts;
+}
+
+uint32_t apn_feedback_timeout(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->feedback_timeout;
+}
+
+uint32_t apn_rate_limit_notifications(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->rate_limiter.notifications.rate;
+}
+
+uint32_t apn_rate_limit_bytes(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->rate_limiter.bytes.rate;
+}
+
+apn_suppression_t *apn_suppression_list(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->suppression;
+}
+
+uint32_t apn_inflight_limit(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return ctx->inflight_limit;
+}
+
 const char *apn_certificate(const apn_ctx_t *const ctx) {
     assert(ctx);
     return ctx->certificate_file;
@@ -295,96 +422,220 @@ apn_return apn_send(apn_ctx_t *const ctx, const apn_payload_t *payload, apn_arra
     assert(tokens);
     assert(apn_array_count(tokens) > 0);
 
+    if (APN_ERROR == __apn_send_confirm_pending(ctx)) {
+        return APN_ERROR;
+    }
+    if (APN_ERROR == apn_send_async(ctx, payload, tokens)) {
+        return APN_ERROR;
+    }
+    return __apn_send_wait(ctx, invalid_tokens, NULL);
+}
+
+apn_return apn_send_token_set(apn_ctx_t *const ctx, const apn_payload_t *payload, const apn_token_set_t *tokens,
+                              apn_token_set_t **invalid_tokens) {
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
+
+    if (APN_ERROR == __apn_send_confirm_pending(ctx)) {
+        return APN_ERROR;
+    }
+    if (APN_ERROR == apn_send_token_set_async(ctx, payload, tokens)) {
+        return APN_ERROR;
+    }
+    return __apn_send_wait(ctx, NULL, invalid_tokens);
+}
+
+apn_return apn_send_token_set_async(apn_ctx_t *const ctx, const apn_payload_t *payload, const apn_token_set_t *tokens) {
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
+
     __APN_CHECK_CONNECTION(ctx)
 
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
     apn_binary_message_t *binary_message = __apn_payload_to_binary_message(ctx, payload);
     if (!binary_message) {
         return APN_ERROR;
     }
 
-    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notification to %d device(s)...", apn_array_count(tokens));
+    apn_frame_source_t source;
+    if (APN_ERROR == apn_frame_source_token_set(&source, binary_message, tokens)) {
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
+    }
 
-    apn_array_t *_invalid_tokens = NULL;
-    uint32_t start_index = 0;
-    uint8_t auto_reconnect = 0;
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notification to %u device(s)...", apn_token_set_count(tokens));
+    return apn_engine_start(ctx, &source, 0);
+}
 
-    apn_return ret = APN_SUCCESS;
+apn_return apn_send_source(apn_ctx_t *const ctx, const apn_payload_t *payload, const apn_token_source_t *tokens,
+                           apn_array_t **invalid_tokens) {
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
 
-    for (;;) {
-        if (1 == auto_reconnect) {
-            apn_log(ctx, APN_LOG_LEVEL_INFO, "Reconnecting...");
-            apn_close(ctx);
-#ifndef _WIN32
-    	    sleep(1);
-#else
-	    Sleep(1000);
-#endif
-            if (APN_ERROR == (ret = apn_connect(ctx))) {
-                break;
-            }
-        }
+    if (APN_ERROR == __apn_send_confirm_pending(ctx)) {
+        return APN_ERROR;
+    }
+    if (APN_ERROR == apn_send_source_async(ctx, payload, tokens)) {
+        return APN_ERROR;
+    }
+    return __apn_send_wait(ctx, invalid_tokens, NULL);
+}
 
-        uint32_t invalid_token_index = 0;
-        uint8_t apple_error_code = 0;
-        ret = __apn_send_binary_message(ctx, binary_message, tokens, start_index, &apple_error_code,
-                                        &invalid_token_index);
-        if (ret == APN_SUCCESS) {
-            break;
-        } else {
-            uint16_t errcode = apple_error_code > 0 ? __apn_convert_apple_error(apple_error_code) : errno;
-            if (errcode == APN_ERR_TOKEN_INVALID) {
-                const char *const invalid_token = (const char *const) apn_array_item_at_index(tokens,
-                                                                                              invalid_token_index);
-                apn_log(ctx, APN_LOG_LEVEL_ERROR, "Invalid token: %s (index: %u)", invalid_token,
-                          invalid_token_index);
-                if (invalid_tokens) {
-                    if (!_invalid_tokens) {
-                        if (NULL ==
-                            (_invalid_tokens = apn_array_init(10, (apn_array_dtor) __apn_invalid_token_dtor, NULL))) {
-                            apn_binary_message_free(binary_message);
-                            return APN_ERROR;
-                        }
-                    }
-                    apn_array_insert(_invalid_tokens, apn_strndup(invalid_token, APN_TOKEN_LENGTH));
-                    if (ctx->invalid_token_callback) {
-                        ctx->invalid_token_callback(invalid_token, invalid_token_index);
-                    }
-                }
-            }
+apn_return apn_send_source_async(apn_ctx_t *const ctx, const apn_payload_t *payload, const apn_token_source_t *tokens) {
+    apn_token_source_t token_source;
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
 
-            char *error_string = apn_error_string(errcode);
-            apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not send notification: %s (errno: %d)", error_string, errcode);
-            apn_strfree(&error_string);
-
-            start_index = (errcode == APN_ERR_TOKEN_INVALID) ? invalid_token_index + 1 : invalid_token_index;
-
-            uint32_t options = apn_behavior(ctx);
-            if (start_index < apn_array_count(tokens)) {
-                if (options & APN_OPTION_RECONNECT &&
-                    (errcode == APN_ERR_CONNECTION_CLOSED
-                     || errcode == APN_ERR_SERVICE_SHUTDOWN
-                     || errcode == APN_ERR_NETWORK_TIMEDOUT
-                     || errcode == APN_ERR_NETWORK_UNREACHABLE
-                     || (errcode == APN_ERR_TOKEN_INVALID))) {
-                    auto_reconnect = 1;
-                    continue;
-                }
-            } else if (errcode == APN_ERR_TOKEN_INVALID) {
-                errno = 0;
-                ret = APN_SUCCESS;
-                break;
-            } else {
-                errno = errcode;
-                break;
-            }
-        }
+    token_source = *tokens;
+
+    if (!ctx->ssl || ctx->feedback) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Connection was not opened");
+        apn_token_source_free(&token_source);
+        errno = APN_ERR_NOT_CONNECTED;
+        return APN_ERROR;
+    }
+
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        apn_token_source_free(&token_source);
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
+    apn_binary_message_t *binary_message = __apn_payload_to_binary_message(ctx, payload);
+    if (!binary_message) {
+        apn_token_source_free(&token_source);
+        return APN_ERROR;
+    }
+
+    apn_frame_source_t source;
+    if (APN_ERROR == apn_frame_source_tokens(&source, binary_message, &token_source)) {
+        apn_token_source_free(&token_source);
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
+    }
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notification to devices from token source...");
+    return apn_engine_start(ctx, &source, 0);
+}
+
+apn_return apn_send_batch(apn_ctx_t *const ctx, const apn_batch_item_t *items, uint32_t count,
+                          apn_array_t **invalid_tokens) {
+    assert(ctx);
+    assert(items);
+    assert(count > 0);
+
+    if (APN_ERROR == __apn_send_confirm_pending(ctx)) {
+        return APN_ERROR;
+    }
+    if (APN_ERROR == apn_send_batch_async(ctx, items, count)) {
+        return APN_ERROR;
+    }
+    return __apn_send_wait(ctx, invalid_tokens, NULL);
+}
+
+apn_return apn_send_batch_async(apn_ctx_t *const ctx, const apn_batch_item_t *items, uint32_t count) {
+    assert(ctx);
+    assert(items);
+    assert(count > 0);
+
+    __APN_CHECK_CONNECTION(ctx)
+
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
+    apn_frame_source_t source;
+    if (APN_ERROR == apn_frame_source_batch(&source, items, count)) {
+        return APN_ERROR;
+    }
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending %u notification(s)...", count);
+    return apn_engine_start(ctx, &source, 0);
+}
+
+apn_return apn_send_confirm(apn_ctx_t *const ctx, apn_array_t **invalid_tokens) {
+    assert(ctx);
+    apn_engine_wait(ctx);
+    return apn_engine_result(ctx, invalid_tokens);
+}
+
+apn_return apn_send_confirm_token_set(apn_ctx_t *const ctx, apn_token_set_t **invalid_tokens) {
+    assert(ctx);
+    apn_engine_wait(ctx);
+    return apn_engine_result_token_set(ctx, invalid_tokens);
+}
+
+apn_return apn_send_async(apn_ctx_t *const ctx, const apn_payload_t *payload, apn_array_t *tokens) {
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
+    assert(apn_array_count(tokens) > 0);
+
+    return apn_send_range_async(ctx, payload, tokens, 0, apn_array_count(tokens));
+}
+
+apn_return apn_send_range_async(apn_ctx_t *const ctx, const apn_payload_t *payload, apn_array_t *tokens,
+                                uint32_t first_index, uint32_t end_index) {
+    assert(ctx);
+    assert(payload);
+    assert(tokens);
+    assert(first_index < end_index && end_index <= apn_array_count(tokens));
+
+    __APN_CHECK_CONNECTION(ctx)
+
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
+    apn_binary_message_t *binary_message = __apn_payload_to_binary_message(ctx, payload);
+    if (!binary_message) {
+        return APN_ERROR;
     }
 
-    apn_binary_message_free(binary_message);
-    if (invalid_tokens && _invalid_tokens) {
-        *invalid_tokens = _invalid_tokens;
+    apn_token_source_t token_source;
+    if (APN_ERROR == apn_token_source_array_range(&token_source, tokens, end_index)) {
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
+    }
+
+    apn_frame_source_t source;
+    if (APN_ERROR == apn_frame_source_tokens(&source, binary_message, &token_source)) {
+        apn_token_source_free(&token_source);
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
     }
-    return ret;
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notification to %d device(s)...", end_index - first_index);
+    return apn_engine_start(ctx, &source, first_index);
+}
+
+uint8_t apn_send_in_progress(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    return apn_engine_busy(ctx);
+}
+
+apn_return apn_send_result(apn_ctx_t *const ctx, apn_array_t **invalid_tokens) {
+    assert(ctx);
+    return apn_engine_result(ctx, invalid_tokens);
+}
+
+apn_return apn_send_result_token_set(apn_ctx_t *const ctx, apn_token_set_t **invalid_tokens) {
+    assert(ctx);
+    return apn_engine_result_token_set(ctx, invalid_tokens);
 }
 
 apn_return apn_feedback_connect(apn_ctx_t *const ctx) {
@@ -399,62 +650,82 @@ apn_return apn_feedback_connect(apn_ctx_t *const ctx) {
 }
 
 apn_return apn_feedback(const apn_ctx_t *const ctx, apn_array_t **tokens) {
+    apn_token_set_t *token_set = NULL;
     assert(ctx);
     assert(tokens);
 
-    fd_set read_set;
-    struct timeval timeout = {3, 0};
+    if (APN_ERROR == apn_feedback_token_set(ctx, &token_set)) {
+        return APN_ERROR;
+    }
+    *tokens = apn_token_set_to_array(token_set);
+    apn_token_set_free(token_set);
+    return *tokens ? APN_SUCCESS : APN_ERROR;
+}
 
-    if (!ctx->ssl || ctx->feedback) {
-        errno = APN_ERR_NOT_CONNECTED;
+apn_return apn_feedback_token_set(const apn_ctx_t *const ctx, apn_token_set_t **tokens) {
+    assert(ctx);
+    assert(tokens);
+
+    char buffer[38];
+    uint32_t buffer_used = 0;
+
+    if (!ctx->ssl || !ctx->feedback) {
+        errno = APN_ERR_NOT_CONNECTED_FEEDBACK;
         return APN_ERROR;
     }
 
-    *tokens = apn_array_init(10, (apn_array_dtor)__apn_invalid_token_dtor, NULL);
+    *tokens = apn_token_set_init(0);
     if (!*tokens) {
         return APN_ERROR;
     }
 
     for (; ;) {
-        FD_ZERO(&read_set);
-        FD_SET(ctx->sock, &read_set);
+        if (0 == SSL_pending(ctx->ssl)) {
+            int ready = apn_poll(ctx->sock, APN_POLL_READ, (int) ctx->feedback_timeout);
+            if (ready < 0) {
+                apn_token_set_free(*tokens);
+                *tokens = NULL;
+                return APN_ERROR;
+            }
+            if (ready == 0) {
+                /* poll() timed out */
+                break;
+            }
+        }
 
-        int select_returned = select(ctx->sock + 1, &read_set, NULL, NULL, &timeout);
-        if (select_returned < 0) {
-            if (errno == EINTR) {
-                continue;
+        int bytes_read = apn_ssl_read(ctx, buffer + buffer_used, sizeof(buffer) - buffer_used);
+        if (bytes_read < 0) {
+            if (APN_ERR_CONNECTION_CLOSED == errno) {
+                /* Feedback service closes the connection after all tuples were sent */
+                break;
             }
+            apn_token_set_free(*tokens);
+            *tokens = NULL;
             return APN_ERROR;
         }
 
-        if (select_returned == 0) {
-            /* select() timed out */
-            break;
+        buffer_used += (uint32_t) bytes_read;
+        if (buffer_used < sizeof(buffer)) {
+            continue;
         }
-
-        if (FD_ISSET(ctx->sock, &read_set)) {
-            char buffer[38];
-            int bytes_read = apn_ssl_read(ctx, buffer, sizeof(buffer));
-            if (bytes_read < 0) {
-                return APN_ERROR;
-            } else if (bytes_read > 0) {
-                char *buffer_ref = buffer;
-                uint16_t token_length = 0;
-                uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
-
-                buffer_ref += sizeof(uint32_t);
-                memcpy(&token_length, buffer_ref, sizeof(token_length));
-                buffer_ref += sizeof(token_length);
-                token_length = ntohs(token_length);
-                memcpy(&binary_token, buffer_ref, sizeof(binary_token));
-                char *token_hex = apn_token_binary_to_hex(binary_token);
-                if (NULL == token_hex) {
-                    apn_array_free(*tokens);
-                    return APN_ERROR;
-                }
-                apn_array_insert(*tokens, token_hex);
-            }
-            break;
+        buffer_used = 0;
+
+        char *buffer_ref = buffer;
+        uint16_t token_length = 0;
+        uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
+
+        buffer_ref += sizeof(uint32_t);
+        memcpy(&token_length, buffer_ref, sizeof(token_length));
+        buffer_ref += sizeof(token_length);
+        token_length = ntohs(token_length);
+        memcpy(&binary_token, buffer_ref, sizeof(binary_token));
+        if (APN_ERROR == apn_token_set_add(*tokens, binary_token)) {
+            apn_token_set_free(*tokens);
+            *tokens = NULL;
+            return APN_ERROR;
+        }
+        if (ctx->suppression) {
+            apn_suppression_add(ctx->suppression, binary_token);
         }
     }
 
@@ -548,6 +819,15 @@ char *apn_error_string(int errnum) {
             apn_snprintf(error, sizeof(error) - 1,
                          "alert message text or key used to get a localized alert-message string or content-available flag must be set");
             break;
+        case APN_ERR_FILE_FORMAT_INVALID:
+            apn_snprintf(error, sizeof(error) - 1, "invalid file format");
+            break;
+        case APN_ERR_PAYLOAD_TEMPLATE_INVALID:
+            apn_snprintf(error, sizeof(error) - 1, "invalid payload template");
+            break;
+        case APN_ERR_PAYLOAD_JSON_INVALID:
+            apn_snprintf(error, sizeof(error) - 1, "payload is not a JSON object with an aps dictionary");
+            break;
         default:
             apn_strerror(errnum, error, sizeof(error) - 1);
             break;
@@ -556,6 +836,116 @@ char *apn_error_string(int errnum) {
 }
 
 static apn_return __apn_connect(apn_ctx_t *const ctx, struct __apn_apple_server server) {
+    if (ctx->sock != -1 && APN_CONNECT_PHASE_NONE == ctx->connect_phase) {
+        return APN_SUCCESS;
+    }
+    if (APN_CONNECT_PHASE_NONE == ctx->connect_phase && APN_ERROR == __apn_connect_begin(ctx, server)) {
+        return APN_ERROR;
+    }
+
+    for (;;) {
+        uint32_t want = 0;
+        int ret = apn_connect_process(ctx, &want);
+        if (ret > 0) {
+            return APN_SUCCESS;
+        } else if (ret < 0) {
+            return APN_ERROR;
+        }
+        if (0 > apn_poll(ctx->sock, want, -1)) {
+            int error = errno;
+            apn_close(ctx);
+            errno = error;
+            return APN_ERROR;
+        }
+    }
+}
+
+apn_return apn_connect_async(apn_ctx_t *const ctx) {
+    assert(ctx);
+    return __apn_connect_begin(ctx, __apn_apple_servers[ctx->mode == APN_MODE_SANDBOX ? 0 : 1]);
+}
+
+int apn_connect_process(apn_ctx_t *const ctx, uint32_t *want) {
+    assert(ctx);
+    assert(want);
+
+    switch (ctx->connect_phase) {
+        case APN_CONNECT_PHASE_TCP: {
+            int ready = apn_poll(ctx->sock, APN_POLL_WRITE, 0);
+            if (ready < 0) {
+                int error = errno;
+                apn_close(ctx);
+                errno = error;
+                return -1;
+            } else if (0 == ready) {
+                *want = APN_POLL_WRITE;
+                return 0;
+            }
+
+            int sock_error = 0;
+            socklen_t sock_error_size = sizeof(sock_error);
+            if (0 != getsockopt(ctx->sock, SOL_SOCKET, SO_ERROR, (char *) &sock_error, &sock_error_size)) {
+                sock_error = errno;
+            }
+            if (0 != sock_error) {
+                char *error = apn_error_string(sock_error);
+                apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not to connect to: %s (errno: %d)", error, sock_error);
+                free(error);
+                APN_CLOSE_SOCKET(ctx->sock);
+                ctx->sock = -1;
+                if (APN_ERROR == __apn_connect_next_address(ctx)) {
+                    return -1;
+                }
+                *want = APN_POLL_WRITE;
+                return 0;
+            }
+
+            /* TCP handshake takes one round trip */
+            uint32_t rtt = (uint32_t) (apn_time_ms() - ctx->connect_started);
+            if (0 == rtt) {
+                rtt = 1;
+            }
+            ctx->rtt = ctx->rtt ? (ctx->rtt * 7 + rtt) / 8 : rtt;
+
+            freeaddrinfo(ctx->addrinfo);
+            ctx->addrinfo = NULL;
+            ctx->addrinfo_next = NULL;
+
+            apn_log(ctx, APN_LOG_LEVEL_INFO, "Connection has been established");
+            apn_log(ctx, APN_LOG_LEVEL_INFO, "Initializing SSL connection...");
+
+            if (APN_ERROR == apn_ssl_prepare(ctx)) {
+                int error = errno;
+                apn_close(ctx);
+                errno = error;
+                return -1;
+            }
+            ctx->connect_phase = APN_CONNECT_PHASE_SSL;
+        }
+        /* fall through */
+        case APN_CONNECT_PHASE_SSL: {
+            int ret = apn_ssl_try_connect(ctx, want);
+            if (ret < 0) {
+                int error = errno;
+                apn_close(ctx);
+                errno = error;
+                return -1;
+            } else if (0 == ret) {
+                return 0;
+            }
+            ctx->connect_phase = APN_CONNECT_PHASE_NONE;
+            return 1;
+        }
+        default:
+            if (!ctx->ssl) {
+                errno = APN_ERR_NOT_CONNECTED;
+                return -1;
+            }
+            return 1;
+    }
+}
+
+static apn_return __apn_connect_begin(apn_ctx_t *const ctx, struct __apn_apple_server server) {
     apn_log(ctx, APN_LOG_LEVEL_INFO, "Connecting to %s:%d...", server.host, server.port);
 
     if (!ctx->pkcs12_file) {
@@ -571,24 +961,33 @@ static apn_return __apn_connect(apn_ctx_t *const ctx, struct __apn_apple_server
         }
     }
 
-    if (ctx->sock == -1) {
-        apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Resolving server hostname...");
+    apn_close(ctx);
 
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_flags = AI_NUMERICSERV;
+    apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Resolving server hostname...");
 
-        char str_port[6];
-        apn_snprintf(str_port, sizeof(str_port) - 1, "%d", server.port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
 
-        struct addrinfo *addrinfo = NULL;
-        if (0 != getaddrinfo(server.host, str_port, &hints, &addrinfo)) {
-            apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to resolve hostname: getaddrinfo() failed");
-            errno  = APN_ERR_UNABLE_TO_ESTABLISH_CONNECTION;
-            return APN_ERROR;
-        }
+    char str_port[6];
+    apn_snprintf(str_port, sizeof(str_port) - 1, "%d", server.port);
+
+    if (0 != getaddrinfo(server.host, str_port, &hints, &ctx->addrinfo)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to resolve hostname: getaddrinfo() failed");
+        ctx->addrinfo = NULL;
+        errno  = APN_ERR_UNABLE_TO_ESTABLISH_CONNECTION;
+        return APN_ERROR;
+    }
+    ctx->addrinfo_next = ctx->addrinfo;
+    return __apn_connect_next_address(ctx);
+}
+
+static apn_return __apn_connect_next_address(apn_ctx_t *const ctx) {
+    while (ctx->addrinfo_next) {
+        struct addrinfo *addrinfo = ctx->addrinfo_next;
+        ctx->addrinfo_next = addrinfo->ai_next;
 
         apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Creating socket...");
 
@@ -598,172 +997,78 @@ static apn_return __apn_connect(apn_ctx_t *const ctx, struct __apn_apple_server
             apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to create socket: socket() failed: %s (errno: %d)", error,
                       errno);
             free(error);
-            return APN_ERROR;
+            break;
         }
 
+        /* Connect and handshake are driven by poll(), so they never block other connections */
 #ifndef _WIN32
-        int sock_flags = fcntl(ctx->sock, F_GETFL, 0);
-        fcntl(ctx->sock, F_SETFL, sock_flags | O_NONBLOCK);
+        int sock_flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, sock_flags | O_NONBLOCK);
 #else
-        int sock_flags = 1;
-        ioctlsocket(ctx->sock, FIONBIO, (u_long *) &sock_flags);
+        u_long sock_flags = 1;
+        ioctlsocket(sock, FIONBIO, &sock_flags);
 #endif
         apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Socket successfully created");
 
-        uint8_t connected = 0;
-        while (addrinfo) {
-            char ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, (void *) &((struct sockaddr_in *) addrinfo->ai_addr)->sin_addr, ip, sizeof(ip));
-            apn_log(ctx, APN_LOG_LEVEL_INFO, "Trying to connect to %s...", ip);
-            if (connect(sock, addrinfo->ai_addr, addrinfo->ai_addrlen) < 0) {
-                char *error = apn_error_string(errno);
-                apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not to connect to: %s (errno: %d)", error, errno);
-                free(error);
-            } else {
-                connected = 1;
-                break;
-            }
-            addrinfo = addrinfo->ai_next;
-        }
-
-        freeaddrinfo(addrinfo);
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, (void *) &((struct sockaddr_in *) addrinfo->ai_addr)->sin_addr, ip, sizeof(ip));
+        apn_log(ctx, APN_LOG_LEVEL_INFO, "Trying to connect to %s...", ip);
 
-        if (!connected) {
-            errno = APN_ERR_UNABLE_TO_ESTABLISH_CONNECTION;
-            apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to establish connection");
-            apn_close(ctx);
-            return APN_ERROR;
+        ctx->connect_started = apn_time_ms();
+#ifndef _WIN32
+        if (0 == connect(sock, addrinfo->ai_addr, addrinfo->ai_addrlen) || EINPROGRESS == errno) {
+#else
+        if (0 == connect(sock, addrinfo->ai_addr, (int) addrinfo->ai_addrlen) || WSAEWOULDBLOCK == WSAGetLastError()) {
+#endif
+            ctx->sock = sock;
+            ctx->connection_id++;
+            ctx->connect_phase = APN_CONNECT_PHASE_TCP;
+            return APN_SUCCESS;
         }
 
-        apn_log(ctx, APN_LOG_LEVEL_INFO, "Connection has been established");
-        apn_log(ctx, APN_LOG_LEVEL_INFO, "Initializing SSL connection...");
-        ctx->sock = sock;
-
-        return apn_ssl_connect(ctx);
+        char *error = apn_error_string(errno);
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not to connect to: %s (errno: %d)", error, errno);
+        free(error);
+        APN_CLOSE_SOCKET(sock);
     }
-    return APN_SUCCESS;
-}
 
-static void __apn_parse_apns_error(char *apns_error, uint8_t *apns_error_code, uint32_t *id) {
-    uint8_t cmd = 0;
-    memcpy(&cmd, apns_error, sizeof(uint8_t));
-    apns_error += sizeof(uint8_t);
-    if (8 == cmd) {
-        uint8_t error_code = 0;
-        memcpy(&error_code, apns_error, sizeof(uint8_t));
-        apns_error += sizeof(uint8_t);
-        if (apns_error_code) {
-            *apns_error_code = error_code;
-        }
-        if (APN_APNS_ERR_INVALID_TOKEN == error_code && id) {
-            uint32_t token_id = 0;
-            memcpy(&token_id, apns_error, sizeof(uint32_t));
-            *id = ntohl(token_id);
-        }
-    }
+    freeaddrinfo(ctx->addrinfo);
+    ctx->addrinfo = NULL;
+    ctx->addrinfo_next = NULL;
+    ctx->connect_phase = APN_CONNECT_PHASE_NONE;
+
+    errno = APN_ERR_UNABLE_TO_ESTABLISH_CONNECTION;
+    apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to establish connection");
+    return APN_ERROR;
 }
 
-#define APN_MACRO_BREAK1 break;
-#define APN_MACRO_BREAK0
-#define APN_LOOP_BREAK(__loop) APN_MACRO_BREAK##__loop
-
-#define __API_SOCKET_READ(__ctx, __read_set, __buffer, __apple_error_flag, __loop, __current_tix, __invalid_tix) \
-    __apple_error_flag = 0; \
-    if (FD_ISSET(__ctx->sock, __read_set)) { \
-        apn_log(__ctx, APN_LOG_LEVEL_DEBUG, "Socket has data for read"); \
-        apn_log(__ctx, APN_LOG_LEVEL_DEBUG, "Reading data from a socket..."); \
-        int __bytes_read = apn_ssl_read(__ctx, __buffer, sizeof(__buffer)); \
-        if (0 < __bytes_read) { \
-            apn_log(__ctx, APN_LOG_LEVEL_DEBUG, "%d byte(s) has been read from a socket", __bytes_read); \
-            __apple_error_flag = 1; \
-            APN_LOOP_BREAK(__loop) \
-        } else { \
-            char *__error_str = apn_error_string(errno); \
-            apn_log(__ctx, APN_LOG_LEVEL_ERROR, "Unable to read data from a socket: %s (errno: %d)", __error_str, errno); \
-            free(__error_str); \
-            if(__invalid_tix) {\
-                *__invalid_tix = __current_tix;\
-            }\
-            return APN_ERROR; \
-        } \
-    }
-
-#define __APN_SELECT_ERROR(__returned_code) \
-    if(__returned_code < 0) { \
-        char *__error_str = apn_error_string(errno); \
-        apn_log(ctx, APN_LOG_LEVEL_ERROR, "select() failed: %s (errno: %d)", __error_str, errno); \
-        free(__error_str); \
-        return APN_ERROR;\
+static apn_return __apn_send_confirm_pending(apn_ctx_t *const ctx) {
+    if (!(ctx->options & APN_OPTION_CONFIRM_LATER)) {
+        return APN_SUCCESS;
     }
-
-static apn_return __apn_send_binary_message(const apn_ctx_t *const ctx,
-                                            apn_binary_message_t *const binary_message,
-                                            apn_array_t *tokens,
-                                            uint32_t token_start_index,
-                                            uint8_t *apple_error_code,
-                                            uint32_t *invalid_token_index) {
-
-    assert(token_start_index < apn_array_count(tokens));
-
-    fd_set write_set, read_set;
-    struct timeval timeout = {10, 0};
-    uint8_t apple_returned_error = 0;
-    int select_returned = 0;
-    char apple_error_str[6];
-
-    uint32_t i = token_start_index;
-    for (; i < apn_array_count(tokens); i++) {
-        const char *token = (const char *) apn_array_item_at_index(tokens, i);
-        apn_binary_message_set_id(binary_message, i);
-        apn_binary_message_set_token_hex(binary_message, token);
-
-        apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notificaton to device with token %s...", token);
-
-        do {
-            FD_ZERO(&write_set);
-            FD_ZERO(&read_set);
-            FD_SET(ctx->sock, &write_set);
-            FD_SET(ctx->sock, &read_set);
-            select_returned = select(ctx->sock + 1, &read_set, &write_set, NULL, &timeout);
-            apn_log(ctx, APN_LOG_LEVEL_DEBUG, "select() returned %d", select_returned);
-        } while (0 == select_returned || (0 > select_returned && EINTR == errno));
-
-        __APN_SELECT_ERROR(select_returned)
-        __API_SOCKET_READ(ctx, &read_set, apple_error_str, apple_returned_error, 1, i, invalid_token_index)
-
-        if (FD_ISSET(ctx->sock, &write_set)) {
-            apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Socket is ready for writing");
-            int bytes_written = apn_ssl_write(ctx, binary_message->message, binary_message->size);
-            if (0 >= bytes_written) {
-                char *error = apn_error_string(errno);
-                apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to write data to a socket: %s (errno: %d)", error, errno);
-                free(error);
-                return APN_ERROR;
-            }
-            apn_log(ctx, APN_LOG_LEVEL_DEBUG, "%d byte(s) has been written to a socket", bytes_written);
-        }
-        apn_log(ctx, APN_LOG_LEVEL_INFO, "Notification has been sent");
+    /* a failure of the previous send is returned instead of starting a new one, its invalid tokens
+     * have only been reported to the invalid token callback */
+    apn_engine_wait(ctx);
+    if (APN_ERROR == apn_engine_result(ctx, NULL)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notifications failed and were not confirmed, nothing is sent");
+        return APN_ERROR;
     }
+    return APN_SUCCESS;
+}
 
-    if (!apple_returned_error) {
-        timeout.tv_sec = 1;
-        do {
-            FD_ZERO(&read_set);
-            FD_SET(ctx->sock, &read_set);
-            select_returned = select(ctx->sock + 1, &read_set, NULL, NULL, &timeout);
-            apn_log(ctx, APN_LOG_LEVEL_DEBUG, "select() returned %d", select_returned);
-        } while (0 > select_returned && EINTR == errno);
-
-        __APN_SELECT_ERROR(select_returned)
-        __API_SOCKET_READ(ctx, &read_set, apple_error_str, apple_returned_error, 0, i, invalid_token_index)
+static apn_return __apn_send_wait(apn_ctx_t *const ctx, apn_array_t **invalid_tokens, apn_token_set_t **invalid_token_set) {
+    if (ctx->options & APN_OPTION_CONFIRM_LATER) {
+        apn_engine_wait_written(ctx);
+        if (apn_engine_busy(ctx)) {
+            return APN_SUCCESS;
+        }
+    } else {
+        apn_engine_wait(ctx);
     }
-    if (apple_returned_error) {
-        apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Parsing Apple response...", *apple_error_code);
-        __apn_parse_apns_error(apple_error_str, apple_error_code, invalid_token_index);
-        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Apple returned error code %d", *apple_error_code);
-        return APN_ERROR;
+    if (invalid_token_set) {
+        return apn_engine_result_token_set(ctx, invalid_token_set);
     }
-    return APN_SUCCESS;
+    return apn_engine_result(ctx, invalid_tokens);
 }
 
 static apn_binary_message_t *__apn_payload_to_binary_message(const apn_ctx_t *const ctx,
@@ -779,26 +1084,3 @@ static apn_binary_message_t *__apn_payload_to_binary_message(const apn_ctx_t *co
     apn_log(ctx, APN_LOG_LEVEL_INFO, "Binary message sucessfully created");
     return binary_message;
 }
-
-static int __apn_convert_apple_error(uint8_t apple_error_code) {
-    if (apple_error_code > 0) {
-        switch (apple_error_code) {
-            case APN_APNS_ERR_PROCESSING_ERROR:
-                return APN_ERR_PROCESSING_ERROR;
-            case APN_APNS_ERR_INVALID_PAYLOAD_SIZE:
-                return APN_ERR_INVALID_PAYLOAD_SIZE;
-            case APN_APNS_ERR_SERVICE_SHUTDOWN:
-                return APN_ERR_SERVICE_SHUTDOWN;
-            case APN_APNS_ERR_INVALID_TOKEN:
-            case APN_APNS_ERR_INVALID_TOKEN_SIZE:
-                return APN_ERR_TOKEN_INVALID;
-            default:
-                return APN_ERR_UNKNOWN;
-        }
-    }
-    return 0;
-}
-
-static void __apn_invalid_token_dtor(char *const token) {
-    free(token);
-}
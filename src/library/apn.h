@@ -26,7 +26,11 @@
 #include "apn_platform.h"
 #include "apn_binary_message.h"
 #include "apn_payload.h"
+#include "apn_payload_template.h"
 #include "apn_array.h"
+#include "apn_token_source.h"
+#include "apn_token_set.h"
+#include "apn_suppression.h"
 
 #include <openssl/ssl.h>
 
@@ -34,6 +38,47 @@
 extern "C" {
 #endif
 
+/**
+ * Default size of the buffer used to coalesce notification frames, in bytes.
+ * Equals to the maximum size of a TLS record.
+ */
+#define APN_SEND_BUFFER_SIZE_DEFAULT 16384
+
+/**
+ * Default size of the buffer which retains sent notification frames for replay, in bytes.
+ */
+#define APN_REPLAY_BUFFER_SIZE_DEFAULT (1024 * 1024)
+
+/**
+ * Default time after which a sent notification is considered delivered if no error was reported, in milliseconds.
+ */
+#define APN_REPLAY_WINDOW_DEFAULT 5000
+
+/**
+ * Default time to wait for an error response after the last notification was written, in milliseconds.
+ */
+#define APN_DRAIN_TIMEOUT_DEFAULT 1000
+
+/**
+ * Default delay before reconnecting after the connection was dropped, in milliseconds.
+ */
+#define APN_RECONNECT_DELAY_DEFAULT 1000
+
+/**
+ * Default upper limit of the reconnect delay, in milliseconds.
+ */
+#define APN_RECONNECT_MAX_DELAY_DEFAULT 60000
+
+/**
+ * Default number of reconnect attempts before sending fails.
+ */
+#define APN_RECONNECT_MAX_ATTEMPTS_DEFAULT 10
+
+/**
+ * Default time to wait for data from Apple Feedback Service, in milliseconds.
+ */
+#define APN_FEEDBACK_TIMEOUT_DEFAULT 3000
+
 /** Connection mode */
 typedef enum __apn_connection_mode {
     APN_MODE_PRODUCTION = 0,
@@ -50,7 +95,19 @@ enum __apn_option {
     /**
      * Print log messages to standard error
      */
-    APN_OPTION_LOG_STDERR = 1 << 2
+    APN_OPTION_LOG_STDERR = 1 << 2,
+    /**
+     * Size the wait for an error response after the last notification from the measured round-trip time
+     * and the amount of unacknowledged data instead of always waiting for the drain timeout
+     */
+    APN_OPTION_ADAPTIVE_DRAIN = 1 << 3,
+    /**
+     * apn_send() returns as soon as all notifications are written. The wait for an error response is finished
+     * by apn_send_confirm() or by the next apn_send() call, the array of tokens must stay valid until then.
+     * If the unconfirmed send failed, the next apn_send() returns its error and sends nothing; its invalid
+     * tokens only reach the invalid token callback
+     */
+    APN_OPTION_CONFIRM_LATER = 1 << 4
 };
 
 typedef enum __apn_errors {
@@ -126,7 +183,16 @@ typedef enum __apn_errors {
     APN_ERR_SSL_INVALID_CERTIFICATE,
 
     /** Unknown error */
-    APN_ERR_UNKNOWN
+    APN_ERR_UNKNOWN,
+
+    /** File is not in the expected format or is truncated */
+    APN_ERR_FILE_FORMAT_INVALID,
+
+    /** Payload template contains a malformed or misplaced placeholder */
+    APN_ERR_PAYLOAD_TEMPLATE_INVALID,
+
+    /** Raw JSON payload is malformed or has no `aps` dictionary */
+    APN_ERR_PAYLOAD_JSON_INVALID
 
 } apn_errors;
 
@@ -142,6 +208,22 @@ typedef enum __apn_log_levels {
 typedef struct __apn_ctx_t apn_ctx_t;
 
 typedef void (*invalid_token_callback)(const char * const token, uint32_t index);
+
+/**
+ * Single notification of a batch, see ::apn_send_batch()
+ */
+typedef struct __apn_batch_item_t {
+    /** Device token (hex). Can be NULL if `binary_message` already has a token */
+    const char *token;
+    /** Notification payload. Ignored if `binary_message` or `payload_template` is set */
+    const apn_payload_t *payload;
+    /** Pre-built binary message, see ::apn_create_binary_message(). Can be NULL */
+    apn_binary_message_t *binary_message;
+    /** Payload template, rendered with `values` and `token`. Ignored if `binary_message` is set. Can be NULL */
+    const apn_payload_template_t *payload_template;
+    /** Placeholder values of `payload_template`, see ::apn_payload_template_placeholder_count() */
+    const apn_payload_template_value_t *values;
+} apn_batch_item_t;
 typedef void (*log_callback)(apn_log_levels level, const char * const log_message, uint32_t message_len);
 
 __apn_export__ apn_return apn_library_init()
@@ -305,6 +387,240 @@ __apn_export__ apn_return apn_set_pkcs12_file(apn_ctx_t *const ctx, const char *
 __apn_export__ void apn_set_behavior(apn_ctx_t * const ctx, uint32_t options)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Sets the size of the buffer which is used to coalesce notification frames.
+ *
+ * ::apn_send() packs as many frames as fit into the buffer and writes them to the connection
+ * with a single call, so a lot of notifications share one TLS record and one system call.
+ * Error responses from Apple are checked between writes.
+ *
+ * Default size is ::APN_SEND_BUFFER_SIZE_DEFAULT. Pass 0 to write each notification separately.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] size - Size of the buffer in bytes.
+ */
+__apn_export__ void apn_set_send_buffer_size(apn_ctx_t * const ctx, uint32_t size)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the size of the buffer which is used to coalesce notification frames.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_send_buffer_size(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the size of the buffer which retains already sent notification frames.
+ *
+ * When Apple reports an error, all notifications sent after the failed one are dropped.
+ * Retained frames are sent again byte for byte after reconnecting, without encoding them again.
+ * Notifications which no longer fit into the buffer are encoded again.
+ *
+ * Default size is ::APN_REPLAY_BUFFER_SIZE_DEFAULT. Pass 0 to disable retention.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] size - Size of the buffer in bytes.
+ */
+__apn_export__ void apn_set_replay_buffer_size(apn_ctx_t * const ctx, uint32_t size)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the size of the buffer which retains sent notification frames.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_replay_buffer_size(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the time after which a sent notification is considered delivered if Apple did not report an error,
+ * and its frame is released.
+ *
+ * Default is ::APN_REPLAY_WINDOW_DEFAULT.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] window - Time in milliseconds.
+ */
+__apn_export__ void apn_set_replay_window(apn_ctx_t * const ctx, uint32_t window)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the time after which a sent notification is considered delivered.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_replay_window(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the time to wait for an error response after the last notification was written.
+ *
+ * With ::APN_OPTION_ADAPTIVE_DRAIN this is the upper limit of the adaptive wait.
+ * Default is ::APN_DRAIN_TIMEOUT_DEFAULT.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] timeout - Time in milliseconds.
+ */
+__apn_export__ void apn_set_drain_timeout(apn_ctx_t * const ctx, uint32_t timeout)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the time to wait for an error response after the last notification was written.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_drain_timeout(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the delay before reconnecting after the connection was dropped.
+ *
+ * The delay doubles with each failed attempt up to ::apn_reconnect_max_delay() and is randomized
+ * between a half and the full value, so connections dropped at once do not reconnect in lockstep.
+ * Reconnecting never blocks: other connections keep sending meanwhile.
+ *
+ * Default is ::APN_RECONNECT_DELAY_DEFAULT.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] delay - Time in milliseconds.
+ */
+__apn_export__ void apn_set_reconnect_delay(apn_ctx_t * const ctx, uint32_t delay)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the delay before reconnecting after the connection was dropped.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_reconnect_delay(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the upper limit of the reconnect delay.
+ *
+ * Default is ::APN_RECONNECT_MAX_DELAY_DEFAULT.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] delay - Time in milliseconds.
+ */
+__apn_export__ void apn_set_reconnect_max_delay(apn_ctx_t * const ctx, uint32_t delay)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the upper limit of the reconnect delay.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_reconnect_max_delay(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the number of reconnect attempts without a successful write before sending fails.
+ *
+ * Default is ::APN_RECONNECT_MAX_ATTEMPTS_DEFAULT. Pass 0 to retry forever.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] attempts - Number of attempts.
+ */
+__apn_export__ void apn_set_reconnect_max_attempts(apn_ctx_t * const ctx, uint32_t attempts)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the number of reconnect attempts before sending fails.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_reconnect_max_attempts(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the time to wait for data from Apple Feedback Service.
+ *
+ * Default is ::APN_FEEDBACK_TIMEOUT_DEFAULT.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] timeout - Time in milliseconds.
+ */
+__apn_export__ void apn_set_feedback_timeout(apn_ctx_t * const ctx, uint32_t timeout)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the time to wait for data from Apple Feedback Service.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_feedback_timeout(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Limits how fast notifications are written to the connection.
+ *
+ * Frames are paced by token buckets which hold 100 ms worth of traffic, so short bursts pass
+ * but the sustained rate does not exceed the limits. Default is no limit.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] notifications_per_second - Maximum number of notifications per second, 0 for no limit.
+ * @param[in] bytes_per_second - Maximum number of bytes per second, 0 for no limit.
+ */
+__apn_export__ void apn_set_rate_limit(apn_ctx_t * const ctx, uint32_t notifications_per_second, uint32_t bytes_per_second)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the maximum number of notifications per second, 0 if not limited.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_rate_limit_notifications(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the maximum number of bytes per second, 0 if not limited.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_rate_limit_bytes(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Attaches a list of tokens which are known to be invalid. Notifications to these tokens are skipped
+ * before they are written, tokens rejected by Apple and tokens returned by the feedback service are
+ * added to the list. The list is not copied and must outlive the context, one list can be shared by
+ * contexts driven by the same thread. Default is no list.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure, NULL to detach the list.
+ */
+__apn_export__ void apn_set_suppression_list(apn_ctx_t * const ctx, apn_suppression_t * const suppression)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the attached suppression list, NULL if there is none.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ apn_suppression_t *apn_suppression_list(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets the maximum amount of written but not yet acknowledged data. Writing pauses while the socket
+ * holds more. Supported where the TCP stack reports the size of its send queue (Linux), ignored elsewhere.
+ * Default is no limit.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] size - Size in bytes, 0 for no limit.
+ */
+__apn_export__ void apn_set_inflight_limit(apn_ctx_t * const ctx, uint32_t size)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns the maximum amount of written but not yet acknowledged data, 0 if not limited.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_inflight_limit(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
 /**
  * Returns current behavior.
  *
@@ -365,7 +681,8 @@ __apn_export__ const char *apn_private_key_pass(const apn_ctx_t * const ctx)
  * Sends push notification.
  *
  * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
- * @param[in] payload - Pointer to `payload` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
  * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string.
  *
  * @return
@@ -375,6 +692,203 @@ __apn_export__ const char *apn_private_key_pass(const apn_ctx_t * const ctx)
 __apn_export__ apn_return apn_send(apn_ctx_t * const ctx, const apn_payload_t *payload, apn_array_t *tokens, apn_array_t **invalid_tokens)
         __apn_attribute_nonnull__((1,2,3));
 
+/**
+ * Starts sending a push notification to the devices without blocking.
+ *
+ * The notification is sent while the connection is processed by an event loop (see apn_loop.h).
+ * `payload` may be freed as soon as this function returns, `tokens` must stay
+ * unchanged until the send is finished.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Array of device tokens. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_async(apn_ctx_t * const ctx, const apn_payload_t *payload, apn_array_t *tokens)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Sends push notification to devices of a token set.
+ *
+ * Index of a token in the set is used as notification identifier.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Set of device tokens. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Set of invalid tokens. The set should be freed - call ::apn_token_set_free()
+ * function for it. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_token_set(apn_ctx_t * const ctx, const apn_payload_t *payload, const apn_token_set_t *tokens,
+                                             apn_token_set_t **invalid_tokens)
+        __apn_attribute_nonnull__((1,2,3));
+
+/**
+ * Starts sending push notification to devices of a token set without blocking, see ::apn_send_async().
+ * `tokens` must stay unchanged until the send is finished.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Set of device tokens. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_token_set_async(apn_ctx_t * const ctx, const apn_payload_t *payload, const apn_token_set_t *tokens)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Sends push notification to devices read lazily from a token source.
+ *
+ * Sending starts as soon as the first token is read and memory use does not depend on the number of tokens.
+ * Index of a token in the source is used as notification identifier.
+ * The call takes ownership of `tokens`, which is freed with ::apn_token_source_free() when sending finishes
+ * or fails to start.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Pointer to an initialized token source. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_source(apn_ctx_t * const ctx, const apn_payload_t *payload, const apn_token_source_t *tokens,
+                                          apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1,2,3));
+
+/**
+ * Starts sending push notification to devices read from a token source without blocking,
+ * see ::apn_send_source() and ::apn_send_async().
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Pointer to an initialized token source. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_source_async(apn_ctx_t * const ctx, const apn_payload_t *payload, const apn_token_source_t *tokens)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Sends a batch of notifications, each with its own device token and payload, payload template
+ * or pre-built binary message, over a single connection in one pipelined pass.
+ *
+ * Notifications which share a payload should be consecutive: the binary message is built once
+ * for a run of items with the same `payload` pointer. Items with a template are rendered
+ * into a reused frame buffer, see ::apn_payload_template_write(). Index of an item is used as notification
+ * identifier and reported to the invalid token callback.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] items - Array of notifications. Cannot be NULL.
+ * @param[in] count - Number of notifications.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_batch(apn_ctx_t * const ctx, const apn_batch_item_t *items, uint32_t count, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Starts sending a batch of notifications without blocking, see ::apn_send_batch() and ::apn_send_async().
+ *
+ * `items`, their payloads and binary messages must stay unchanged until the send is finished.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] items - Array of notifications. Cannot be NULL.
+ * @param[in] count - Number of notifications.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_batch_async(apn_ctx_t * const ctx, const apn_batch_item_t *items, uint32_t count)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Returns 1 if a notification started with ::apn_send_async() is still being sent.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ uint8_t apn_send_in_progress(const apn_ctx_t * const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns result of the last notification started with ::apn_send_async().
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_result(apn_ctx_t * const ctx, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Same as ::apn_send_result(), returning invalid tokens as a set.
+ * Tokens which are not valid hex are only reported to the invalid token callback.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Set of invalid tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_result_token_set(apn_ctx_t * const ctx, apn_token_set_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Waits for the outcome of the last notification sent with ::APN_OPTION_CONFIRM_LATER behavior.
+ * An outcome which is not confirmed is collected by the next ::apn_send(): a failure is returned
+ * from it instead of sending, invalid tokens are only reported to the invalid token callback.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success or if nothing was pending.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_confirm(apn_ctx_t * const ctx, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Same as ::apn_send_confirm(), returning invalid tokens as a set.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Set of invalid tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success or if nothing was pending.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_send_confirm_token_set(apn_ctx_t * const ctx, apn_token_set_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
 /**
  * Opens Apple Push Feedback Service connection.
  *
@@ -401,6 +915,20 @@ __apn_export__ apn_return apn_feedback_connect(apn_ctx_t * const ctx)
 __apn_export__ apn_return apn_feedback(const apn_ctx_t * const ctx, apn_array_t **tokens)
         __apn_attribute_nonnull__((1, 2));
 
+/**
+ * Returns set of device tokens which no longer exists.
+ *
+ * @param[in] ctx - Pointer to an initialized `::apn_ctx` structure. Cannot be NULL.
+ * @param[in, out] tokens - Pointer to a device token set. The set should be freed - call ::apn_token_set_free()
+ * function for it.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_feedback_token_set(const apn_ctx_t * const ctx, apn_token_set_t **tokens)
+        __apn_attribute_nonnull__((1, 2));
+
 
 __apn_export__ char *apn_error_string(int err_code);
 
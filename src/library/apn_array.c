@@ -22,35 +22,47 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 
 #include "apn_array_private.h"
 #include "apn_memory.h"
-#include "apn_memory.h"
+
+/** Size of a block arena items are allocated from, larger items take a block of their own */
+#define APN_ARRAY_BLOCK_SIZE 65536
+#define APN_ARRAY_ALIGNMENT 8
+/** Arena allocations are prefixed with their size, so arena arrays can be copied */
+#define APN_ARRAY_ALLOC_HEADER_SIZE APN_ARRAY_ALIGNMENT
+#define APN_ARRAY_BLOCK_HEADER_SIZE ((sizeof(apn_array_block_t) + APN_ARRAY_ALIGNMENT - 1) & ~((size_t) APN_ARRAY_ALIGNMENT - 1))
+
+static apn_array_t *__apn_array_create(uint32_t min_size, uint32_t item_size);
+static apn_return __apn_array_grow(apn_array_t *const array, uint32_t count);
 
 apn_array_t *apn_array_init(uint32_t minsize, apn_array_dtor dtor, apn_array_ctor ctor) {
-    apn_array_t *array = NULL;
-    assert(minsize < (UINT32_MAX - 1));
-    array = malloc(sizeof(apn_array_t));
-    if (!array) {
-        errno = ENOMEM;
-        return NULL;
+    apn_array_t *array = __apn_array_create(minsize, 0);
+    if (array) {
+        array->dtor = dtor;
+        array->ctor = ctor;
     }
-    array->items = malloc(sizeof(void *) * minsize);
-    if (!array->items) {
-        errno = ENOMEM;
-        free(array);
-        return NULL;
+    return array;
+}
+
+apn_array_t *apn_array_init_arena(uint32_t min_size) {
+    apn_array_t *array = __apn_array_create(min_size, 0);
+    if (array) {
+        array->arena = 1;
     }
-    array->allocated_size = minsize;
-    array->dtor = dtor;
-    array->ctor = ctor;
-    array->count = 0;
     return array;
 }
 
+apn_array_t *apn_array_init_inline(uint32_t min_size, uint32_t item_size) {
+    assert(item_size > 0);
+    return __apn_array_create(min_size, item_size);
+}
+
 void apn_array_free(apn_array_t *array) {
+    apn_array_block_t *block = NULL;
     uint32_t i = 0;
     if (!array) {
         return;
@@ -63,25 +75,132 @@ void apn_array_free(apn_array_t *array) {
         }
         free(array->items);
     }
+    free(array->records);
+    while (array->blocks) {
+        block = array->blocks;
+        array->blocks = block->next;
+        free(block);
+    }
     free(array);
 }
 
 apn_return apn_array_insert(apn_array_t *array, void *item) {
-    void **new_items = NULL;
     assert(array);
-    assert((array->count + 1) < UINT32_MAX);
 
-    if (array->count == array->allocated_size) {
-        new_items = apn_mem_realloc(array->items, sizeof(void *) * (array->allocated_size * 2));
-        if (!new_items) {
+    if (APN_ERROR == __apn_array_grow(array, 1)) {
+        return APN_ERROR;
+    }
+    if (array->item_size) {
+        memcpy(array->records + (size_t) array->count * array->item_size, item, array->item_size);
+    } else {
+        array->items[array->count] = item;
+    }
+    array->count++;
+    return APN_SUCCESS;
+}
+
+apn_return apn_array_insert_many(apn_array_t *array, void *const *items, uint32_t count) {
+    uint32_t i = 0;
+    assert(array);
+    assert(items);
+
+    if (APN_ERROR == __apn_array_grow(array, count)) {
+        return APN_ERROR;
+    }
+    if (array->item_size) {
+        for (; i < count; i++) {
+            memcpy(array->records + (size_t) (array->count + i) * array->item_size, items[i], array->item_size);
+        }
+    } else if (count > 0) {
+        memcpy(array->items + array->count, items, (size_t) count * sizeof(void *));
+    }
+    array->count += count;
+    return APN_SUCCESS;
+}
+
+apn_return apn_array_reserve(apn_array_t *array, uint32_t capacity) {
+    size_t item_size = 0;
+    void *memory = NULL;
+    assert(array);
+
+    if (capacity <= array->allocated_size) {
+        return APN_SUCCESS;
+    }
+    item_size = array->item_size ? array->item_size : sizeof(void *);
+    if ((uint64_t) capacity * item_size > SIZE_MAX) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    memory = apn_mem_realloc(array->item_size ? (void *) array->records : (void *) array->items, (size_t) capacity * item_size);
+    if (!memory) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    if (array->item_size) {
+        array->records = memory;
+    } else {
+        array->items = memory;
+    }
+    array->allocated_size = capacity;
+    return APN_SUCCESS;
+}
+
+void *apn_array_alloc(apn_array_t *array, size_t size) {
+    apn_array_block_t *block = NULL;
+    size_t needed = 0;
+    uint8_t *memory = NULL;
+    assert(array);
+    assert(array->arena);
+
+    if (!array->arena) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (size > SIZE_MAX - APN_ARRAY_ALLOC_HEADER_SIZE - APN_ARRAY_BLOCK_HEADER_SIZE - APN_ARRAY_ALIGNMENT) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    needed = (APN_ARRAY_ALLOC_HEADER_SIZE + size + APN_ARRAY_ALIGNMENT - 1) & ~((size_t) APN_ARRAY_ALIGNMENT - 1);
+
+    block = array->blocks;
+    if (!block || block->size - block->used < needed) {
+        size_t block_size = (needed > APN_ARRAY_BLOCK_SIZE - APN_ARRAY_BLOCK_HEADER_SIZE) ? needed : APN_ARRAY_BLOCK_SIZE - APN_ARRAY_BLOCK_HEADER_SIZE;
+        block = malloc(APN_ARRAY_BLOCK_HEADER_SIZE + block_size);
+        if (!block) {
             errno = ENOMEM;
-            return APN_ERROR;
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        /* an oversized block goes behind the current one, so the rest of the current one is still used */
+        if (array->blocks && needed > APN_ARRAY_BLOCK_SIZE - APN_ARRAY_BLOCK_HEADER_SIZE) {
+            block->next = array->blocks->next;
+            array->blocks->next = block;
+        } else {
+            block->next = array->blocks;
+            array->blocks = block;
         }
-        array->items = new_items;
-        array->allocated_size *= 2;
     }
-    array->items[array->count] = item;
-    array->count++;
+
+    memory = (uint8_t *) block + APN_ARRAY_BLOCK_HEADER_SIZE + block->used;
+    block->used += needed;
+    memcpy(memory, &size, sizeof(size_t));
+    return memory + APN_ARRAY_ALLOC_HEADER_SIZE;
+}
+
+apn_return apn_array_insert_copy(apn_array_t *array, const void *data, size_t size) {
+    void *item = NULL;
+    assert(array);
+    assert(data);
+
+    if (APN_ERROR == __apn_array_grow(array, 1)) {
+        return APN_ERROR;
+    }
+    if (NULL == (item = apn_array_alloc(array, size))) {
+        return APN_ERROR;
+    }
+    memcpy(item, data, size);
+    array->items[array->count++] = item;
     return APN_SUCCESS;
 }
 
@@ -91,34 +210,29 @@ uint32_t apn_array_count(const apn_array_t *const array) {
 }
 
 apn_return apn_array_insert_at_index(apn_array_t *const array, uint32_t index, void *item) {
-    void **new_items = NULL;
     void *data = NULL;
     assert(array);
     assert(index < array->count);
 
-    if (array->count == array->allocated_size) {
-        new_items = (void **) apn_mem_realloc(array->items, sizeof(void *) * (array->allocated_size * 2));
-        if (!new_items) {
-            errno = ENOMEM;
-            return APN_ERROR;
-        }
-        array->items = new_items;
-        array->allocated_size *= 2;
+    if (array->item_size) {
+        memcpy(array->records + (size_t) index * array->item_size, item, array->item_size);
+        return APN_SUCCESS;
     }
 
     data = array->items[index];
     if (array->dtor && data) {
         array->dtor(data);
     }
-
     array->items[index] = item;
-    array->count++;
     return APN_SUCCESS;
 }
 
 void *apn_array_item_at_index(const apn_array_t *const array, uint32_t index) {
     assert(array);
     assert(index < array->count);
+    if (array->item_size) {
+        return array->records + (size_t) index * array->item_size;
+    }
     return array->items[index];
 }
 
@@ -127,6 +241,10 @@ void apn_array_remove(apn_array_t *const array, uint32_t index) {
     assert(array);
     assert(index < array->count);
 
+    if (array->item_size) {
+        memset(array->records + (size_t) index * array->item_size, 0, array->item_size);
+        return;
+    }
     data = array->items[index];
     if (data && array->dtor) {
         array->dtor(data);
@@ -134,28 +252,112 @@ void apn_array_remove(apn_array_t *const array, uint32_t index) {
     array->items[index] = NULL;
 }
 
+void apn_array_clear(apn_array_t *const array) {
+    apn_array_block_t *block = NULL;
+    apn_array_block_t *kept = NULL;
+    uint32_t i = 0;
+    assert(array);
+
+    if (array->items && array->dtor) {
+        for (; i < array->count; i++) {
+            array->dtor(array->items[i]);
+        }
+    }
+    array->count = 0;
+
+    /* oversized blocks are released, one regular block is kept */
+    while (array->blocks) {
+        block = array->blocks;
+        array->blocks = block->next;
+        if (!kept && APN_ARRAY_BLOCK_SIZE - APN_ARRAY_BLOCK_HEADER_SIZE == block->size) {
+            kept = block;
+        } else {
+            free(block);
+        }
+    }
+    if (kept) {
+        kept->next = NULL;
+        kept->used = 0;
+        array->blocks = kept;
+    }
+}
+
 apn_array_t *apn_array_copy(const apn_array_t *const array) {
     apn_array_t *dst = NULL;
     uint32_t i = 0;
 
     assert(array);
-    dst = apn_array_init(array->allocated_size, array->dtor, array->ctor);
+    dst = __apn_array_create(array->count, array->item_size);
     if (!dst) {
         errno = ENOMEM;
         return NULL;
     }
+    dst->dtor = array->dtor;
+    dst->ctor = array->ctor;
+    dst->arena = array->arena;
 
-    if (array->items) {
-        for (; i < array->count; i++) {
-            void *item = array->items[i];
+    if (array->item_size) {
+        if (array->count > 0) {
+            memcpy(dst->records, array->records, (size_t) array->count * array->item_size);
+        }
+        dst->count = array->count;
+        return dst;
+    }
+
+    for (; i < array->count; i++) {
+        void *item = array->items[i];
+        apn_return ret = APN_SUCCESS;
+        if (array->arena) {
+            size_t size = 0;
+            if (item) {
+                memcpy(&size, (uint8_t *) item - APN_ARRAY_ALLOC_HEADER_SIZE, sizeof(size_t));
+                ret = apn_array_insert_copy(dst, item, size);
+            } else {
+                /* dst was created with room for all items */
+                dst->items[dst->count++] = NULL;
+            }
+        } else {
             if (array->ctor) {
                 item = array->ctor(item);
             }
-            if (!apn_array_insert(dst, item)) {
-                apn_array_free(dst);
-                return NULL;
-            }
+            ret = apn_array_insert(dst, item);
+        }
+        if (APN_ERROR == ret) {
+            apn_array_free(dst);
+            return NULL;
         }
     }
     return dst;
 }
+
+static apn_array_t *__apn_array_create(uint32_t min_size, uint32_t item_size) {
+    apn_array_t *array = NULL;
+    assert(min_size < (UINT32_MAX - 1));
+    array = calloc(1, sizeof(apn_array_t));
+    if (!array) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    array->item_size = item_size;
+    if (APN_ERROR == apn_array_reserve(array, min_size ? min_size : 1)) {
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+static apn_return __apn_array_grow(apn_array_t *const array, uint32_t count) {
+    uint32_t capacity = array->allocated_size;
+
+    if (count <= array->allocated_size - array->count) {
+        return APN_SUCCESS;
+    }
+    if (count > UINT32_MAX - 1 - array->count) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    while (capacity < array->count + count) {
+        capacity = (capacity > UINT32_MAX / 2) ? UINT32_MAX - 1 : capacity * 2;
+    }
+    return apn_array_reserve(array, capacity);
+}
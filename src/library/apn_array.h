@@ -25,6 +25,8 @@
 
 #include "apn_platform.h"
 
+#include <stddef.h>
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -37,6 +39,21 @@ typedef struct __apn_array_t apn_array_t;
 __apn_export__ apn_array_t *apn_array_init(uint32_t min_size, apn_array_dtor dtor, apn_array_ctor ctor)
         __apn_attribute_warn_unused_result__;
 
+/**
+ * Creates an array in arena mode: items are allocated with ::apn_array_alloc() or ::apn_array_insert_copy()
+ * from large blocks owned by the array, and are freed all at once with the array.
+ */
+__apn_export__ apn_array_t *apn_array_init_arena(uint32_t min_size)
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Creates an array of fixed-size records stored in place. ::apn_array_insert() copies `item_size` bytes
+ * from the item pointer and ::apn_array_item_at_index() returns a pointer into the array, which is valid
+ * until the array grows.
+ */
+__apn_export__ apn_array_t *apn_array_init_inline(uint32_t min_size, uint32_t item_size)
+        __apn_attribute_warn_unused_result__;
+
 __apn_export__ void apn_array_free(apn_array_t *array);
 
 __apn_export__ apn_array_t *apn_array_copy(const apn_array_t * const array)
@@ -46,6 +63,29 @@ __apn_export__ apn_array_t *apn_array_copy(const apn_array_t * const array)
 __apn_export__ apn_return apn_array_insert(apn_array_t *array, void *item)
         __apn_attribute_nonnull__((1,2));
 
+__apn_export__ apn_return apn_array_insert_many(apn_array_t *array, void *const *items, uint32_t count)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Allocates memory for at least `capacity` items.
+ */
+__apn_export__ apn_return apn_array_reserve(apn_array_t *array, uint32_t capacity)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Allocates `size` bytes from the arena of an array created with ::apn_array_init_arena().
+ * The memory is not inserted and is freed with the array.
+ */
+__apn_export__ void *apn_array_alloc(apn_array_t *array, size_t size)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Copies `size` bytes of `data` to the arena of an array created with ::apn_array_init_arena() and inserts the copy.
+ */
+__apn_export__ apn_return apn_array_insert_copy(apn_array_t *array, const void *data, size_t size)
+        __apn_attribute_nonnull__((1,2));
+
 __apn_export__ uint32_t apn_array_count(const apn_array_t * const array)
         __apn_attribute_nonnull__((1));
 
@@ -58,6 +98,13 @@ __apn_export__ void * apn_array_item_at_index(const apn_array_t * const array, u
 __apn_export__ void apn_array_remove(apn_array_t * const array, uint32_t index)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Removes all items and keeps the allocated storage. An arena array keeps one block of its arena
+ * and reuses it, so an array which is cleared and refilled does not allocate memory again.
+ */
+__apn_export__ void apn_array_clear(apn_array_t * const array)
+        __apn_attribute_nonnull__((1));
+
 #ifdef	__cplusplus
 }
 #endif
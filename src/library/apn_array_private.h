@@ -30,12 +30,24 @@
 extern "C" {
 #endif
 
+typedef struct __apn_array_block_t {
+    struct __apn_array_block_t *next;
+    size_t size;
+    size_t used;
+} apn_array_block_t;
+
 struct __apn_array_t {
     uint32_t count;
     uint32_t allocated_size;
     apn_array_dtor dtor;
     apn_array_ctor ctor;
     void **items;
+    /** Size of a record stored in place in `records`, 0 if the array keeps pointers in `items` */
+    uint32_t item_size;
+    uint8_t *records;
+    /** Arena of the array, newest block first */
+    apn_array_block_t *blocks;
+    uint8_t arena;
 };
 
 #ifdef	__cplusplus
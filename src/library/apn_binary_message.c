@@ -36,32 +36,27 @@
 #include "apn_paload_private.h"
 #include "apn_tokens.h"
 
-static apn_return __apn_binary_message_set_token(apn_binary_message_t *const binary_message,
-                                                 const uint8_t *const token_binary, const char *const token_hex);
+static uint8_t *__apn_binary_message_item(uint8_t *buffer, uint8_t item_id, uint16_t size);
 
 apn_binary_message_t *apn_binary_message_init(uint32_t size) {
-    apn_binary_message_t *binary_message = malloc(sizeof(apn_binary_message_t));
+    /* the frame follows the structure in the same block */
+    apn_binary_message_t *binary_message = malloc(sizeof(apn_binary_message_t) + size);
     if (!binary_message) {
         errno = ENOMEM;
         return NULL;
     }
-    binary_message->message = malloc(size);
-    if (!binary_message->message) {
-        errno = ENOMEM;
-        free(binary_message);
-        return NULL;
-    };
+    binary_message->message = (uint8_t *) (binary_message + 1);
     binary_message->size = size;
+    binary_message->payload_size = 0;
     binary_message->id_position = NULL;
     binary_message->token_position = NULL;
     binary_message->token_hex = NULL;
+    binary_message->token_hex_buffer[0] = '\0';
     return binary_message;
 }
 
 void apn_binary_message_free(apn_binary_message_t *binary_message) {
     if (binary_message) {
-        apn_mem_free(binary_message->message);
-        apn_mem_free(binary_message->token_hex);
         free(binary_message);
     }
 }
@@ -74,18 +69,47 @@ void apn_binary_message_set_id(const apn_binary_message_t *const binary_message,
 }
 
 void apn_binary_message_set_token(apn_binary_message_t *const binary_message, const uint8_t *const token_binary) {
+    assert(binary_message);
     assert(token_binary);
-    char *token_hex = apn_token_binary_to_hex(token_binary);
-    __apn_binary_message_set_token(binary_message, token_binary, token_hex);
-    free(token_hex);
+    if (binary_message->token_position) {
+        memcpy(binary_message->token_position, token_binary, APN_TOKEN_BINARY_SIZE);
+        apn_token_hex_encode(token_binary, binary_message->token_hex_buffer);
+        binary_message->token_hex = binary_message->token_hex_buffer;
+    }
 }
 
 apn_return apn_binary_message_set_token_hex(apn_binary_message_t *const binary_message, const char *const token_hex) {
+    assert(binary_message);
     assert(token_hex);
-    uint8_t *token_binary = apn_token_hex_to_binary(token_hex);
-    apn_return ret = __apn_binary_message_set_token(binary_message, token_binary, token_hex);
-    free(token_binary);
-    return ret;
+    if (!binary_message->token_position) {
+        if (!apn_hex_token_is_valid(token_hex)) {
+            errno = APN_ERR_TOKEN_INVALID;
+            return APN_ERROR;
+        }
+        return APN_SUCCESS;
+    }
+    if (APN_ERROR == apn_binary_message_patch_token_hex(binary_message, token_hex)) {
+        return APN_ERROR;
+    }
+    /* the caller may free its string, keep a copy */
+    memcpy(binary_message->token_hex_buffer, token_hex, APN_TOKEN_LENGTH + 1);
+    binary_message->token_hex = binary_message->token_hex_buffer;
+    return APN_SUCCESS;
+}
+
+apn_return apn_binary_message_patch_token_hex(apn_binary_message_t *const binary_message, const char *const token_hex) {
+    uint8_t token_binary[APN_TOKEN_BINARY_SIZE];
+    assert(binary_message);
+    assert(token_hex);
+    assert(binary_message->token_position);
+
+    /* decoded on the stack, so an invalid token leaves the frame untouched */
+    if (APN_ERROR == apn_token_hex_decode(token_hex, token_binary)) {
+        return APN_ERROR;
+    }
+    memcpy(binary_message->token_position, token_binary, APN_TOKEN_BINARY_SIZE);
+    binary_message->token_hex = token_hex;
+    return APN_SUCCESS;
 }
 
 const char *apn_binary_message_token_hex(apn_binary_message_t *const binary_message) {
@@ -94,118 +118,107 @@ const char *apn_binary_message_token_hex(apn_binary_message_t *const binary_mess
 }
 
 apn_binary_message_t *apn_create_binary_message(const apn_payload_t *const payload) {
-    char *json = NULL;
-    size_t json_size = 0;
-    uint8_t *frame = NULL;
-    uint8_t *frame_ref = NULL;
-    uint32_t frame_size = 0;
-    uint32_t id_n = 0; // ID (network ordered)
-    uint32_t expiry_n = htonl((uint32_t) payload->expiry); // expiry time (network ordered)
-    uint8_t item_id = 1; // Item ID
-    uint16_t item_data_size_n = 0; // Item data size (network ordered)
-    uint8_t *message_ref = NULL;
-    uint32_t frame_size_n; // Frame size (network ordered)
-    apn_binary_message_t *binary_message;
-
-    json = apn_create_json_document_from_payload(payload);
-    if (!json) {
+    uint8_t buffer[APN_PAYLOAD_MAX_FRAME_SIZE];
+    apn_binary_message_t scratch;
+    const apn_binary_message_t *frame = NULL;
+    apn_binary_message_t *binary_message = NULL;
+    assert(payload);
+
+    scratch.message = buffer;
+    if (NULL == (frame = apn_payload_frame(payload, &scratch))) {
         return NULL;
     }
 
-    json_size = strlen(json);
-    if (json_size > APN_PAYLOAD_MAX_SIZE) {
-        errno = APN_ERR_INVALID_PAYLOAD_SIZE;
-        free(json);
+    binary_message = apn_binary_message_init(frame->size);
+    if (!binary_message) {
         return NULL;
     }
+    memcpy(binary_message->message, frame->message, frame->size);
 
-    frame_size = (uint32_t)(((sizeof(uint8_t) + sizeof(uint16_t)) * 5)
-                            + APN_TOKEN_BINARY_SIZE
-                            + json_size
-                            + sizeof(uint32_t)
-                            + sizeof(uint32_t)
-                            + sizeof(uint8_t));
+    binary_message->payload_size = frame->payload_size;
+    binary_message->token_position = binary_message->message + APN_BINARY_MESSAGE_TOKEN_OFFSET;
+    binary_message->id_position = binary_message->message + APN_BINARY_MESSAGE_ID_OFFSET(frame->payload_size);
+    return binary_message;
+}
 
-    frame_size_n = htonl(frame_size);
-    frame = malloc(frame_size);
-    if (!frame) {
-        errno = ENOMEM;
-        return NULL;
-    }
-    frame_ref = frame;
+uint32_t apn_binary_message_frame_size(uint32_t payload_size) {
+    return (uint32_t) APN_BINARY_MESSAGE_FRAME_SIZE(payload_size);
+}
 
-    binary_message = apn_binary_message_init((uint32_t)(frame_size + sizeof(uint32_t) + sizeof(uint8_t)));
-    if (!binary_message) {
-        return NULL;
+uint32_t apn_binary_message_write(const apn_payload_t *const payload, const uint8_t *const token, uint32_t id,
+                                  uint8_t *const buffer, uint32_t buffer_size) {
+    uint8_t frame_buffer[APN_PAYLOAD_MAX_FRAME_SIZE];
+    apn_binary_message_t scratch;
+    const apn_binary_message_t *frame = NULL;
+    uint32_t id_n = htonl(id);
+    assert(payload);
+    assert(buffer);
+
+    scratch.message = frame_buffer;
+    if (NULL == (frame = apn_payload_frame(payload, &scratch))) {
+        return 0;
+    }
+    if (frame->size > buffer_size) {
+        errno = ENOBUFS;
+        return 0;
     }
-    message_ref = binary_message->message;
+    memcpy(buffer, frame->message, frame->size);
+    if (token) {
+        memcpy(buffer + APN_BINARY_MESSAGE_TOKEN_OFFSET, token, APN_TOKEN_BINARY_SIZE);
+    }
+    memcpy(buffer + APN_BINARY_MESSAGE_ID_OFFSET(frame->payload_size), &id_n, sizeof(uint32_t));
+    return frame->size;
+}
+
+uint32_t apn_binary_message_encode(uint8_t *const buffer, const uint8_t *const token, const char *const json,
+                                   uint32_t json_size, uint32_t id, uint32_t expiry, uint8_t priority) {
+    uint8_t *buffer_ref = buffer;
+    uint32_t frame_size = apn_binary_message_frame_size(json_size);
+    uint32_t value_n = htonl(frame_size - APN_BINARY_MESSAGE_HEADER_SIZE);
+
+    /* Binary message */
+    *buffer_ref++ = 2;
+    memcpy(buffer_ref, &value_n, sizeof(uint32_t));
+    buffer_ref += sizeof(uint32_t);
 
     /* Token */
-    *frame_ref++ = item_id++;
-    item_data_size_n = htons(APN_TOKEN_BINARY_SIZE);
-    memcpy(frame_ref, &item_data_size_n, sizeof(uint16_t));
-    frame_ref += sizeof(uint16_t);
-    frame_ref += APN_TOKEN_BINARY_SIZE;
+    buffer_ref = __apn_binary_message_item(buffer_ref, 1, APN_TOKEN_BINARY_SIZE);
+    if (token) {
+        memcpy(buffer_ref, token, APN_TOKEN_BINARY_SIZE);
+    } else {
+        memset(buffer_ref, 0, APN_TOKEN_BINARY_SIZE);
+    }
+    buffer_ref += APN_TOKEN_BINARY_SIZE;
 
     /* Payload */
-    *frame_ref++ = item_id++;
-    item_data_size_n = htons((uint16_t) json_size);
-    memcpy(frame_ref, &item_data_size_n, sizeof(uint16_t));
-    frame_ref += sizeof(uint16_t);
-    memcpy(frame_ref, json, json_size);
-    frame_ref += json_size;
-
-    free(json);
+    buffer_ref = __apn_binary_message_item(buffer_ref, 2, (uint16_t) json_size);
+    if ((const char *) buffer_ref != json) {
+        memcpy(buffer_ref, json, json_size);
+    }
+    buffer_ref += json_size;
 
     /* Message ID */
-    *frame_ref++ = item_id++;
-    item_data_size_n = htons(sizeof(uint32_t));
-    memcpy(frame_ref, &item_data_size_n, sizeof(uint16_t));
-    frame_ref += sizeof(uint16_t);
-    memcpy(frame_ref, &id_n, sizeof(uint32_t));
-    frame_ref += sizeof(uint32_t);
+    buffer_ref = __apn_binary_message_item(buffer_ref, 3, sizeof(uint32_t));
+    value_n = htonl(id);
+    memcpy(buffer_ref, &value_n, sizeof(uint32_t));
+    buffer_ref += sizeof(uint32_t);
 
     /* Expires */
-    *frame_ref++ = item_id++;
-    item_data_size_n = htons(sizeof(uint32_t));
-    memcpy(frame_ref, &item_data_size_n, sizeof(uint16_t));
-    frame_ref += sizeof(uint16_t);
-    memcpy(frame_ref, &expiry_n, sizeof(uint32_t));
-    frame_ref += sizeof(uint32_t);
+    buffer_ref = __apn_binary_message_item(buffer_ref, 4, sizeof(uint32_t));
+    value_n = htonl(expiry);
+    memcpy(buffer_ref, &value_n, sizeof(uint32_t));
+    buffer_ref += sizeof(uint32_t);
 
     /* Priority */
-    *frame_ref++ = item_id;
-    item_data_size_n = htons(sizeof(uint8_t));
-    memcpy(frame_ref, &item_data_size_n, sizeof(uint16_t));
-    frame_ref += sizeof(uint16_t);
-    *frame_ref = (uint8_t) payload->priority;
-
-    /* Binary message */
-    *message_ref++ = 2;
-    memcpy(message_ref, &frame_size_n, sizeof(uint32_t));
-    message_ref += sizeof(uint32_t);
-    memcpy(message_ref, frame, frame_size);
-
-    binary_message->token_position = message_ref + (sizeof(uint8_t) + sizeof(uint16_t));
-    binary_message->id_position = binary_message->token_position +
-                                  (APN_TOKEN_BINARY_SIZE + ((sizeof(uint8_t) + sizeof(uint16_t)) * 2) + json_size);
+    buffer_ref = __apn_binary_message_item(buffer_ref, 5, sizeof(uint8_t));
+    *buffer_ref = priority;
 
-    free(frame);
-    return binary_message;
+    return frame_size;
 }
 
-static apn_return __apn_binary_message_set_token(apn_binary_message_t *const binary_message,
-                                                 const uint8_t *const token_binary, const char *const token_hex) {
-    if (!apn_hex_token_is_valid(token_hex)) {
-        errno = APN_ERR_TOKEN_INVALID;
-        return APN_ERROR;
-    }
-    if (binary_message && binary_message->token_position) {
-        memcpy(binary_message->token_position, token_binary, APN_TOKEN_BINARY_SIZE);
-        if (binary_message->token_hex) {
-            free(binary_message->token_hex);
-        }
-        binary_message->token_hex = apn_strndup(token_hex, APN_TOKEN_LENGTH);
-    }
-    return APN_SUCCESS;
+static uint8_t *__apn_binary_message_item(uint8_t *buffer, uint8_t item_id, uint16_t size) {
+    uint16_t size_n = htons(size);
+    *buffer++ = item_id;
+    memcpy(buffer, &size_n, sizeof(uint16_t));
+    return buffer + sizeof(uint16_t);
 }
@@ -32,10 +32,45 @@ extern "C" {
 
 typedef struct __apn_binary_message_t apn_binary_message_t;
 
+/**
+ * Creates a binary message for `payload` with a zeroed token and identifier.
+ * The frame prepared by ::apn_payload_prepare() is copied, otherwise the payload is rendered.
+ *
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it.
+ *
+ * @return Pointer to new binary message on success, or NULL on failure with error information stored in `errno`.
+ */
 __apn_export__ apn_binary_message_t *apn_create_binary_message(const apn_payload_t * const payload)
         __apn_attribute_warn_unused_result__
         __apn_attribute_nonnull__((1));
 
+/**
+ * Returns size of a notification frame with a `payload_size` bytes JSON payload.
+ *
+ * @param[in] payload_size - Size of the serialized payload.
+ */
+__apn_export__ uint32_t apn_binary_message_frame_size(uint32_t payload_size);
+
+/**
+ * Encodes a notification frame for `payload` directly into a caller-provided buffer.
+ * Call ::apn_payload_prepare() before writing many frames, so the payload is not rendered again for each.
+ *
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] token - Binary device token (32 bytes). Can be NULL, then the token is zeroed
+ * and can be set in place later.
+ * @param[in] id - Notification identifier.
+ * @param[out] buffer - Buffer for the frame. Cannot be NULL.
+ * @param[in] buffer_size - Size of `buffer`.
+ *
+ * @return Size of the frame on success, or 0 on failure with error information stored in `errno`,
+ * `ENOBUFS` if the frame does not fit into `buffer`.
+ */
+__apn_export__ uint32_t apn_binary_message_write(const apn_payload_t * const payload, const uint8_t * const token, uint32_t id,
+                                                 uint8_t * const buffer, uint32_t buffer_size)
+        __apn_attribute_nonnull__((1,4));
+
 __apn_export__ void apn_binary_message_set_token(apn_binary_message_t * const binary_message, const uint8_t * const token)
         __apn_attribute_nonnull__((1,2));
 
@@ -25,26 +25,67 @@
 
 #include "apn_platform.h"
 #include "apn_binary_message.h"
+#include "apn_tokens.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** Command byte and frame length */
+#define APN_BINARY_MESSAGE_HEADER_SIZE 5
+/** Item identifier and item data length */
+#define APN_BINARY_MESSAGE_ITEM_HEADER_SIZE 3
+#define APN_BINARY_MESSAGE_TOKEN_OFFSET (APN_BINARY_MESSAGE_HEADER_SIZE + APN_BINARY_MESSAGE_ITEM_HEADER_SIZE)
+#define APN_BINARY_MESSAGE_PAYLOAD_OFFSET (APN_BINARY_MESSAGE_TOKEN_OFFSET + APN_TOKEN_BINARY_SIZE + APN_BINARY_MESSAGE_ITEM_HEADER_SIZE)
+#define APN_BINARY_MESSAGE_ID_OFFSET(__payload_size) \
+    (APN_BINARY_MESSAGE_TOKEN_OFFSET + APN_TOKEN_BINARY_SIZE + APN_BINARY_MESSAGE_ITEM_HEADER_SIZE * 2 + (uint32_t) (__payload_size))
+#define APN_BINARY_MESSAGE_FRAME_SIZE(__payload_size) \
+    (APN_BINARY_MESSAGE_ID_OFFSET(__payload_size) \
+     + sizeof(uint32_t) \
+     + APN_BINARY_MESSAGE_ITEM_HEADER_SIZE + sizeof(uint32_t) \
+     + APN_BINARY_MESSAGE_ITEM_HEADER_SIZE + sizeof(uint8_t))
+
 struct __apn_binary_message_t {
     uint32_t payload_size;
     uint32_t size;
     uint8_t *token_position;
     uint8_t *id_position;
+    /** Frame, allocated together with the structure */
     uint8_t *message;
-    char *token_hex;
+    /** Points to `token_hex_buffer` or to a token borrowed by apn_binary_message_patch_token_hex() */
+    const char *token_hex;
+    char token_hex_buffer[APN_TOKEN_LENGTH + 1];
 };
 
 apn_binary_message_t *apn_binary_message_init(uint32_t size)
         __apn_attribute_warn_unused_result__;
 
+/**
+ * Encodes a notification frame into `buffer`, which must hold ::apn_binary_message_frame_size() bytes.
+ *
+ * @param[in] token - Binary device token, NULL to leave the token zeroed.
+ * @param[in] json - Payload, may already be in place at ::APN_BINARY_MESSAGE_PAYLOAD_OFFSET of `buffer`.
+ *
+ * @return Size of the frame.
+ */
+uint32_t apn_binary_message_encode(uint8_t * const buffer, const uint8_t * const token, const char * const json,
+                                   uint32_t json_size, uint32_t id, uint32_t expiry, uint8_t priority)
+        __apn_attribute_nonnull__((1,3));
+
 void apn_binary_message_set_id(const apn_binary_message_t * const binary_message, uint32_t id)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Decodes `token_hex` straight into the frame without allocating memory. The message keeps
+ * a pointer to `token_hex`, which must stay valid while the token of the message is used.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if the token is invalid, `errno` is set to ::APN_ERR_TOKEN_INVALID.
+ */
+apn_return apn_binary_message_patch_token_hex(apn_binary_message_t * const binary_message, const char * const token_hex)
+        __apn_attribute_nonnull__((1,2));
+
 #ifdef __cplusplus
 }
 #endif
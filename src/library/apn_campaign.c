@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_campaign.h"
+#include "apn_private.h"
+#include "apn_binary_message_private.h"
+#include "apn_engine_private.h"
+#include "apn_tokens.h"
+#include "apn_mmap.h"
+#include "apn_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef APN_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+/*
+ * File layout, integers are in network byte order:
+ *
+ *     magic (8) | version (4) | frame count (4) | frame size (4) | offset of frames (4) | offset of identifier in a frame (4) | reserved (4)
+ *     frame 0 | frame 1 | ...
+ */
+#define APN_CAMPAIGN_MAGIC "CAPNCAMP"
+#define APN_CAMPAIGN_MAGIC_SIZE 8
+#define APN_CAMPAIGN_VERSION 1
+#define APN_CAMPAIGN_HEADER_SIZE 32
+#define APN_CAMPAIGN_WRITE_BUFFER_SIZE 65536
+
+struct __apn_campaign_t {
+    apn_mmap_t map;
+    const uint8_t *frames;
+    uint32_t count;
+    uint32_t frame_size;
+};
+
+static void __apn_campaign_header_encode(uint8_t *const header, uint32_t count, uint32_t frame_size, uint32_t id_offset);
+static uint32_t __apn_campaign_header_field(const uint8_t *const header, uint32_t offset);
+static apn_return __apn_campaign_write(FILE *const stream, const apn_payload_t *const payload,
+                                       apn_token_source_t *const tokens, uint32_t *frame_count, uint32_t *invalid_count);
+
+static int __apn_campaign_source_next(void *data, uint32_t index, apn_frame_t *frame);
+static apn_return __apn_campaign_source_token(void *data, uint32_t index, char *token_hex);
+
+apn_return apn_campaign_compile(const char *const file, const apn_payload_t *const payload,
+                                const apn_token_source_t *tokens, uint32_t *frame_count, uint32_t *invalid_count) {
+    apn_token_source_t token_source;
+    FILE *stream = NULL;
+    apn_return ret = APN_ERROR;
+    int error = 0;
+    assert(file);
+    assert(payload);
+    assert(tokens);
+
+    token_source = *tokens;
+    stream = fopen(file, "wb");
+    if (!stream) {
+        apn_token_source_free(&token_source);
+        return APN_ERROR;
+    }
+    setvbuf(stream, NULL, _IOFBF, APN_CAMPAIGN_WRITE_BUFFER_SIZE);
+
+    ret = __apn_campaign_write(stream, payload, &token_source, frame_count, invalid_count);
+    error = errno;
+    apn_token_source_free(&token_source);
+    if (0 != fclose(stream) && APN_SUCCESS == ret) {
+        ret = APN_ERROR;
+        error = errno;
+    }
+    if (APN_ERROR == ret) {
+        remove(file);
+        errno = error;
+    }
+    return ret;
+}
+
+apn_campaign_t *apn_campaign_open(const char *const file) {
+    apn_campaign_t *campaign = NULL;
+    const uint8_t *header = NULL;
+    uint32_t frames_offset = 0;
+    uint32_t id_offset = 0;
+    assert(file);
+
+    campaign = malloc(sizeof(apn_campaign_t));
+    if (!campaign) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (APN_ERROR == apn_mmap_open(&campaign->map, file)) {
+        free(campaign);
+        return NULL;
+    }
+
+    header = campaign->map.data;
+    if (campaign->map.size < APN_CAMPAIGN_HEADER_SIZE
+        || 0 != memcmp(header, APN_CAMPAIGN_MAGIC, APN_CAMPAIGN_MAGIC_SIZE)
+        || APN_CAMPAIGN_VERSION != __apn_campaign_header_field(header, 8)) {
+        apn_campaign_close(campaign);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    campaign->count = __apn_campaign_header_field(header, 12);
+    campaign->frame_size = __apn_campaign_header_field(header, 16);
+    frames_offset = __apn_campaign_header_field(header, 20);
+    id_offset = __apn_campaign_header_field(header, 24);
+
+    if (frames_offset < APN_CAMPAIGN_HEADER_SIZE
+        || campaign->frame_size < APN_BINARY_MESSAGE_ID_OFFSET(0) + sizeof(uint32_t)
+        || id_offset + sizeof(uint32_t) > campaign->frame_size
+        || (uint64_t) frames_offset + (uint64_t) campaign->count * campaign->frame_size > (uint64_t) campaign->map.size) {
+        apn_campaign_close(campaign);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    campaign->frames = campaign->map.data + frames_offset;
+    return campaign;
+}
+
+void apn_campaign_close(apn_campaign_t *campaign) {
+    if (campaign) {
+        apn_mmap_close(&campaign->map);
+        free(campaign);
+    }
+}
+
+uint32_t apn_campaign_count(const apn_campaign_t *const campaign) {
+    assert(campaign);
+    return campaign->count;
+}
+
+apn_return apn_campaign_send(apn_ctx_t *const ctx, const apn_campaign_t *const campaign, uint32_t first_id,
+                             apn_array_t **invalid_tokens) {
+    assert(ctx);
+    assert(campaign);
+
+    if (APN_ERROR == apn_campaign_send_async(ctx, campaign, first_id)) {
+        return APN_ERROR;
+    }
+    if (!apn_engine_busy(ctx)) {
+        return APN_SUCCESS;
+    }
+    apn_engine_wait(ctx);
+    return apn_engine_result(ctx, invalid_tokens);
+}
+
+apn_return apn_campaign_send_async(apn_ctx_t *const ctx, const apn_campaign_t *const campaign, uint32_t first_id) {
+    apn_frame_source_t source;
+    assert(ctx);
+    assert(campaign);
+
+    if (!ctx->ssl || ctx->feedback) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Connection was not opened");
+        errno = APN_ERR_NOT_CONNECTED;
+        return APN_ERROR;
+    }
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+    if (first_id >= campaign->count) {
+        return APN_SUCCESS;
+    }
+
+    /* frames are read from the mapping as they are, the source owns nothing */
+    source.data = (void *) campaign;
+    source.next = __apn_campaign_source_next;
+    source.token = __apn_campaign_source_token;
+    source.free = NULL;
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending campaign, frames %u-%u...", first_id, campaign->count - 1);
+    return apn_engine_start(ctx, &source, first_id);
+}
+
+static apn_return __apn_campaign_write(FILE *const stream, const apn_payload_t *const payload,
+                                       apn_token_source_t *const tokens, uint32_t *frame_count, uint32_t *invalid_count) {
+    apn_binary_message_t *binary_message = NULL;
+    uint8_t header[APN_CAMPAIGN_HEADER_SIZE];
+    const char *token = NULL;
+    uint32_t count = 0;
+    uint32_t invalid = 0;
+    int ret = 0;
+
+    binary_message = apn_create_binary_message(payload);
+    if (!binary_message) {
+        return APN_ERROR;
+    }
+
+    /* the header is rewritten with the frame count once all frames are written */
+    __apn_campaign_header_encode(header, 0, binary_message->size, (uint32_t) (binary_message->id_position - binary_message->message));
+    if (1 != fwrite(header, sizeof(header), 1, stream)) {
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
+    }
+
+    while (1 == (ret = tokens->next(tokens->data, &token))) {
+        if (APN_ERROR == apn_binary_message_patch_token_hex(binary_message, token)) {
+            invalid++;
+            continue;
+        }
+        if (UINT32_MAX == count) {
+            apn_binary_message_free(binary_message);
+            errno = APN_ERR_TOKEN_TOO_MANY;
+            return APN_ERROR;
+        }
+        apn_binary_message_set_id(binary_message, count);
+        if (1 != fwrite(binary_message->message, binary_message->size, 1, stream)) {
+            apn_binary_message_free(binary_message);
+            return APN_ERROR;
+        }
+        count++;
+    }
+    if (ret < 0) {
+        apn_binary_message_free(binary_message);
+        return APN_ERROR;
+    }
+
+    __apn_campaign_header_encode(header, count, binary_message->size, (uint32_t) (binary_message->id_position - binary_message->message));
+    apn_binary_message_free(binary_message);
+    if (0 != fseek(stream, 0, SEEK_SET) || 1 != fwrite(header, sizeof(header), 1, stream)) {
+        return APN_ERROR;
+    }
+
+    if (frame_count) {
+        *frame_count = count;
+    }
+    if (invalid_count) {
+        *invalid_count = invalid;
+    }
+    return APN_SUCCESS;
+}
+
+static void __apn_campaign_header_encode(uint8_t *const header, uint32_t count, uint32_t frame_size, uint32_t id_offset) {
+    uint32_t fields[6];
+    fields[0] = htonl(APN_CAMPAIGN_VERSION);
+    fields[1] = htonl(count);
+    fields[2] = htonl(frame_size);
+    fields[3] = htonl(APN_CAMPAIGN_HEADER_SIZE);
+    fields[4] = htonl(id_offset);
+    fields[5] = 0;
+    memcpy(header, APN_CAMPAIGN_MAGIC, APN_CAMPAIGN_MAGIC_SIZE);
+    memcpy(header + APN_CAMPAIGN_MAGIC_SIZE, fields, sizeof(fields));
+}
+
+static uint32_t __apn_campaign_header_field(const uint8_t *const header, uint32_t offset) {
+    uint32_t value_n = 0;
+    memcpy(&value_n, header + offset, sizeof(uint32_t));
+    return ntohl(value_n);
+}
+
+static int __apn_campaign_source_next(void *data, uint32_t index, apn_frame_t *frame) {
+    const apn_campaign_t *campaign = (const apn_campaign_t *) data;
+    if (index >= campaign->count) {
+        return 0;
+    }
+    frame->data = campaign->frames + (size_t) index * campaign->frame_size;
+    frame->size = campaign->frame_size;
+    frame->token_hex = NULL;
+    return 1;
+}
+
+static apn_return __apn_campaign_source_token(void *data, uint32_t index, char *token_hex) {
+    const apn_campaign_t *campaign = (const apn_campaign_t *) data;
+    if (index >= campaign->count) {
+        return APN_ERROR;
+    }
+    apn_token_hex_encode(campaign->frames + (size_t) index * campaign->frame_size + APN_BINARY_MESSAGE_TOKEN_OFFSET, token_hex);
+    return APN_SUCCESS;
+}
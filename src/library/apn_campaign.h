@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_CAMPAIGN_H__
+#define __APN_CAMPAIGN_H__
+
+#include "apn_platform.h"
+#include "apn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Precompiled campaign: a file of ready-to-send notification frames for one payload.
+ *
+ * The file starts with a header followed by frames of equal size; frame identifiers are their indexes,
+ * so sending can resume from any frame.
+ */
+typedef struct __apn_campaign_t apn_campaign_t;
+
+/**
+ * Encodes a notification frame for each device read from `tokens` and writes them to `file`.
+ * Invalid tokens are skipped and do not take a frame identifier.
+ *
+ * The call takes ownership of `tokens`, which is freed with ::apn_token_source_free().
+ *
+ * @param[in] file - Path to the campaign file, an existing file is replaced. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Pointer to an initialized token source. Cannot be NULL.
+ * @param[out] frame_count - Receives number of written frames. Can be NULL.
+ * @param[out] invalid_count - Receives number of skipped tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the file is removed.
+ */
+__apn_export__ apn_return apn_campaign_compile(const char *const file, const apn_payload_t *const payload,
+                                               const apn_token_source_t *tokens, uint32_t *frame_count,
+                                               uint32_t *invalid_count)
+        __apn_attribute_nonnull__((1,2,3));
+
+/**
+ * Maps a campaign file into memory.
+ *
+ * @param[in] file - Path to the campaign file. Cannot be NULL.
+ *
+ * @return Pointer to new `campaign` structure on success, or NULL on failure with error information stored in `errno`,
+ * ::APN_ERR_FILE_FORMAT_INVALID if the file is not a campaign or is truncated.
+ */
+__apn_export__ apn_campaign_t *apn_campaign_open(const char *const file)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Unmaps the campaign file and frees memory allocated for the campaign.
+ *
+ * @param[in] campaign - Pointer to `campaign` structure.
+ */
+__apn_export__ void apn_campaign_close(apn_campaign_t *campaign);
+
+/**
+ * Returns number of frames in the campaign.
+ *
+ * @param[in] campaign - Pointer to an opened `campaign` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_campaign_count(const apn_campaign_t *const campaign)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sends frames of the campaign starting with `first_id`. Frames are written to the connection as they are,
+ * payload and tokens are not encoded again.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] campaign - Pointer to an opened `campaign` structure. Cannot be NULL.
+ * @param[in] first_id - Identifier of the first frame to send, e.g. to resume an interrupted campaign.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success, also when there is nothing to send.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_campaign_send(apn_ctx_t *const ctx, const apn_campaign_t *const campaign, uint32_t first_id,
+                                            apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Starts sending frames of the campaign without blocking, see ::apn_campaign_send() and ::apn_send_async().
+ * The campaign must stay opened until the send is finished.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] campaign - Pointer to an opened `campaign` structure. Cannot be NULL.
+ * @param[in] first_id - Identifier of the first frame to send.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success, also when there is nothing to send.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_campaign_send_async(apn_ctx_t *const ctx, const apn_campaign_t *const campaign, uint32_t first_id)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
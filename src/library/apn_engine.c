@@ -0,0 +1,1134 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef APN_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#include "apn_engine_private.h"
+#include "apn_private.h"
+#include "apn_binary_message_private.h"
+#include "apn_paload_private.h"
+#include "apn_array_private.h"
+#include "apn_tokens.h"
+#include "apn_suppression.h"
+#include "apn_strings.h"
+#include "apn_memory.h"
+#include "apn_poll.h"
+#include "apn_log.h"
+#include "apn_ssl.h"
+
+typedef enum __apn_apple_errors {
+    APN_APNS_ERR_PROCESSING_ERROR = 1,
+    APN_APNS_ERR_MISSING_DEVICE_TOKEN,
+    APN_APNS_ERR_MISSING_TOPIC,
+    APN_APNS_ERR_MISSING_PAYLOAD,
+    APN_APNS_ERR_INVALID_TOKEN_SIZE,
+    APN_APNS_ERR_INVALID_TOPIC_SIZE,
+    APN_APNS_ERR_INVALID_PAYLOAD_SIZE,
+    APN_APNS_ERR_INVALID_TOKEN,
+    APN_APNS_ERR_SERVICE_SHUTDOWN = 10,
+    APN_APNS_ERR_NONE = 255
+} apn_apple_errors;
+
+typedef struct __apn_batch_source_data_t {
+    const apn_batch_item_t *items;
+    uint32_t count;
+    /** Binary message built for `payload`, reused by consecutive items with the same payload */
+    const apn_payload_t *payload;
+    apn_binary_message_t *binary_message;
+    /** Frame buffer for items rendered from a payload template, allocated on first use */
+    uint8_t *frame_buffer;
+} apn_batch_source_data_t;
+
+typedef struct __apn_token_set_source_data_t {
+    apn_binary_message_t *binary_message;
+    const apn_token_set_t *tokens;
+    char token_hex[APN_TOKEN_LENGTH + 1];
+} apn_token_set_source_data_t;
+
+typedef struct __apn_tokens_source_data_t {
+    apn_binary_message_t *binary_message;
+    apn_token_source_t tokens;
+    /** Index of the token which `tokens` reads next */
+    uint32_t position;
+} apn_tokens_source_data_t;
+
+static void __apn_engine_fill(apn_ctx_t *const ctx);
+static uint32_t __apn_engine_throttle_delay(apn_ctx_t *const ctx, uint32_t pending, uint32_t size, uint64_t now);
+static void __apn_engine_throttle_take(apn_ctx_t *const ctx, uint32_t size);
+static apn_return __apn_engine_reserve(apn_ctx_t *const ctx, uint32_t size);
+static uint32_t __apn_engine_drain_timeout(const apn_ctx_t *const ctx);
+static void __apn_engine_write(apn_ctx_t *const ctx);
+static void __apn_engine_read(apn_ctx_t *const ctx);
+static void __apn_engine_reconnect(apn_ctx_t *const ctx);
+static void __apn_engine_connect(apn_ctx_t *const ctx);
+static void __apn_engine_schedule_reconnect(apn_ctx_t *const ctx, int errcode);
+static uint32_t __apn_engine_random(apn_engine_t *const engine);
+static void __apn_engine_error(apn_ctx_t *const ctx, int errcode, uint32_t restart_index);
+static void __apn_engine_finish(apn_ctx_t *const ctx, apn_return result, int error);
+static void __apn_engine_invalid_token(apn_ctx_t *const ctx, uint32_t index);
+static void __apn_engine_free_source(apn_engine_t *const engine);
+static int __apn_convert_apple_error(uint8_t apple_error_code);
+static apn_return __apn_engine_take_result(apn_ctx_t *const ctx);
+static apn_array_t *__apn_engine_invalid_token_array(apn_engine_t *const engine);
+
+static int __apn_batch_source_next(void *data, uint32_t index, apn_frame_t *frame);
+static int __apn_batch_source_render(apn_batch_source_data_t *const source, const apn_batch_item_t *const item,
+                                     uint32_t index, apn_frame_t *frame);
+static apn_return __apn_batch_source_token(void *data, uint32_t index, char *token_hex);
+static void __apn_batch_source_free(void *data);
+
+static int __apn_tokens_source_next(void *data, uint32_t index, apn_frame_t *frame);
+static apn_return __apn_tokens_source_token(void *data, uint32_t index, char *token_hex);
+static void __apn_tokens_source_free(void *data);
+
+static int __apn_token_set_source_next(void *data, uint32_t index, apn_frame_t *frame);
+static apn_return __apn_token_set_source_token(void *data, uint32_t index, char *token_hex);
+static void __apn_token_set_source_free(void *data);
+
+void apn_engine_init(apn_engine_t *const engine) {
+    assert(engine);
+    memset(engine, 0, sizeof(apn_engine_t));
+    engine->state = APN_ENGINE_STATE_IDLE;
+    engine->result = APN_SUCCESS;
+    engine->write_want = APN_POLL_WRITE;
+    apn_ring_init(&engine->ring);
+    engine->random_state = (uint32_t) apn_time_ms() ^ (uint32_t) (uintptr_t) engine;
+    if (0 == engine->random_state) {
+        engine->random_state = 1;
+    }
+}
+
+void apn_engine_free(apn_engine_t *const engine) {
+    assert(engine);
+    __apn_engine_free_source(engine);
+    apn_mem_free(engine->buffer);
+    apn_token_set_free(engine->invalid_tokens);
+    apn_array_free(engine->malformed_tokens);
+    apn_ring_free(&engine->ring);
+    apn_engine_init(engine);
+}
+
+apn_return apn_engine_start(apn_ctx_t *const ctx, const apn_frame_source_t *const source, uint32_t first_index) {
+    apn_engine_t *engine = NULL;
+    assert(ctx);
+    assert(source);
+    assert(source->next);
+
+    engine = &ctx->engine;
+    if (apn_engine_busy(ctx)) {
+        if (source->free && source->data) {
+            source->free(source->data);
+        }
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
+    __apn_engine_free_source(engine);
+    apn_token_set_free(engine->invalid_tokens);
+    engine->invalid_tokens = NULL;
+    apn_array_free(engine->malformed_tokens);
+    engine->malformed_tokens = NULL;
+
+    if (APN_ERROR == apn_ring_set_size(&engine->ring, ctx->replay_buffer_size)) {
+        if (source->free && source->data) {
+            source->free(source->data);
+        }
+        return APN_ERROR;
+    }
+    apn_ring_reset(&engine->ring, first_index);
+    engine->replay_count = 0;
+
+    engine->source = *source;
+    engine->source_drained = 0;
+    engine->frame_held = 0;
+    engine->next_index = first_index;
+    engine->batch_first_index = first_index;
+    engine->suppressed_count = 0;
+    engine->buffer_used = 0;
+    engine->response_size = 0;
+    engine->last_write_size = 0;
+    engine->reconnect_attempts = 0;
+    engine->write_want = APN_POLL_WRITE;
+    engine->deadline = 0;
+    engine->throttled = 0;
+    engine->result = APN_SUCCESS;
+    engine->error = 0;
+    engine->state = APN_ENGINE_STATE_SENDING;
+    return APN_SUCCESS;
+}
+
+uint8_t apn_engine_busy(const apn_ctx_t *const ctx) {
+    assert(ctx);
+    switch (ctx->engine.state) {
+        case APN_ENGINE_STATE_SENDING:
+        case APN_ENGINE_STATE_DRAINING:
+        case APN_ENGINE_STATE_RECONNECTING:
+        case APN_ENGINE_STATE_CONNECTING:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+uint32_t apn_engine_events(const apn_ctx_t *const ctx) {
+    const apn_engine_t *engine = NULL;
+    assert(ctx);
+
+    engine = &ctx->engine;
+    switch (engine->state) {
+        case APN_ENGINE_STATE_SENDING:
+            if (engine->buffer_used > 0) {
+                return APN_POLL_READ | engine->write_want;
+            }
+            if (engine->throttled) {
+                return APN_POLL_READ;
+            }
+            return APN_POLL_READ | APN_POLL_WRITE;
+        case APN_ENGINE_STATE_DRAINING:
+            return APN_POLL_READ;
+        case APN_ENGINE_STATE_CONNECTING:
+            return engine->connect_want;
+        default:
+            return 0;
+    }
+}
+
+int apn_engine_timeout(const apn_ctx_t *const ctx) {
+    uint64_t now = 0;
+    assert(ctx);
+
+    if (!apn_engine_busy(ctx) || 0 == ctx->engine.deadline) {
+        return -1;
+    }
+    now = apn_time_ms();
+    if (now >= ctx->engine.deadline) {
+        return 0;
+    }
+    return (int) (ctx->engine.deadline - now);
+}
+
+void apn_engine_process(apn_ctx_t *const ctx, uint32_t revents) {
+    apn_engine_t *engine = NULL;
+    assert(ctx);
+
+    engine = &ctx->engine;
+    switch (engine->state) {
+        case APN_ENGINE_STATE_SENDING:
+            if (revents & APN_POLL_READ) {
+                __apn_engine_read(ctx);
+                if (APN_ENGINE_STATE_SENDING != engine->state) {
+                    break;
+                }
+            }
+            if (engine->throttled) {
+                if (0 == apn_engine_timeout(ctx)) {
+                    engine->throttled = 0;
+                    engine->deadline = 0;
+                    __apn_engine_write(ctx);
+                }
+            } else if (revents & (engine->buffer_used > 0 ? engine->write_want : APN_POLL_WRITE)) {
+                __apn_engine_write(ctx);
+            }
+            break;
+        case APN_ENGINE_STATE_DRAINING:
+            if (revents & APN_POLL_READ) {
+                __apn_engine_read(ctx);
+                if (APN_ENGINE_STATE_DRAINING != engine->state) {
+                    break;
+                }
+            }
+            if (0 == apn_engine_timeout(ctx)) {
+                apn_log(ctx, APN_LOG_LEVEL_DEBUG, "No error response received");
+                __apn_engine_finish(ctx, APN_SUCCESS, 0);
+            }
+            break;
+        case APN_ENGINE_STATE_RECONNECTING:
+            if (0 == apn_engine_timeout(ctx)) {
+                __apn_engine_reconnect(ctx);
+            }
+            break;
+        case APN_ENGINE_STATE_CONNECTING:
+            __apn_engine_connect(ctx);
+            break;
+        default:
+            break;
+    }
+}
+
+void apn_engine_wait(apn_ctx_t *const ctx) {
+    assert(ctx);
+    while (apn_engine_busy(ctx)) {
+        int revents = apn_poll(ctx->sock, apn_engine_events(ctx), apn_engine_timeout(ctx));
+        if (revents < 0) {
+            char *error = apn_error_string(errno);
+            apn_log(ctx, APN_LOG_LEVEL_ERROR, "poll() failed: %s (errno: %d)", error, errno);
+            free(error);
+            __apn_engine_finish(ctx, APN_ERROR, errno);
+            break;
+        }
+        apn_engine_process(ctx, (uint32_t) revents);
+    }
+}
+
+void apn_engine_wait_written(apn_ctx_t *const ctx) {
+    assert(ctx);
+    while (APN_ENGINE_STATE_SENDING == ctx->engine.state || APN_ENGINE_STATE_RECONNECTING == ctx->engine.state
+           || APN_ENGINE_STATE_CONNECTING == ctx->engine.state) {
+        int revents = apn_poll(ctx->sock, apn_engine_events(ctx), apn_engine_timeout(ctx));
+        if (revents < 0) {
+            char *error = apn_error_string(errno);
+            apn_log(ctx, APN_LOG_LEVEL_ERROR, "poll() failed: %s (errno: %d)", error, errno);
+            free(error);
+            __apn_engine_finish(ctx, APN_ERROR, errno);
+            break;
+        }
+        apn_engine_process(ctx, (uint32_t) revents);
+    }
+}
+
+apn_return apn_engine_result(apn_ctx_t *const ctx, apn_array_t **invalid_tokens) {
+    apn_engine_t *engine = NULL;
+    assert(ctx);
+
+    engine = &ctx->engine;
+    if (apn_engine_busy(ctx)) {
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+    if (APN_ENGINE_STATE_DONE != engine->state) {
+        return APN_SUCCESS;
+    }
+
+    if (invalid_tokens && (engine->invalid_tokens || engine->malformed_tokens)) {
+        *invalid_tokens = __apn_engine_invalid_token_array(engine);
+    }
+    return __apn_engine_take_result(ctx);
+}
+
+apn_return apn_engine_result_token_set(apn_ctx_t *const ctx, apn_token_set_t **invalid_tokens) {
+    apn_engine_t *engine = NULL;
+    assert(ctx);
+
+    engine = &ctx->engine;
+    if (apn_engine_busy(ctx)) {
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+    if (APN_ENGINE_STATE_DONE != engine->state) {
+        return APN_SUCCESS;
+    }
+
+    if (invalid_tokens && engine->invalid_tokens) {
+        *invalid_tokens = engine->invalid_tokens;
+        engine->invalid_tokens = NULL;
+    }
+    return __apn_engine_take_result(ctx);
+}
+
+apn_return apn_frame_source_batch(apn_frame_source_t *const source, const apn_batch_item_t *items, uint32_t count) {
+    apn_batch_source_data_t *data = NULL;
+    assert(source);
+    assert(items);
+
+    data = malloc(sizeof(apn_batch_source_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->items = items;
+    data->count = count;
+    data->payload = NULL;
+    data->binary_message = NULL;
+    data->frame_buffer = NULL;
+
+    source->data = data;
+    source->next = __apn_batch_source_next;
+    source->token = __apn_batch_source_token;
+    source->free = __apn_batch_source_free;
+    return APN_SUCCESS;
+}
+
+apn_return apn_frame_source_token_set(apn_frame_source_t *const source, apn_binary_message_t *binary_message,
+                                      const apn_token_set_t *const tokens) {
+    apn_token_set_source_data_t *data = NULL;
+    assert(source);
+    assert(binary_message);
+    assert(tokens);
+
+    data = malloc(sizeof(apn_token_set_source_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->binary_message = binary_message;
+    data->tokens = tokens;
+
+    source->data = data;
+    source->next = __apn_token_set_source_next;
+    source->token = __apn_token_set_source_token;
+    source->free = __apn_token_set_source_free;
+    return APN_SUCCESS;
+}
+
+apn_return apn_frame_source_tokens(apn_frame_source_t *const source, apn_binary_message_t *binary_message,
+                                   const apn_token_source_t *const tokens) {
+    apn_tokens_source_data_t *data = NULL;
+    assert(source);
+    assert(binary_message);
+    assert(tokens);
+
+    data = malloc(sizeof(apn_tokens_source_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->binary_message = binary_message;
+    data->tokens = *tokens;
+    data->position = 0;
+
+    source->data = data;
+    source->next = __apn_tokens_source_next;
+    source->token = __apn_tokens_source_token;
+    source->free = __apn_tokens_source_free;
+    return APN_SUCCESS;
+}
+
+static void __apn_engine_fill(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+    uint64_t now = apn_time_ms();
+    uint32_t pending = ctx->inflight_limit ? apn_socket_pending(ctx->sock) : 0;
+    uint32_t delay = 0;
+    apn_frame_t frame;
+
+    /* Frames which were not reported within the window are considered delivered */
+    if (0 == engine->replay_count && now > ctx->replay_window) {
+        apn_ring_drop_older(&engine->ring, now - ctx->replay_window);
+    }
+
+    while (engine->replay_count > 0) {
+        const apn_ring_record_t *record = apn_ring_at(&engine->ring, engine->ring.count - engine->replay_count);
+
+        if (engine->buffer_used > 0 && engine->buffer_used + record->size > ctx->send_buffer_size) {
+            return;
+        }
+        if (APN_ERROR == __apn_engine_reserve(ctx, record->size)) {
+            return;
+        }
+        if (0 == engine->buffer_used) {
+            engine->batch_first_index = record->id;
+        }
+
+        apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Replaying notification %u...", record->id);
+
+        memcpy(engine->buffer + engine->buffer_used, engine->ring.data + record->offset, record->size);
+        engine->buffer_used += record->size;
+        engine->replay_count--;
+        /* replayed frames are not delayed, but count against the limits */
+        __apn_engine_throttle_take(ctx, record->size);
+    }
+
+    while (engine->frame_held || !engine->source_drained) {
+        if (engine->frame_held) {
+            frame = engine->held_frame;
+            engine->frame_held = 0;
+        } else {
+            int ret = engine->source.next(engine->source.data, engine->next_index, &frame);
+            if (0 == ret) {
+                engine->source_drained = 1;
+                break;
+            } else if (0 > ret) {
+                if (APN_ERR_TOKEN_INVALID == errno) {
+                    __apn_engine_invalid_token(ctx, engine->next_index);
+                    engine->next_index++;
+                    continue;
+                }
+                __apn_engine_finish(ctx, APN_ERROR, errno);
+                return;
+            }
+            if (ctx->suppression && frame.size >= APN_FRAME_TOKEN_OFFSET + APN_TOKEN_BINARY_SIZE
+                && apn_suppression_contains(ctx->suppression, frame.data + APN_FRAME_TOKEN_OFFSET)) {
+                apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Notification %u is skipped, token is suppressed", engine->next_index);
+                engine->suppressed_count++;
+                engine->next_index++;
+                continue;
+            }
+        }
+
+        if (engine->buffer_used > 0 && engine->buffer_used + frame.size > ctx->send_buffer_size) {
+            engine->held_frame = frame;
+            engine->frame_held = 1;
+            break;
+        }
+
+        if (0 != (delay = __apn_engine_throttle_delay(ctx, pending, frame.size, now))) {
+            engine->held_frame = frame;
+            engine->frame_held = 1;
+            if (0 == engine->buffer_used) {
+                apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Sending is throttled for %u ms", delay);
+                engine->throttled = 1;
+                engine->deadline = now + delay;
+            }
+            break;
+        }
+
+        if (APN_ERROR == __apn_engine_reserve(ctx, frame.size)) {
+            return;
+        }
+
+        if (0 == engine->buffer_used) {
+            engine->batch_first_index = engine->next_index;
+        }
+
+        if (frame.token_hex) {
+            apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending notificaton to device with token %s...", frame.token_hex);
+        }
+
+        memcpy(engine->buffer + engine->buffer_used, frame.data, frame.size);
+        engine->buffer_used += frame.size;
+        apn_ring_push(&engine->ring, engine->next_index, frame.data, frame.size, now);
+        engine->next_index++;
+        __apn_engine_throttle_take(ctx, frame.size);
+    }
+}
+
+static uint32_t __apn_engine_throttle_delay(apn_ctx_t *const ctx, uint32_t pending, uint32_t size, uint64_t now) {
+    const apn_engine_t *engine = &ctx->engine;
+    uint32_t delay = apn_rate_limiter_delay(&ctx->rate_limiter, now);
+
+    if (ctx->shared_rate_limiter) {
+        uint32_t shared_delay = apn_rate_limiter_delay(ctx->shared_rate_limiter, now);
+        if (shared_delay > delay) {
+            delay = shared_delay;
+        }
+    }
+
+    /* a frame larger than the limit is still sent once the socket is empty */
+    if (0 == delay && ctx->inflight_limit > 0 && (pending > 0 || engine->buffer_used > 0)
+        && (uint64_t) pending + engine->buffer_used + size > ctx->inflight_limit) {
+        delay = ctx->rtt > 4 ? ctx->rtt / 4 : APN_INFLIGHT_CHECK_INTERVAL;
+    }
+    return delay;
+}
+
+static void __apn_engine_throttle_take(apn_ctx_t *const ctx, uint32_t size) {
+    apn_rate_limiter_take(&ctx->rate_limiter, size);
+    if (ctx->shared_rate_limiter) {
+        apn_rate_limiter_take(ctx->shared_rate_limiter, size);
+    }
+}
+
+static uint32_t __apn_engine_drain_timeout(const apn_ctx_t *const ctx) {
+    uint32_t rtt = ctx->rtt;
+    uint32_t in_flight = ctx->engine.last_write_size;
+    uint64_t timeout = 0;
+
+    if (!(ctx->options & APN_OPTION_ADAPTIVE_DRAIN)) {
+        return ctx->drain_timeout;
+    }
+
+    /* Kernel statistics are more precise than the handshake estimate when available */
+    apn_socket_stats(ctx->sock, &rtt, &in_flight);
+    if (0 == rtt) {
+        return ctx->drain_timeout;
+    }
+
+    /*
+     * The error response comes back about one round trip after Apple received the failed frame.
+     * Data which is not acknowledged yet needs roughly one more round trip per send buffer.
+     */
+    timeout = (uint64_t) rtt * (APN_DRAIN_RTT_FACTOR + in_flight / APN_SEND_BUFFER_SIZE_DEFAULT);
+    if (timeout < APN_DRAIN_TIMEOUT_MIN) {
+        timeout = APN_DRAIN_TIMEOUT_MIN;
+    }
+    if (timeout > ctx->drain_timeout) {
+        timeout = ctx->drain_timeout;
+    }
+    return (uint32_t) timeout;
+}
+
+static apn_return __apn_engine_reserve(apn_ctx_t *const ctx, uint32_t size) {
+    apn_engine_t *engine = &ctx->engine;
+    if (engine->buffer_used + size > engine->buffer_size) {
+        uint8_t *buffer = realloc(engine->buffer, engine->buffer_used + size);
+        if (!buffer) {
+            __apn_engine_finish(ctx, APN_ERROR, ENOMEM);
+            return APN_ERROR;
+        }
+        engine->buffer = buffer;
+        engine->buffer_size = engine->buffer_used + size;
+    }
+    return APN_SUCCESS;
+}
+
+static void __apn_engine_write(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+    uint32_t want = 0;
+    int bytes_written = 0;
+
+    if (0 == engine->buffer_used) {
+        if (engine->buffer_size < ctx->send_buffer_size) {
+            uint8_t *buffer = apn_mem_realloc(engine->buffer, ctx->send_buffer_size);
+            if (!buffer) {
+                engine->buffer = NULL;
+                engine->buffer_size = 0;
+                __apn_engine_finish(ctx, APN_ERROR, ENOMEM);
+                return;
+            }
+            engine->buffer = buffer;
+            engine->buffer_size = ctx->send_buffer_size;
+        }
+        __apn_engine_fill(ctx);
+        if (APN_ENGINE_STATE_SENDING != engine->state || engine->throttled) {
+            return;
+        }
+        if (0 == engine->buffer_used) {
+            uint32_t drain_timeout = __apn_engine_drain_timeout(ctx);
+            apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Waiting for an error response (%u ms)...", drain_timeout);
+            engine->state = APN_ENGINE_STATE_DRAINING;
+            engine->deadline = apn_time_ms() + drain_timeout;
+            return;
+        }
+    }
+
+    bytes_written = apn_ssl_try_write(ctx, engine->buffer, engine->buffer_used, &want);
+    if (0 > bytes_written) {
+        char *error = apn_error_string(errno);
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to write data to a socket: %s (errno: %d)", error, errno);
+        free(error);
+        __apn_engine_error(ctx, errno, engine->batch_first_index);
+        return;
+    } else if (0 == bytes_written) {
+        engine->write_want = want;
+        return;
+    }
+
+    apn_log(ctx, APN_LOG_LEVEL_DEBUG, "%d byte(s) has been written to a socket", bytes_written);
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Notifications have been sent");
+    engine->reconnect_attempts = 0;
+    engine->last_write_size = engine->buffer_used;
+    engine->buffer_used = 0;
+    engine->write_want = APN_POLL_WRITE;
+}
+
+static void __apn_engine_read(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+    uint32_t want = 0;
+    int bytes_read = 0;
+    uint8_t command = 0;
+    uint8_t apple_error_code = 0;
+    uint32_t id = 0;
+    int errcode = 0;
+    uint32_t restart_index = 0;
+
+    bytes_read = apn_ssl_try_read(ctx, engine->response + engine->response_size,
+                                  APN_ERROR_RESPONSE_SIZE - engine->response_size, &want);
+    if (0 == bytes_read) {
+        return;
+    } else if (0 > bytes_read) {
+        char *error = apn_error_string(errno);
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unable to read data from a socket: %s (errno: %d)", error, errno);
+        free(error);
+        if (APN_ENGINE_STATE_DRAINING == engine->state) {
+            __apn_engine_finish(ctx, APN_ERROR, errno);
+        } else {
+            __apn_engine_error(ctx, errno, engine->batch_first_index);
+        }
+        return;
+    }
+
+    apn_log(ctx, APN_LOG_LEVEL_DEBUG, "%d byte(s) has been read from a socket", bytes_read);
+    engine->response_size += (uint32_t) bytes_read;
+    if (engine->response_size < APN_ERROR_RESPONSE_SIZE) {
+        return;
+    }
+    engine->response_size = 0;
+
+    apn_log(ctx, APN_LOG_LEVEL_DEBUG, "Parsing Apple response...");
+    command = (uint8_t) engine->response[0];
+    apple_error_code = (uint8_t) engine->response[1];
+    memcpy(&id, engine->response + 2, sizeof(uint32_t));
+    id = ntohl(id);
+
+    if (8 != command) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Unknown response command %d", command);
+        __apn_engine_error(ctx, APN_ERR_UNKNOWN, engine->batch_first_index);
+        return;
+    }
+
+    apn_log(ctx, APN_LOG_LEVEL_ERROR, "Apple returned error code %d (id: %u)", apple_error_code, id);
+    errcode = __apn_convert_apple_error(apple_error_code);
+
+    if (id >= engine->next_index) {
+        id = engine->batch_first_index;
+    }
+
+    switch (errcode) {
+        case APN_ERR_TOKEN_INVALID:
+            __apn_engine_invalid_token(ctx, id);
+            restart_index = id + 1;
+            break;
+        case APN_ERR_SERVICE_SHUTDOWN:
+            /* Identifier of the last notification that was successfully sent */
+            restart_index = id + 1;
+            break;
+        default:
+            restart_index = id;
+            break;
+    }
+    __apn_engine_error(ctx, errcode, restart_index);
+}
+
+static void __apn_engine_error(apn_ctx_t *const ctx, int errcode, uint32_t restart_index) {
+    apn_engine_t *engine = &ctx->engine;
+    uint8_t has_more = 0;
+    char *error_string = apn_error_string(errcode);
+
+    apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not send notification: %s (errno: %d)", error_string, errcode);
+    apn_strfree(&error_string);
+
+    if (restart_index < engine->next_index) {
+        has_more = 1;
+    } else if (restart_index == engine->next_index) {
+        has_more = (uint8_t) (engine->frame_held || !engine->source_drained);
+    }
+
+    if (has_more) {
+        if (apn_behavior(ctx) & APN_OPTION_RECONNECT &&
+            (errcode == APN_ERR_CONNECTION_CLOSED
+             || errcode == APN_ERR_SERVICE_SHUTDOWN
+             || errcode == APN_ERR_NETWORK_TIMEDOUT
+             || errcode == APN_ERR_NETWORK_UNREACHABLE
+             || errcode == APN_ERR_TOKEN_INVALID)) {
+            apn_ring_drop_before(&engine->ring, restart_index);
+            if (restart_index >= engine->ring.complete_from) {
+                /* Everything sent after the failed notification is retained, replay the exact frames */
+                engine->replay_count = engine->ring.count;
+            } else {
+                apn_ring_reset(&engine->ring, restart_index);
+                engine->replay_count = 0;
+                engine->next_index = restart_index;
+                engine->source_drained = 0;
+                engine->frame_held = 0;
+            }
+            engine->batch_first_index = restart_index;
+            engine->buffer_used = 0;
+            engine->response_size = 0;
+            engine->write_want = APN_POLL_WRITE;
+            __apn_engine_schedule_reconnect(ctx, errcode);
+            return;
+        }
+        __apn_engine_finish(ctx, APN_ERROR, errcode);
+    } else if (errcode == APN_ERR_TOKEN_INVALID) {
+        __apn_engine_finish(ctx, APN_SUCCESS, 0);
+    } else {
+        __apn_engine_finish(ctx, APN_ERROR, errcode);
+    }
+}
+
+static void __apn_engine_schedule_reconnect(apn_ctx_t *const ctx, int errcode) {
+    apn_engine_t *engine = &ctx->engine;
+    uint64_t delay = 0;
+
+    apn_close(ctx);
+    engine->throttled = 0;
+
+    if (ctx->reconnect_max_attempts > 0 && engine->reconnect_attempts >= ctx->reconnect_max_attempts) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Giving up after %u reconnect attempt(s)", engine->reconnect_attempts);
+        __apn_engine_finish(ctx, APN_ERROR, errcode);
+        return;
+    }
+
+    /* Exponential backoff with jitter, so that connections dropped together do not reconnect in lockstep */
+    delay = (uint64_t) ctx->reconnect_delay << (engine->reconnect_attempts < 16 ? engine->reconnect_attempts : 16);
+    if (delay > ctx->reconnect_max_delay) {
+        delay = ctx->reconnect_max_delay;
+    }
+    if (delay > 1) {
+        delay = delay / 2 + __apn_engine_random(engine) % (delay / 2 + 1);
+    }
+
+    engine->reconnect_attempts++;
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Reconnecting in %u ms (attempt %u)...", (uint32_t) delay,
+            engine->reconnect_attempts);
+    engine->state = APN_ENGINE_STATE_RECONNECTING;
+    engine->deadline = apn_time_ms() + delay;
+}
+
+static void __apn_engine_reconnect(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Reconnecting...");
+    if (APN_ERROR == apn_connect_async(ctx)) {
+        __apn_engine_schedule_reconnect(ctx, errno);
+        return;
+    }
+    engine->state = APN_ENGINE_STATE_CONNECTING;
+    engine->deadline = apn_time_ms() + APN_CONNECT_TIMEOUT;
+    engine->connect_want = APN_POLL_WRITE;
+}
+
+static void __apn_engine_connect(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+    uint32_t want = 0;
+    int ret = apn_connect_process(ctx, &want);
+
+    if (ret > 0) {
+        engine->deadline = 0;
+        engine->write_want = APN_POLL_WRITE;
+        engine->state = APN_ENGINE_STATE_SENDING;
+    } else if (ret < 0) {
+        __apn_engine_schedule_reconnect(ctx, errno);
+    } else if (0 == apn_engine_timeout(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Connection timed out");
+        __apn_engine_schedule_reconnect(ctx, APN_ERR_NETWORK_TIMEDOUT);
+    } else {
+        engine->connect_want = want;
+    }
+}
+
+static uint32_t __apn_engine_random(apn_engine_t *const engine) {
+    /* xorshift32 */
+    uint32_t x = engine->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    engine->random_state = x;
+    return x;
+}
+
+static void __apn_engine_finish(apn_ctx_t *const ctx, apn_return result, int error) {
+    apn_engine_t *engine = &ctx->engine;
+    engine->state = APN_ENGINE_STATE_DONE;
+    engine->result = result;
+    engine->error = error;
+    engine->deadline = 0;
+    engine->throttled = 0;
+    engine->frame_held = 0;
+    engine->replay_count = 0;
+    engine->buffer_used = 0;
+    __apn_engine_free_source(engine);
+    if (engine->suppressed_count > 0) {
+        apn_log(ctx, APN_LOG_LEVEL_INFO, "%u notification(s) to suppressed tokens were skipped", engine->suppressed_count);
+    }
+}
+
+static void __apn_engine_invalid_token(apn_ctx_t *const ctx, uint32_t index) {
+    apn_engine_t *engine = &ctx->engine;
+    char token[APN_TOKEN_LENGTH + 1] = {0};
+    uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
+    uint8_t decoded = 0;
+    const apn_ring_record_t *record = apn_ring_find(&engine->ring, index);
+
+    /* a rejected frame is usually still in the ring, which spares the source a rewind */
+    if (record && record->size >= APN_FRAME_TOKEN_OFFSET + APN_TOKEN_BINARY_SIZE) {
+        memcpy(binary_token, engine->ring.data + record->offset + APN_FRAME_TOKEN_OFFSET, APN_TOKEN_BINARY_SIZE);
+        apn_token_hex_encode(binary_token, token);
+        decoded = 1;
+    } else if (!engine->source.token || APN_ERROR == engine->source.token(engine->source.data, index, token)) {
+        token[0] = '\0';
+    } else {
+        decoded = (uint8_t) (APN_SUCCESS == apn_token_hex_decode(token, binary_token));
+    }
+    apn_log(ctx, APN_LOG_LEVEL_ERROR, "Invalid token: %s (index: %u)", token, index);
+
+    if (decoded) {
+        if (!engine->invalid_tokens) {
+            engine->invalid_tokens = apn_token_set_init(0);
+        }
+        if (engine->invalid_tokens) {
+            apn_token_set_add(engine->invalid_tokens, binary_token);
+        }
+        if (ctx->suppression) {
+            apn_suppression_add(ctx->suppression, binary_token);
+        }
+    } else {
+        /* not a hex token, so it is kept as is */
+        if (!engine->malformed_tokens) {
+            engine->malformed_tokens = apn_array_init_arena(10);
+        }
+        if (engine->malformed_tokens) {
+            apn_array_insert_copy(engine->malformed_tokens, token, strlen(token) + 1);
+        }
+    }
+    if (ctx->invalid_token_callback) {
+        ctx->invalid_token_callback(token, index);
+    }
+}
+
+static apn_return __apn_engine_take_result(apn_ctx_t *const ctx) {
+    apn_engine_t *engine = &ctx->engine;
+
+    apn_token_set_free(engine->invalid_tokens);
+    engine->invalid_tokens = NULL;
+    apn_array_free(engine->malformed_tokens);
+    engine->malformed_tokens = NULL;
+    engine->state = APN_ENGINE_STATE_IDLE;
+
+    errno = engine->error;
+    return engine->result;
+}
+
+static apn_array_t *__apn_engine_invalid_token_array(apn_engine_t *const engine) {
+    apn_array_t *malformed_tokens = engine->malformed_tokens;
+    apn_array_t *tokens = NULL;
+    uint32_t i = 0;
+
+    if (!engine->invalid_tokens) {
+        engine->malformed_tokens = NULL;
+        return malformed_tokens;
+    }
+    tokens = apn_token_set_to_array(engine->invalid_tokens);
+    if (!tokens || !malformed_tokens) {
+        return tokens;
+    }
+    /* strings are copied to the arena of the result */
+    for (; i < malformed_tokens->count; i++) {
+        const char *token = malformed_tokens->items[i];
+        if (APN_ERROR == apn_array_insert_copy(tokens, token, strlen(token) + 1)) {
+            break;
+        }
+    }
+    return tokens;
+}
+
+static void __apn_engine_free_source(apn_engine_t *const engine) {
+    if (engine->source.free && engine->source.data) {
+        engine->source.free(engine->source.data);
+    }
+    memset(&engine->source, 0, sizeof(apn_frame_source_t));
+}
+
+static int __apn_convert_apple_error(uint8_t apple_error_code) {
+    if (apple_error_code > 0) {
+        switch (apple_error_code) {
+            case APN_APNS_ERR_PROCESSING_ERROR:
+                return APN_ERR_PROCESSING_ERROR;
+            case APN_APNS_ERR_INVALID_PAYLOAD_SIZE:
+                return APN_ERR_INVALID_PAYLOAD_SIZE;
+            case APN_APNS_ERR_SERVICE_SHUTDOWN:
+                return APN_ERR_SERVICE_SHUTDOWN;
+            case APN_APNS_ERR_INVALID_TOKEN:
+            case APN_APNS_ERR_INVALID_TOKEN_SIZE:
+                return APN_ERR_TOKEN_INVALID;
+            default:
+                return APN_ERR_UNKNOWN;
+        }
+    }
+    return 0;
+}
+
+
+static int __apn_batch_source_next(void *data, uint32_t index, apn_frame_t *frame) {
+    apn_batch_source_data_t *source = (apn_batch_source_data_t *) data;
+    const apn_batch_item_t *item = NULL;
+    apn_binary_message_t *binary_message = NULL;
+
+    if (index >= source->count) {
+        return 0;
+    }
+    item = &source->items[index];
+
+    if (!item->binary_message && item->payload_template) {
+        return __apn_batch_source_render(source, item, index, frame);
+    }
+
+    if (item->binary_message) {
+        binary_message = item->binary_message;
+    } else if (item->payload) {
+        if (item->payload != source->payload || !source->binary_message) {
+            apn_binary_message_free(source->binary_message);
+            source->payload = item->payload;
+            if (NULL == (source->binary_message = apn_create_binary_message(item->payload))) {
+                source->payload = NULL;
+                return -1;
+            }
+        }
+        binary_message = source->binary_message;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (item->token) {
+        if (APN_ERROR == apn_binary_message_patch_token_hex(binary_message, item->token)) {
+            return -1;
+        }
+    } else if (!binary_message->token_hex) {
+        errno = APN_ERR_TOKEN_INVALID;
+        return -1;
+    }
+    apn_binary_message_set_id(binary_message, index);
+
+    frame->data = binary_message->message;
+    frame->size = binary_message->size;
+    frame->token_hex = binary_message->token_hex;
+    return 1;
+}
+
+static int __apn_batch_source_render(apn_batch_source_data_t *const source, const apn_batch_item_t *const item,
+                                     uint32_t index, apn_frame_t *frame) {
+    uint8_t token[APN_TOKEN_BINARY_SIZE];
+    uint32_t frame_size = 0;
+
+    if (!item->token) {
+        errno = APN_ERR_TOKEN_INVALID;
+        return -1;
+    }
+    if (APN_ERROR == apn_token_hex_decode(item->token, token)) {
+        return -1;
+    }
+    if (!source->frame_buffer) {
+        if (NULL == (source->frame_buffer = malloc(apn_binary_message_frame_size(APN_PAYLOAD_MAX_SIZE)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    frame_size = apn_payload_template_write(item->payload_template, item->values, token, index, source->frame_buffer,
+                                            apn_binary_message_frame_size(APN_PAYLOAD_MAX_SIZE));
+    if (0 == frame_size) {
+        return -1;
+    }
+
+    frame->data = source->frame_buffer;
+    frame->size = frame_size;
+    frame->token_hex = item->token;
+    return 1;
+}
+
+static apn_return __apn_batch_source_token(void *data, uint32_t index, char *token_hex) {
+    apn_batch_source_data_t *source = (apn_batch_source_data_t *) data;
+    const apn_batch_item_t *item = NULL;
+    const char *token = NULL;
+
+    if (index >= source->count) {
+        return APN_ERROR;
+    }
+    item = &source->items[index];
+    token = item->token;
+    if (!token && item->binary_message) {
+        token = item->binary_message->token_hex;
+    }
+    if (!token) {
+        return APN_ERROR;
+    }
+    apn_strncpy(token_hex, token, APN_TOKEN_LENGTH + 1, APN_TOKEN_LENGTH);
+    return APN_SUCCESS;
+}
+
+static void __apn_batch_source_free(void *data) {
+    apn_batch_source_data_t *source = (apn_batch_source_data_t *) data;
+    if (source) {
+        apn_binary_message_free(source->binary_message);
+        free(source->frame_buffer);
+        free(source);
+    }
+}
+
+static int __apn_tokens_source_next(void *data, uint32_t index, apn_frame_t *frame) {
+    apn_tokens_source_data_t *source = (apn_tokens_source_data_t *) data;
+    const char *token = NULL;
+    int ret = 0;
+
+    if (index != source->position) {
+        if (APN_ERROR == source->tokens.rewind(source->tokens.data, index)) {
+            return -1;
+        }
+        source->position = index;
+    }
+    if (1 != (ret = source->tokens.next(source->tokens.data, &token))) {
+        return ret;
+    }
+    source->position++;
+
+    apn_binary_message_set_id(source->binary_message, index);
+    if (APN_ERROR == apn_binary_message_patch_token_hex(source->binary_message, token)) {
+        return -1;
+    }
+    frame->data = source->binary_message->message;
+    frame->size = source->binary_message->size;
+    frame->token_hex = source->binary_message->token_hex;
+    return 1;
+}
+
+static apn_return __apn_tokens_source_token(void *data, uint32_t index, char *token_hex) {
+    apn_tokens_source_data_t *source = (apn_tokens_source_data_t *) data;
+    const char *token = NULL;
+
+    if (APN_ERROR == source->tokens.rewind(source->tokens.data, index)) {
+        return APN_ERROR;
+    }
+    source->position = index;
+    if (1 != source->tokens.next(source->tokens.data, &token)) {
+        return APN_ERROR;
+    }
+    source->position++;
+    apn_strncpy(token_hex, token, APN_TOKEN_LENGTH + 1, APN_TOKEN_LENGTH);
+    return APN_SUCCESS;
+}
+
+static void __apn_tokens_source_free(void *data) {
+    apn_tokens_source_data_t *source = (apn_tokens_source_data_t *) data;
+    if (source) {
+        apn_binary_message_free(source->binary_message);
+        apn_token_source_free(&source->tokens);
+        free(source);
+    }
+}
+
+static int __apn_token_set_source_next(void *data, uint32_t index, apn_frame_t *frame) {
+    apn_token_set_source_data_t *source = (apn_token_set_source_data_t *) data;
+    const uint8_t *token = apn_token_set_at(source->tokens, index);
+
+    if (!token) {
+        return 0;
+    }
+    apn_binary_message_set_id(source->binary_message, index);
+    memcpy(source->binary_message->token_position, token, APN_TOKEN_BINARY_SIZE);
+    apn_token_hex_encode(token, source->token_hex);
+
+    frame->data = source->binary_message->message;
+    frame->size = source->binary_message->size;
+    frame->token_hex = source->token_hex;
+    return 1;
+}
+
+static apn_return __apn_token_set_source_token(void *data, uint32_t index, char *token_hex) {
+    apn_token_set_source_data_t *source = (apn_token_set_source_data_t *) data;
+    return apn_token_set_hex_at(source->tokens, index, token_hex);
+}
+
+static void __apn_token_set_source_free(void *data) {
+    apn_token_set_source_data_t *source = (apn_token_set_source_data_t *) data;
+    if (source) {
+        apn_binary_message_free(source->binary_message);
+        free(source);
+    }
+}
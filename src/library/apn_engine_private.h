@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_ENGINE_PRIVATE_H__
+#define __APN_ENGINE_PRIVATE_H__
+
+#include "apn_platform.h"
+#include "apn.h"
+#include "apn_binary_message.h"
+#include "apn_ring.h"
+#include "apn_token_source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Size of an error-response packet: command (8), status code and notification identifier
+ */
+#define APN_ERROR_RESPONSE_SIZE 6
+
+/**
+ * Offset of the device token in a frame: command, frame length, item identifier and item length
+ */
+#define APN_FRAME_TOKEN_OFFSET 8
+
+/**
+ * Interval of checking the socket send queue while the in-flight limit is reached and round-trip time is unknown,
+ * in milliseconds
+ */
+#define APN_INFLIGHT_CHECK_INTERVAL 5
+
+/**
+ * Lower limit of the adaptive wait for an error response, in milliseconds
+ */
+#define APN_DRAIN_TIMEOUT_MIN 20
+
+/**
+ * Number of round trips to wait for an error response once all data is acknowledged
+ */
+#define APN_DRAIN_RTT_FACTOR 3
+
+/**
+ * Time limit for a single reconnect attempt (TCP connect and SSL handshake), in milliseconds
+ */
+#define APN_CONNECT_TIMEOUT 10000
+
+typedef enum __apn_engine_state {
+    APN_ENGINE_STATE_IDLE = 0,
+    APN_ENGINE_STATE_SENDING,
+    APN_ENGINE_STATE_DRAINING,
+    APN_ENGINE_STATE_RECONNECTING,
+    APN_ENGINE_STATE_CONNECTING,
+    APN_ENGINE_STATE_DONE
+} apn_engine_state;
+
+/**
+ * Encoded notification, returned by a frame source
+ */
+typedef struct __apn_frame_t {
+    const uint8_t *data;
+    uint32_t size;
+    /** Hex representation of the device token, used for logging. Can be NULL */
+    const char *token_hex;
+} apn_frame_t;
+
+/**
+ * Produces encoded notifications for the send engine.
+ *
+ * Items are addressed by index which is also used as the notification identifier,
+ * so the engine is able to restart from any item after Apple reports an error.
+ */
+typedef struct __apn_frame_source_t {
+    void *data;
+
+    /**
+     * Encodes the item at `index`. Returned frame must stay valid until the next call.
+     *
+     * @return
+     *      - 1 on success.
+     *      - 0 if there are no more items.
+     *      - -1 if the item cannot be encoded, with error information stored in `errno`.
+     *      ::APN_ERR_TOKEN_INVALID means the item is skipped and reported as invalid.
+     */
+    int (*next)(void *data, uint32_t index, apn_frame_t *frame);
+
+    /**
+     * Copies the device token of the item at `index` to `token_hex`
+     * (at least APN_TOKEN_LENGTH + 1 bytes).
+     */
+    apn_return (*token)(void *data, uint32_t index, char *token_hex);
+
+    /** Frees `data`. Can be NULL */
+    void (*free)(void *data);
+} apn_frame_source_t;
+
+typedef struct __apn_engine_t {
+    apn_engine_state state;
+    apn_frame_source_t source;
+    uint8_t source_drained;
+
+    /** Frame which did not fit into the previous batch */
+    apn_frame_t held_frame;
+    uint8_t frame_held;
+
+    /** Index of the next item to take from the source */
+    uint32_t next_index;
+
+    /** Index of the first item of the most recent batch */
+    uint32_t batch_first_index;
+
+    /** Frames handed to the socket, replayed after Apple reports an error */
+    apn_ring_t ring;
+    /** Number of newest frames in the ring which have to be sent again */
+    uint32_t replay_count;
+
+    uint8_t *buffer;
+    uint32_t buffer_size;
+    uint32_t buffer_used;
+    /** Size of the last successful write */
+    uint32_t last_write_size;
+
+    char response[APN_ERROR_RESPONSE_SIZE];
+    uint32_t response_size;
+
+    /** Events the SSL layer waits for before the pending write can be retried */
+    uint32_t write_want;
+
+    /** Deadline of the current state, 0 if not set */
+    uint64_t deadline;
+    /** Writing is paused by a rate or in-flight limit until the deadline */
+    uint8_t throttled;
+
+    /** Reconnects scheduled since the last successful write */
+    uint32_t reconnect_attempts;
+    /** Events the pending connection waits for */
+    uint32_t connect_want;
+    uint32_t random_state;
+
+    /** Frames skipped because their token is in the suppression list */
+    uint32_t suppressed_count;
+
+    /** Rejected tokens */
+    apn_token_set_t *invalid_tokens;
+    /** Tokens skipped by the source because they are not valid hex */
+    apn_array_t *malformed_tokens;
+    apn_return result;
+    int error;
+} apn_engine_t;
+
+void apn_engine_init(apn_engine_t *const engine)
+        __apn_attribute_nonnull__((1));
+
+void apn_engine_free(apn_engine_t *const engine)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Starts sending items of `source` beginning with `first_index`.
+ * The engine takes ownership of the source, which is freed also when the engine fails to start.
+ */
+apn_return apn_engine_start(apn_ctx_t *const ctx, const apn_frame_source_t *const source, uint32_t first_index)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns ::APN_POLL_READ and/or ::APN_POLL_WRITE events the engine waits for.
+ */
+uint32_t apn_engine_events(const apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns number of milliseconds until the engine has to be processed regardless of socket events,
+ * or -1 if there is no deadline.
+ */
+int apn_engine_timeout(const apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Advances the engine. Never blocks on the socket.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure.
+ * @param[in] revents - Ready socket events (::APN_POLL_READ, ::APN_POLL_WRITE).
+ */
+void apn_engine_process(apn_ctx_t *const ctx, uint32_t revents)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns 1 if the engine is sending, waiting for an error response or reconnecting.
+ */
+uint8_t apn_engine_busy(const apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Processes the engine until it finishes, blocking the calling thread.
+ */
+void apn_engine_wait(apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Processes the engine until all notifications are written and it waits for an error response
+ * or finishes, blocking the calling thread.
+ */
+void apn_engine_wait_written(apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns result of the last finished send and moves the engine to the idle state.
+ *
+ * @param[in, out] invalid_tokens - Receives array of invalid tokens, if any. Can be NULL.
+ */
+apn_return apn_engine_result(apn_ctx_t *const ctx, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Same as ::apn_engine_result(), returning invalid tokens as a set. Tokens which are not valid hex
+ * are only logged and reported to the invalid token callback.
+ *
+ * @param[in, out] invalid_tokens - Receives set of invalid tokens, if any. Can be NULL.
+ */
+apn_return apn_engine_result_token_set(apn_ctx_t *const ctx, apn_token_set_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Initializes a frame source which sends items of a batch, see ::apn_send_batch().
+ */
+apn_return apn_frame_source_batch(apn_frame_source_t *const source, const apn_batch_item_t *items, uint32_t count)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Initializes a frame source which sends `binary_message` to each device of `tokens`.
+ * The source takes ownership of `binary_message`, `tokens` must stay valid until the send finishes.
+ */
+apn_return apn_frame_source_token_set(apn_frame_source_t *const source, apn_binary_message_t *binary_message,
+                                      const apn_token_set_t *const tokens)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Initializes a frame source which sends `binary_message` to each device read from `tokens`.
+ * The source takes ownership of `binary_message` and `tokens`.
+ */
+apn_return apn_frame_source_tokens(apn_frame_source_t *const source, apn_binary_message_t *binary_message,
+                                   const apn_token_source_t *const tokens)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_json.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "apn_strings.h"
+#include "apn.h"
+
+/* nesting limit of the validator, which recurses on arrays and objects */
+#define APN_JSON_MAX_DEPTH 64
+
+/* 1 if the byte is written as it is inside a JSON string */
+static const uint8_t __apn_json_plain[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+typedef struct __apn_json_scanner_t {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t depth;
+    int error;
+} apn_json_scanner_t;
+
+static void __apn_json_write_escape(apn_json_writer_t *const writer, uint8_t c);
+static size_t __apn_json_escaped_size(uint8_t c);
+
+static void __apn_json_skip_whitespace(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_value(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_object(apn_json_scanner_t *const scanner, uint8_t *const has_aps);
+static uint8_t __apn_json_scan_array(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_string(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_utf8(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_number(apn_json_scanner_t *const scanner);
+static uint8_t __apn_json_scan_literal(apn_json_scanner_t *const scanner, const char *const literal, size_t length);
+static uint8_t __apn_json_fail(apn_json_scanner_t *const scanner, int error);
+
+void apn_json_writer_init(apn_json_writer_t *const writer, char *const buffer, size_t size) {
+    assert(writer);
+    assert(buffer);
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = 0;
+}
+
+void apn_json_writer_init_measure(apn_json_writer_t *const writer) {
+    assert(writer);
+    writer->buffer = NULL;
+    writer->size = SIZE_MAX;
+    writer->length = 0;
+    writer->overflow = 0;
+}
+
+void apn_json_write_raw(apn_json_writer_t *const writer, const char *const data, size_t length) {
+    assert(writer);
+    assert(data);
+
+    if (writer->overflow) {
+        return;
+    }
+    if (length > writer->size - writer->length) {
+        writer->overflow = 1;
+        return;
+    }
+    if (writer->buffer) {
+        memcpy(writer->buffer + writer->length, data, length);
+    }
+    writer->length += length;
+}
+
+void apn_json_write_string(apn_json_writer_t *const writer, const char *const value, size_t length) {
+    assert(writer);
+    assert(value);
+
+    apn_json_write_raw(writer, "\"", 1);
+    apn_json_write_escaped(writer, value, length);
+    apn_json_write_raw(writer, "\"", 1);
+}
+
+void apn_json_write_escaped(apn_json_writer_t *const writer, const char *const value, size_t length) {
+    const uint8_t *p = (const uint8_t *) value;
+    const uint8_t *end = p + length;
+    assert(writer);
+    assert(value);
+
+    while (p < end && !writer->overflow) {
+        const uint8_t *run = p;
+        while (p < end && __apn_json_plain[*p]) {
+            p++;
+        }
+        if (p > run) {
+            apn_json_write_raw(writer, (const char *) run, (size_t) (p - run));
+        }
+        if (p < end) {
+            __apn_json_write_escape(writer, *p++);
+        }
+    }
+}
+
+size_t apn_json_escaped_prefix(const char *const value, size_t length, size_t budget) {
+    const uint8_t *p = (const uint8_t *) value;
+    size_t escaped_size = 0;
+    size_t prefix = 0;
+    size_t i = 0;
+    assert(value);
+
+    for (i = 0; i < length; i++) {
+        /* continuation bytes (10xxxxxx) never start a character */
+        if (0x80 != (p[i] & 0xC0)) {
+            prefix = i;
+        }
+        escaped_size += __apn_json_escaped_size(p[i]);
+        if (escaped_size > budget) {
+            return prefix;
+        }
+    }
+    return length;
+}
+
+void apn_json_write_key(apn_json_writer_t *const writer, const char *const key, uint8_t first) {
+    assert(writer);
+    assert(key);
+
+    if (!first) {
+        apn_json_write_raw(writer, ",", 1);
+    }
+    apn_json_write_string(writer, key, strlen(key));
+    apn_json_write_raw(writer, ":", 1);
+}
+
+void apn_json_write_integer(apn_json_writer_t *const writer, int64_t value) {
+    char digits[21];
+    char *p = digits + sizeof(digits);
+    /* unsigned, so INT64_MIN negates without overflow */
+    uint64_t magnitude = (value < 0) ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+    assert(writer);
+
+    do {
+        *--p = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    apn_json_write_raw(writer, p, (size_t) (digits + sizeof(digits) - p));
+}
+
+apn_return apn_json_write_real(apn_json_writer_t *const writer, double value) {
+    char number[32];
+    int length = 0;
+    int i = 0;
+    assert(writer);
+
+    if (value != value || value > DBL_MAX || value < -DBL_MAX) {
+        return APN_ERROR;
+    }
+    length = apn_snprintf(number, sizeof(number) - 2, "%.17g", value);
+    if (length < 0 || length >= (int) sizeof(number) - 2) {
+        return APN_ERROR;
+    }
+    /* the decimal point depends on the locale */
+    for (i = 0; i < length; i++) {
+        if (',' == number[i]) {
+            number[i] = '.';
+        }
+    }
+    if (!strpbrk(number, ".e")) {
+        number[length++] = '.';
+        number[length++] = '0';
+    }
+    apn_json_write_raw(writer, number, (size_t) length);
+    return APN_SUCCESS;
+}
+
+apn_return apn_json_validate_payload(const char *const json, size_t length) {
+    apn_json_scanner_t scanner;
+    uint8_t has_aps = 0;
+    assert(json);
+
+    scanner.p = (const uint8_t *) json;
+    scanner.end = scanner.p + length;
+    scanner.depth = 0;
+    scanner.error = APN_ERR_PAYLOAD_JSON_INVALID;
+
+    __apn_json_skip_whitespace(&scanner);
+    if (scanner.p == scanner.end || '{' != *scanner.p || !__apn_json_scan_object(&scanner, &has_aps)) {
+        errno = scanner.error;
+        return APN_ERROR;
+    }
+    __apn_json_skip_whitespace(&scanner);
+    if (scanner.p != scanner.end || !has_aps) {
+        errno = APN_ERR_PAYLOAD_JSON_INVALID;
+        return APN_ERROR;
+    }
+    return APN_SUCCESS;
+}
+
+/* Size of byte `c` inside a JSON string, as written by apn_json_write_escaped() */
+static size_t __apn_json_escaped_size(uint8_t c) {
+    if (__apn_json_plain[c]) {
+        return 1;
+    }
+    switch (c) {
+        case '"':
+        case '\\':
+        case '\b':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+            return 2;
+        default:
+            return 6;
+    }
+}
+
+static void __apn_json_write_escape(apn_json_writer_t *const writer, uint8_t c) {
+    static const char hex[] = "0123456789ABCDEF";
+    char escape[6] = {'\\', 'u', '0', '0', 0, 0};
+    switch (c) {
+        case '"':
+            apn_json_write_raw(writer, "\\\"", 2);
+            break;
+        case '\\':
+            apn_json_write_raw(writer, "\\\\", 2);
+            break;
+        case '\b':
+            apn_json_write_raw(writer, "\\b", 2);
+            break;
+        case '\f':
+            apn_json_write_raw(writer, "\\f", 2);
+            break;
+        case '\n':
+            apn_json_write_raw(writer, "\\n", 2);
+            break;
+        case '\r':
+            apn_json_write_raw(writer, "\\r", 2);
+            break;
+        case '\t':
+            apn_json_write_raw(writer, "\\t", 2);
+            break;
+        default:
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0x0F];
+            apn_json_write_raw(writer, escape, sizeof(escape));
+            break;
+    }
+}
+
+static void __apn_json_skip_whitespace(apn_json_scanner_t *const scanner) {
+    while (scanner->p < scanner->end
+           && (' ' == *scanner->p || '\t' == *scanner->p || '\n' == *scanner->p || '\r' == *scanner->p)) {
+        scanner->p++;
+    }
+}
+
+static uint8_t __apn_json_scan_value(apn_json_scanner_t *const scanner) {
+    if (scanner->p == scanner->end) {
+        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+    }
+    switch (*scanner->p) {
+        case '{':
+            return __apn_json_scan_object(scanner, NULL);
+        case '[':
+            return __apn_json_scan_array(scanner);
+        case '"':
+            return __apn_json_scan_string(scanner);
+        case 't':
+            return __apn_json_scan_literal(scanner, "true", 4);
+        case 'f':
+            return __apn_json_scan_literal(scanner, "false", 5);
+        case 'n':
+            return __apn_json_scan_literal(scanner, "null", 4);
+        default:
+            return __apn_json_scan_number(scanner);
+    }
+}
+
+/* `has_aps` is set for the root object only, it receives 1 if the object has an "aps" object member */
+static uint8_t __apn_json_scan_object(apn_json_scanner_t *const scanner, uint8_t *const has_aps) {
+    if (++scanner->depth > APN_JSON_MAX_DEPTH) {
+        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+    }
+    scanner->p++;
+    __apn_json_skip_whitespace(scanner);
+    if (scanner->p < scanner->end && '}' == *scanner->p) {
+        scanner->p++;
+        scanner->depth--;
+        return 1;
+    }
+    for (;;) {
+        const uint8_t *key = scanner->p;
+        uint8_t aps = 0;
+        if (scanner->p == scanner->end || '"' != *scanner->p) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        if (!__apn_json_scan_string(scanner)) {
+            return 0;
+        }
+        aps = (uint8_t) (has_aps && 5 == scanner->p - key && 0 == memcmp(key, "\"aps\"", 5));
+        __apn_json_skip_whitespace(scanner);
+        if (scanner->p == scanner->end || ':' != *scanner->p) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        scanner->p++;
+        __apn_json_skip_whitespace(scanner);
+        if (aps && scanner->p < scanner->end && '{' == *scanner->p) {
+            *has_aps = 1;
+        }
+        if (!__apn_json_scan_value(scanner)) {
+            return 0;
+        }
+        __apn_json_skip_whitespace(scanner);
+        if (scanner->p == scanner->end) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        if ('}' == *scanner->p) {
+            scanner->p++;
+            scanner->depth--;
+            return 1;
+        }
+        if (',' != *scanner->p) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        scanner->p++;
+        __apn_json_skip_whitespace(scanner);
+    }
+}
+
+static uint8_t __apn_json_scan_array(apn_json_scanner_t *const scanner) {
+    if (++scanner->depth > APN_JSON_MAX_DEPTH) {
+        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+    }
+    scanner->p++;
+    __apn_json_skip_whitespace(scanner);
+    if (scanner->p < scanner->end && ']' == *scanner->p) {
+        scanner->p++;
+        scanner->depth--;
+        return 1;
+    }
+    for (;;) {
+        if (!__apn_json_scan_value(scanner)) {
+            return 0;
+        }
+        __apn_json_skip_whitespace(scanner);
+        if (scanner->p == scanner->end) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        if (']' == *scanner->p) {
+            scanner->p++;
+            scanner->depth--;
+            return 1;
+        }
+        if (',' != *scanner->p) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        scanner->p++;
+        __apn_json_skip_whitespace(scanner);
+    }
+}
+
+static uint8_t __apn_json_scan_string(apn_json_scanner_t *const scanner) {
+    uint8_t i = 0;
+    scanner->p++;
+    while (scanner->p < scanner->end) {
+        uint8_t c = *scanner->p;
+        if ('"' == c) {
+            scanner->p++;
+            return 1;
+        }
+        if (c < 0x20) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+        if (c >= 0x80) {
+            if (!__apn_json_scan_utf8(scanner)) {
+                return 0;
+            }
+            continue;
+        }
+        scanner->p++;
+        if ('\\' == c) {
+            if (scanner->p == scanner->end || !strchr("\"\\/bfnrtu", *scanner->p) || !*scanner->p) {
+                return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+            }
+            if ('u' == *scanner->p++) {
+                for (i = 0; i < 4; i++, scanner->p++) {
+                    if (scanner->p == scanner->end || !isxdigit(*scanner->p)) {
+                        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+                    }
+                }
+            }
+        }
+    }
+    return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+}
+
+/* Validates one multi-byte UTF-8 sequence, rejecting overlong forms, surrogates and code points above U+10FFFF */
+static uint8_t __apn_json_scan_utf8(apn_json_scanner_t *const scanner) {
+    const uint8_t *p = scanner->p;
+    uint8_t lower = 0x80;
+    uint8_t upper = 0xBF;
+    size_t size = 0;
+    size_t i = 0;
+
+    if (*p >= 0xC2 && *p <= 0xDF) {
+        size = 2;
+    } else if (*p >= 0xE0 && *p <= 0xEF) {
+        size = 3;
+        if (0xE0 == *p) {
+            lower = 0xA0;
+        } else if (0xED == *p) {
+            upper = 0x9F;
+        }
+    } else if (*p >= 0xF0 && *p <= 0xF4) {
+        size = 4;
+        if (0xF0 == *p) {
+            lower = 0x90;
+        } else if (0xF4 == *p) {
+            upper = 0x8F;
+        }
+    } else {
+        return __apn_json_fail(scanner, APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS);
+    }
+    if ((size_t) (scanner->end - p) < size || p[1] < lower || p[1] > upper) {
+        return __apn_json_fail(scanner, APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS);
+    }
+    for (i = 2; i < size; i++) {
+        if (p[i] < 0x80 || p[i] > 0xBF) {
+            return __apn_json_fail(scanner, APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS);
+        }
+    }
+    scanner->p += size;
+    return 1;
+}
+
+static uint8_t __apn_json_scan_number(apn_json_scanner_t *const scanner) {
+    const uint8_t *digits = NULL;
+    if (scanner->p < scanner->end && '-' == *scanner->p) {
+        scanner->p++;
+    }
+    digits = scanner->p;
+    while (scanner->p < scanner->end && isdigit(*scanner->p)) {
+        scanner->p++;
+    }
+    if (scanner->p == digits || (scanner->p - digits > 1 && '0' == *digits)) {
+        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+    }
+    if (scanner->p < scanner->end && '.' == *scanner->p) {
+        digits = ++scanner->p;
+        while (scanner->p < scanner->end && isdigit(*scanner->p)) {
+            scanner->p++;
+        }
+        if (scanner->p == digits) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+    }
+    if (scanner->p < scanner->end && ('e' == *scanner->p || 'E' == *scanner->p)) {
+        scanner->p++;
+        if (scanner->p < scanner->end && ('+' == *scanner->p || '-' == *scanner->p)) {
+            scanner->p++;
+        }
+        digits = scanner->p;
+        while (scanner->p < scanner->end && isdigit(*scanner->p)) {
+            scanner->p++;
+        }
+        if (scanner->p == digits) {
+            return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+        }
+    }
+    return 1;
+}
+
+static uint8_t __apn_json_scan_literal(apn_json_scanner_t *const scanner, const char *const literal, size_t length) {
+    if ((size_t) (scanner->end - scanner->p) < length || 0 != memcmp(scanner->p, literal, length)) {
+        return __apn_json_fail(scanner, APN_ERR_PAYLOAD_JSON_INVALID);
+    }
+    scanner->p += length;
+    return 1;
+}
+
+static uint8_t __apn_json_fail(apn_json_scanner_t *const scanner, int error) {
+    scanner->error = error;
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_JSON_H__
+#define __APN_JSON_H__
+
+#include "apn_platform.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Writes JSON text straight into a caller-provided buffer. Writing stops at the first value which does not fit
+ * and `overflow` is set, so a document which is too large is rejected without being rendered in full.
+ * Output is compact, without whitespace between tokens, and reals are written with 17 significant digits.
+ *
+ * A writer without a buffer only counts the length of the text, see ::apn_json_writer_init_measure().
+ */
+typedef struct __apn_json_writer_t {
+    char *buffer;
+    size_t size;
+    size_t length;
+    uint8_t overflow;
+} apn_json_writer_t;
+
+void apn_json_writer_init(apn_json_writer_t *const writer, char *const buffer, size_t size)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Initializes a writer which stores nothing and never overflows, `length` receives the size of the text.
+ */
+void apn_json_writer_init_measure(apn_json_writer_t *const writer)
+        __apn_attribute_nonnull__((1));
+
+void apn_json_write_raw(apn_json_writer_t *const writer, const char *const data, size_t length)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Writes `value` as a quoted JSON string. `"`, `\` and control characters are escaped,
+ * other bytes (including UTF-8 sequences) are copied as they are.
+ */
+void apn_json_write_string(apn_json_writer_t *const writer, const char *const value, size_t length)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Writes `value` escaped as by ::apn_json_write_string() but without the quotes,
+ * e.g. into a string literal which is already open.
+ */
+void apn_json_write_escaped(apn_json_writer_t *const writer, const char *const value, size_t length)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns length of the longest prefix of UTF-8 string `value` which ends on a character boundary
+ * and takes at most `budget` bytes once escaped by ::apn_json_write_escaped().
+ */
+size_t apn_json_escaped_prefix(const char *const value, size_t length, size_t budget)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Writes `,"key":`, or `"key":` if `first` is not 0.
+ */
+void apn_json_write_key(apn_json_writer_t *const writer, const char *const key, uint8_t first)
+        __apn_attribute_nonnull__((1,2));
+
+void apn_json_write_integer(apn_json_writer_t *const writer, int64_t value)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Writes a real number with 17 significant digits, always with a fraction or an exponent.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if `value` is not finite, nothing is written.
+ */
+apn_return apn_json_write_real(apn_json_writer_t *const writer, double value)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Checks in a single pass, without allocating memory, that `json` is a well-formed JSON document
+ * whose strings are valid UTF-8 and whose root is an object with an `aps` object member.
+ *
+ * @return
+ *      - ::APN_SUCCESS if the document is a valid payload.
+ *      - ::APN_ERROR otherwise, `errno` is set to ::APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS
+ *      or ::APN_ERR_PAYLOAD_JSON_INVALID.
+ */
+apn_return apn_json_validate_payload(const char *const json, size_t length)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
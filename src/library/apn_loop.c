@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_loop.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef APN_HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef APN_HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef APN_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "apn_private.h"
+#include "apn_engine_private.h"
+#include "apn_poll.h"
+#include "apn_log.h"
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+typedef struct __apn_loop_entry_t {
+    apn_ctx_t *ctx;
+    apn_loop_callback callback;
+    void *arg;
+    /** Socket and connection registered in the backend, -1 if none */
+    SOCKET sock;
+    uint32_t connection_id;
+    uint32_t events;
+    uint32_t revents;
+    uint8_t busy;
+    uint8_t ready_pending;
+    uint8_t removed;
+} apn_loop_entry_t;
+
+struct __apn_loop_t {
+    apn_loop_entry_t **entries;
+    uint32_t count;
+    uint32_t allocated;
+    uint8_t dispatching;
+    uint8_t has_removed;
+#ifdef APN_HAVE_SYS_EPOLL_H
+    int epoll_fd;
+    struct epoll_event *epoll_events;
+#endif
+    struct pollfd *pollfds;
+    uint32_t pollfds_allocated;
+};
+
+static apn_return __apn_loop_register(apn_loop_t *const loop, apn_loop_entry_t *const entry, uint32_t events);
+static void __apn_loop_unregister(apn_loop_t *const loop, apn_loop_entry_t *const entry);
+static apn_return __apn_loop_wait(apn_loop_t *const loop, int timeout);
+static void __apn_loop_dispatch(apn_loop_t *const loop, apn_loop_entry_t *const entry);
+static void __apn_loop_cleanup(apn_loop_t *const loop);
+static apn_loop_entry_t *__apn_loop_find(const apn_loop_t *const loop, const apn_ctx_t *const ctx);
+
+apn_loop_t *apn_loop_init() {
+    apn_loop_t *loop = malloc(sizeof(apn_loop_t));
+    if (!loop) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    loop->entries = NULL;
+    loop->count = 0;
+    loop->allocated = 0;
+    loop->dispatching = 0;
+    loop->has_removed = 0;
+    loop->pollfds = NULL;
+    loop->pollfds_allocated = 0;
+#ifdef APN_HAVE_SYS_EPOLL_H
+    loop->epoll_events = NULL;
+    /* Falls back to poll() if epoll is not usable */
+    loop->epoll_fd = epoll_create(16);
+#endif
+    return loop;
+}
+
+void apn_loop_free(apn_loop_t *loop) {
+    uint32_t i = 0;
+    if (loop) {
+        for (i = 0; i < loop->count; i++) {
+            free(loop->entries[i]);
+        }
+        free(loop->entries);
+        free(loop->pollfds);
+#ifdef APN_HAVE_SYS_EPOLL_H
+        free(loop->epoll_events);
+        if (loop->epoll_fd >= 0) {
+            close(loop->epoll_fd);
+        }
+#endif
+        free(loop);
+    }
+}
+
+apn_return apn_loop_add(apn_loop_t *const loop, apn_ctx_t *const ctx, apn_loop_callback callback, void *arg) {
+    apn_loop_entry_t *entry = NULL;
+    assert(loop);
+    assert(ctx);
+
+    entry = __apn_loop_find(loop, ctx);
+    if (entry) {
+        entry->callback = callback;
+        entry->arg = arg;
+        return APN_SUCCESS;
+    }
+
+    if (loop->count == loop->allocated) {
+        uint32_t allocated = loop->allocated ? loop->allocated * 2 : 8;
+        apn_loop_entry_t **entries = realloc(loop->entries, allocated * sizeof(apn_loop_entry_t *));
+        if (!entries) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        loop->entries = entries;
+        loop->allocated = allocated;
+    }
+
+    /* Entries are allocated separately so that pointers handed to epoll stay valid */
+    entry = malloc(sizeof(apn_loop_entry_t));
+    if (!entry) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    entry->ctx = ctx;
+    entry->callback = callback;
+    entry->arg = arg;
+    entry->sock = -1;
+    entry->connection_id = 0;
+    entry->events = 0;
+    entry->revents = 0;
+    entry->busy = apn_engine_busy(ctx);
+    entry->ready_pending = (uint8_t) !entry->busy;
+    entry->removed = 0;
+    loop->entries[loop->count++] = entry;
+    return APN_SUCCESS;
+}
+
+void apn_loop_remove(apn_loop_t *const loop, apn_ctx_t *const ctx) {
+    apn_loop_entry_t *entry = NULL;
+    assert(loop);
+    assert(ctx);
+
+    entry = __apn_loop_find(loop, ctx);
+    if (!entry) {
+        return;
+    }
+    __apn_loop_unregister(loop, entry);
+    entry->removed = 1;
+    loop->has_removed = 1;
+    if (!loop->dispatching) {
+        __apn_loop_cleanup(loop);
+    }
+}
+
+apn_return apn_loop_run_once(apn_loop_t *const loop, int timeout) {
+    uint32_t i = 0;
+    uint32_t count = 0;
+    assert(loop);
+
+    for (i = 0; i < loop->count; i++) {
+        apn_loop_entry_t *entry = loop->entries[i];
+        apn_ctx_t *ctx = entry->ctx;
+        uint32_t events = 0;
+
+        if (entry->ready_pending) {
+            timeout = 0;
+        }
+
+        entry->busy = apn_engine_busy(ctx);
+        if (entry->busy) {
+            int engine_timeout = apn_engine_timeout(ctx);
+            if (engine_timeout >= 0 && (timeout < 0 || engine_timeout < timeout)) {
+                timeout = engine_timeout;
+            }
+            events = apn_engine_events(ctx);
+        } else if (ctx->ssl) {
+            events = APN_POLL_READ;
+            if (SSL_pending(ctx->ssl) > 0) {
+                timeout = 0;
+            }
+        }
+
+        if (APN_ERROR == __apn_loop_register(loop, entry, events)) {
+            return APN_ERROR;
+        }
+    }
+
+    if (APN_ERROR == __apn_loop_wait(loop, timeout)) {
+        return APN_ERROR;
+    }
+
+    loop->dispatching = 1;
+    /* Callbacks may add connections, only those present before the wait are dispatched */
+    count = loop->count;
+    for (i = 0; i < count; i++) {
+        apn_loop_entry_t *entry = loop->entries[i];
+        if (!entry->removed) {
+            __apn_loop_dispatch(loop, entry);
+        }
+    }
+    loop->dispatching = 0;
+
+    if (loop->has_removed) {
+        __apn_loop_cleanup(loop);
+    }
+    return APN_SUCCESS;
+}
+
+apn_return apn_loop_run(apn_loop_t *const loop) {
+    assert(loop);
+    for (;;) {
+        uint32_t i = 0;
+        uint8_t busy = 0;
+        for (i = 0; i < loop->count; i++) {
+            if (loop->entries[i]->ready_pending || apn_engine_busy(loop->entries[i]->ctx)) {
+                busy = 1;
+                break;
+            }
+        }
+        if (!busy) {
+            break;
+        }
+        if (APN_ERROR == apn_loop_run_once(loop, -1)) {
+            return APN_ERROR;
+        }
+    }
+    return APN_SUCCESS;
+}
+
+static void __apn_loop_dispatch(apn_loop_t *const loop, apn_loop_entry_t *const entry) {
+    apn_ctx_t *ctx = entry->ctx;
+    uint32_t revents = entry->revents;
+    uint8_t busy = 0;
+
+    entry->revents = 0;
+
+    if (apn_engine_busy(ctx)) {
+        if (revents || 0 == apn_engine_timeout(ctx)) {
+            apn_engine_process(ctx, revents);
+        }
+    } else if ((revents & APN_POLL_READ) && entry->callback) {
+        entry->callback(loop, ctx, APN_LOOP_EVENT_READABLE, entry->arg);
+        if (entry->removed) {
+            return;
+        }
+    }
+
+    busy = apn_engine_busy(ctx);
+    if (entry->busy && !busy) {
+        entry->ready_pending = 1;
+    }
+    entry->busy = busy;
+
+    if (entry->ready_pending && !entry->busy) {
+        entry->ready_pending = 0;
+        if (entry->callback) {
+            entry->callback(loop, ctx, APN_LOOP_EVENT_READY, entry->arg);
+            if (entry->removed) {
+                return;
+            }
+        }
+        entry->busy = apn_engine_busy(ctx);
+    }
+}
+
+static apn_return __apn_loop_register(apn_loop_t *const loop, apn_loop_entry_t *const entry, uint32_t events) {
+    apn_ctx_t *ctx = entry->ctx;
+
+    if (entry->sock != ctx->sock || entry->connection_id != ctx->connection_id) {
+        /* Closed sockets are dropped by epoll automatically */
+        entry->sock = -1;
+        entry->events = 0;
+    }
+
+#ifdef APN_HAVE_SYS_EPOLL_H
+    if (loop->epoll_fd >= 0) {
+        struct epoll_event event;
+
+        if (ctx->sock == -1 || (entry->sock != -1 && entry->events == events)) {
+            return APN_SUCCESS;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.data.ptr = entry;
+        if (events & APN_POLL_READ) {
+            event.events |= EPOLLIN;
+        }
+        if (events & APN_POLL_WRITE) {
+            event.events |= EPOLLOUT;
+        }
+
+        if (entry->sock == -1) {
+            if (0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, ctx->sock, &event)) {
+                if (EEXIST != errno || 0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, ctx->sock, &event)) {
+                    return APN_ERROR;
+                }
+            }
+        } else if (0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, ctx->sock, &event)) {
+            if (ENOENT != errno || 0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, ctx->sock, &event)) {
+                return APN_ERROR;
+            }
+        }
+    }
+#else
+    (void) loop;
+#endif
+
+    entry->sock = ctx->sock;
+    entry->connection_id = ctx->connection_id;
+    entry->events = events;
+    return APN_SUCCESS;
+}
+
+static void __apn_loop_unregister(apn_loop_t *const loop, apn_loop_entry_t *const entry) {
+#ifdef APN_HAVE_SYS_EPOLL_H
+    if (loop->epoll_fd >= 0 && entry->sock != -1
+        && entry->sock == entry->ctx->sock && entry->connection_id == entry->ctx->connection_id) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, entry->sock, &event);
+    }
+#else
+    (void) loop;
+#endif
+    entry->sock = -1;
+    entry->events = 0;
+}
+
+static apn_return __apn_loop_wait(apn_loop_t *const loop, int timeout) {
+    uint32_t i = 0;
+    int ret = 0;
+
+#ifdef APN_HAVE_SYS_EPOLL_H
+    if (loop->epoll_fd >= 0) {
+        if (loop->count > 0) {
+            struct epoll_event *epoll_events = realloc(loop->epoll_events, loop->count * sizeof(struct epoll_event));
+            if (!epoll_events) {
+                errno = ENOMEM;
+                return APN_ERROR;
+            }
+            loop->epoll_events = epoll_events;
+        }
+        do {
+            ret = epoll_wait(loop->epoll_fd, loop->epoll_events, (int) (loop->count ? loop->count : 1), timeout);
+        } while (ret < 0 && EINTR == errno);
+        if (ret < 0) {
+            return APN_ERROR;
+        }
+        for (i = 0; i < (uint32_t) ret; i++) {
+            apn_loop_entry_t *entry = (apn_loop_entry_t *) loop->epoll_events[i].data.ptr;
+            uint32_t events = loop->epoll_events[i].events;
+            if (events & EPOLLIN) {
+                entry->revents |= APN_POLL_READ;
+            }
+            if (events & EPOLLOUT) {
+                entry->revents |= APN_POLL_WRITE;
+            }
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                entry->revents |= APN_POLL_ERROR | (entry->events & APN_POLL_READ);
+            }
+        }
+        return APN_SUCCESS;
+    }
+#endif
+
+    if (loop->count > loop->pollfds_allocated) {
+        struct pollfd *pollfds = realloc(loop->pollfds, loop->count * sizeof(struct pollfd));
+        if (!pollfds) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        loop->pollfds = pollfds;
+        loop->pollfds_allocated = loop->count;
+    }
+
+    for (i = 0; i < loop->count; i++) {
+        apn_loop_entry_t *entry = loop->entries[i];
+        loop->pollfds[i].fd = entry->events ? entry->sock : -1;
+        loop->pollfds[i].events = 0;
+        loop->pollfds[i].revents = 0;
+        if (entry->events & APN_POLL_READ) {
+            loop->pollfds[i].events |= POLLIN;
+        }
+        if (entry->events & APN_POLL_WRITE) {
+            loop->pollfds[i].events |= POLLOUT;
+        }
+    }
+
+#ifdef _WIN32
+    if (0 == loop->count) {
+        Sleep(timeout < 0 ? INFINITE : (DWORD) timeout);
+        return APN_SUCCESS;
+    }
+#endif
+
+    do {
+        ret = poll(loop->pollfds, loop->count, timeout);
+    } while (ret < 0 && EINTR == errno);
+    if (ret < 0) {
+        return APN_ERROR;
+    }
+
+    for (i = 0; ret > 0 && i < loop->count; i++) {
+        apn_loop_entry_t *entry = loop->entries[i];
+        short revents = loop->pollfds[i].revents;
+        if (revents & POLLIN) {
+            entry->revents |= APN_POLL_READ;
+        }
+        if (revents & POLLOUT) {
+            entry->revents |= APN_POLL_WRITE;
+        }
+        if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            entry->revents |= APN_POLL_ERROR | (entry->events & APN_POLL_READ);
+        }
+    }
+    return APN_SUCCESS;
+}
+
+static void __apn_loop_cleanup(apn_loop_t *const loop) {
+    uint32_t i = 0;
+    uint32_t j = 0;
+    for (i = 0; i < loop->count; i++) {
+        if (loop->entries[i]->removed) {
+            free(loop->entries[i]);
+        } else {
+            loop->entries[j++] = loop->entries[i];
+        }
+    }
+    loop->count = j;
+    loop->has_removed = 0;
+}
+
+static apn_loop_entry_t *__apn_loop_find(const apn_loop_t *const loop, const apn_ctx_t *const ctx) {
+    uint32_t i = 0;
+    for (i = 0; i < loop->count; i++) {
+        if (loop->entries[i]->ctx == ctx && !loop->entries[i]->removed) {
+            return loop->entries[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_LOOP_H__
+#define __APN_LOOP_H__
+
+#include "apn_platform.h"
+#include "apn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum __apn_loop_event {
+    /** Connection finished sending a notification (or was just added) and is ready for the next one */
+    APN_LOOP_EVENT_READY = 1,
+    /** Idle connection has data to read, e.g. Apple Feedback Service tuples or closure of the connection */
+    APN_LOOP_EVENT_READABLE = 2
+} apn_loop_event;
+
+typedef struct __apn_loop_t apn_loop_t;
+
+typedef void (*apn_loop_callback)(apn_loop_t *loop, apn_ctx_t *ctx, apn_loop_event event, void *arg);
+
+/**
+ * Creates a new event loop.
+ *
+ * The loop drives any number of connections from a single thread: notifications started with
+ * ::apn_send_async() are written and error responses are read as soon as sockets become ready.
+ * `epoll` is used where available, `poll` otherwise.
+ *
+ * @return Pointer to new `loop` structure on success, or NULL on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_loop_t *apn_loop_init()
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Frees memory allocated for the loop. Connections are not closed.
+ *
+ * @param[in] loop - Pointer to `loop` structure.
+ */
+__apn_export__ void apn_loop_free(apn_loop_t *loop);
+
+/**
+ * Adds a connection to the loop.
+ *
+ * @param[in] loop - Pointer to an initialized `loop` structure. Cannot be NULL.
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] callback - Function which is called on loop events. Can be NULL.
+ * @param[in] arg - Argument passed to `callback`.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_loop_add(apn_loop_t *const loop, apn_ctx_t *const ctx, apn_loop_callback callback, void *arg)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Removes a connection from the loop. Can be called from a callback.
+ *
+ * @param[in] loop - Pointer to an initialized `loop` structure. Cannot be NULL.
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ */
+__apn_export__ void apn_loop_remove(apn_loop_t *const loop, apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Waits for socket events or timers and processes ready connections once.
+ *
+ * @param[in] loop - Pointer to an initialized `loop` structure. Cannot be NULL.
+ * @param[in] timeout - Maximum time to wait, in milliseconds. -1 means no limit.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_loop_run_once(apn_loop_t *const loop, int timeout)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Runs the loop until no connection is sending a notification.
+ *
+ * @param[in] loop - Pointer to an initialized `loop` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_loop_run(apn_loop_t *const loop)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
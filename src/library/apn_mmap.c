@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#if !defined(_WIN32) && defined(APN_HAVE_SYS_MMAN_H)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "apn_mmap.h"
+
+#if !defined(_WIN32) && !defined(APN_HAVE_SYS_MMAN_H)
+static apn_return __apn_mmap_read(apn_mmap_t *const map, const char *const file);
+#endif
+
+apn_return apn_mmap_open(apn_mmap_t *const map, const char *const file) {
+    assert(map);
+    assert(file);
+
+    memset(map, 0, sizeof(apn_mmap_t));
+
+#ifdef _WIN32
+    {
+        LARGE_INTEGER size;
+        HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE == handle) {
+            errno = ENOENT;
+            return APN_ERROR;
+        }
+        if (!GetFileSizeEx(handle, &size)) {
+            CloseHandle(handle);
+            errno = EIO;
+            return APN_ERROR;
+        }
+        map->size = (size_t) size.QuadPart;
+        if (0 == map->size) {
+            CloseHandle(handle);
+            return APN_SUCCESS;
+        }
+        map->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        /* the mapping keeps the file open */
+        CloseHandle(handle);
+        if (!map->mapping) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!map->data) {
+            CloseHandle(map->mapping);
+            map->mapping = NULL;
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+    }
+    return APN_SUCCESS;
+#elif defined(APN_HAVE_SYS_MMAN_H)
+    {
+        struct stat st;
+        void *data = NULL;
+        int fd = open(file, O_RDONLY);
+        if (fd < 0) {
+            return APN_ERROR;
+        }
+        if (0 != fstat(fd, &st)) {
+            close(fd);
+            return APN_ERROR;
+        }
+        map->size = (size_t) st.st_size;
+        if (0 == map->size) {
+            close(fd);
+            return APN_SUCCESS;
+        }
+        data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+        /* the mapping keeps the file open */
+        close(fd);
+        if (MAP_FAILED == data) {
+            map->size = 0;
+            return APN_ERROR;
+        }
+        map->data = data;
+    }
+    return APN_SUCCESS;
+#else
+    return __apn_mmap_read(map, file);
+#endif
+}
+
+void apn_mmap_close(apn_mmap_t *const map) {
+    assert(map);
+
+    if (map->copied) {
+        free((void *) map->data);
+    } else if (map->data) {
+#ifdef _WIN32
+        UnmapViewOfFile(map->data);
+        CloseHandle(map->mapping);
+#elif defined(APN_HAVE_SYS_MMAN_H)
+        munmap((void *) map->data, map->size);
+#endif
+    }
+    memset(map, 0, sizeof(apn_mmap_t));
+}
+
+#if !defined(_WIN32) && !defined(APN_HAVE_SYS_MMAN_H)
+static apn_return __apn_mmap_read(apn_mmap_t *const map, const char *const file) {
+    uint8_t *data = NULL;
+    long size = 0;
+    FILE *stream = fopen(file, "rb");
+    if (!stream) {
+        return APN_ERROR;
+    }
+    if (0 != fseek(stream, 0, SEEK_END) || (size = ftell(stream)) < 0 || 0 != fseek(stream, 0, SEEK_SET)) {
+        fclose(stream);
+        errno = EIO;
+        return APN_ERROR;
+    }
+    if (size > 0) {
+        data = malloc((size_t) size);
+        if (!data) {
+            fclose(stream);
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        if ((size_t) size != fread(data, 1, (size_t) size, stream)) {
+            free(data);
+            fclose(stream);
+            errno = EIO;
+            return APN_ERROR;
+        }
+    }
+    fclose(stream);
+    map->data = data;
+    map->size = (size_t) size;
+    map->copied = 1;
+    return APN_SUCCESS;
+}
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_MMAP_H__
+#define __APN_MMAP_H__
+
+#include "apn_platform.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Read-only view of a file. Files are memory-mapped where the platform supports it
+ * and read into memory otherwise.
+ */
+typedef struct __apn_mmap_t {
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    /** `data` is a copy of the file which has to be freed */
+    uint8_t copied;
+} apn_mmap_t;
+
+/**
+ * Maps `file` into memory.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+apn_return apn_mmap_open(apn_mmap_t *const map, const char *const file)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Unmaps the file. Does nothing for a zeroed structure.
+ */
+void apn_mmap_close(apn_mmap_t *const map)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
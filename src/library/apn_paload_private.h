@@ -25,8 +25,11 @@
 
 #include "apn_payload.h"
 #include "apn_array.h"
+#include "apn_binary_message.h"
 
 #define APN_PAYLOAD_MAX_SIZE  2048
+/** Largest frame of a payload, expanding it needs apn_binary_message_private.h */
+#define APN_PAYLOAD_MAX_FRAME_SIZE APN_BINARY_MESSAGE_FRAME_SIZE(APN_PAYLOAD_MAX_SIZE)
 
 /**
  * Types of custom property of notification payload
@@ -76,10 +79,44 @@ struct __apn_payload_t {
     apn_payload_alert_t *alert;
     char *sound;
     char *category;
+    /** Custom properties, in arena mode also the arena the strings, properties and alert are allocated from */
     apn_array_t *custom_properties;
+    apn_payload_body_fit_t body_fit;
+    /** Validated document set with apn_payload_set_raw_json(), replaces the fields above */
+    char *raw_json;
+    uint32_t raw_json_size;
+    /** Rendered frame with a zeroed token and identifier, built by apn_payload_prepare() and marked stale by the setters */
+    apn_binary_message_t *frame;
+    uint32_t frame_capacity;
+    uint8_t frame_valid;
+    /** Set by apn_payload_init_arena() */
+    uint8_t arena;
 };
 
 char *apn_create_json_document_from_payload(const apn_payload_t * const payload)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Renders the JSON document of the payload into `buffer` (not NUL-terminated) in a single pass.
+ * Rendering stops as soon as the document outgrows `size` or ::APN_PAYLOAD_MAX_SIZE bytes.
+ *
+ * @return Size of the document on success, or 0 on failure with error information stored in `errno`,
+ * ::APN_ERR_INVALID_PAYLOAD_SIZE if the document does not fit.
+ */
+uint32_t apn_payload_serialize(const apn_payload_t * const payload, char * const buffer, uint32_t size)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns the frame template of the payload: the one cached by apn_payload_prepare() while it is up to date,
+ * otherwise the payload is rendered into `scratch`. The payload is only read, so any number of threads
+ * can call this for a payload which nobody modifies.
+ *
+ * @param[in] payload - Pointer to `payload` structure.
+ * @param[in, out] scratch - Binary message whose `message` points to ::APN_PAYLOAD_MAX_FRAME_SIZE bytes.
+ *
+ * @return Pointer to the frame template on success, or NULL on failure with error information stored in `errno`.
+ */
+const apn_binary_message_t *apn_payload_frame(const apn_payload_t * const payload, apn_binary_message_t * const scratch)
+        __apn_attribute_nonnull__((1,2));
+
 #endif
@@ -23,8 +23,8 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <float.h>
 
-#include "src/jansson.h"
 #include "apn_strings.h"
 #include "apn_memory.h"
 #include "apn_private.h"
@@ -32,21 +32,40 @@
 #include "apn_paload_private.h"
 #include "apn_binary_message_private.h"
 #include "apn_log.h"
+#include "apn_json.h"
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
 #endif
 
-static apn_payload_alert_t *__apn_payload_alert_init();
+/* U+2026 HORIZONTAL ELLIPSIS in UTF-8 */
+#define APN_PAYLOAD_ELLIPSIS "\xE2\x80\xA6"
+#define APN_PAYLOAD_ELLIPSIS_SIZE 3
+
+static apn_return __apn_payload_init_content(apn_payload_t *payload);
+static void __apn_payload_free_content(apn_payload_t *payload);
+static void __apn_payload_invalidate(apn_payload_t *payload);
+static void *__apn_payload_alloc(apn_payload_t *payload, size_t size);
+static char *__apn_payload_strndup(apn_payload_t *payload, const char *str, size_t length);
+static void __apn_payload_strfree(apn_payload_t *payload, char **str);
 static uint8_t __apn_payload_custom_property_name_already_is_used(apn_payload_t *payload, const char *property_key);
 
-static apn_payload_custom_property_t *__apn_payload_custom_property_init(const char *name);
+static apn_payload_custom_property_t *__apn_payload_custom_property_init(apn_payload_t *payload, const char *name);
+static apn_return __apn_payload_custom_property_add(apn_payload_t *payload, apn_payload_custom_property_t *property);
+static void __apn_payload_custom_property_discard(apn_payload_t *payload, apn_payload_custom_property_t *property);
 static void __apn_payload_custom_property_free(apn_payload_custom_property_t *property);
 static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const apn_payload_custom_property_t * const property);
 
 static void __apn_payload_custom_property_dtor(void *data);
 static void *__apn_payload_custom_property_ctor(const void * const data);
 
+static void __apn_payload_write(const apn_payload_t *const payload, apn_json_writer_t *const writer, size_t limit);
+static void __apn_payload_fit_body(const apn_payload_t *const payload, size_t limit, size_t *body_length, uint8_t *ellipsis);
+static void __apn_payload_write_aps(const apn_payload_t *const payload, size_t body_length, uint8_t ellipsis,
+                                    apn_json_writer_t *const writer);
+static void __apn_payload_write_body(apn_json_writer_t *const writer, const char *const body, size_t length, uint8_t ellipsis);
+static void __apn_payload_write_custom_properties(const apn_payload_t *const payload, apn_json_writer_t *const writer);
+
 apn_payload_t *apn_payload_init() {
     apn_payload_t *payload = NULL;
     payload = malloc(sizeof(apn_payload_t));
@@ -54,45 +73,66 @@ apn_payload_t *apn_payload_init() {
         errno = ENOMEM;
         return NULL;
     }
-    if (NULL == (payload->alert = __apn_payload_alert_init())) {
+    payload->arena = 0;
+    payload->frame = NULL;
+    payload->frame_capacity = 0;
+    payload->frame_valid = 0;
+    payload->alert = NULL;
+    if (NULL == (payload->custom_properties = apn_array_init(20, __apn_payload_custom_property_dtor, __apn_payload_custom_property_ctor))) {
+        free(payload);
+        return NULL;
+    }
+    if (APN_ERROR == __apn_payload_init_content(payload)) {
         apn_payload_free(payload);
         return NULL;
     }
+    return payload;
+}
 
-    if (NULL == (payload->custom_properties = apn_array_init(20, __apn_payload_custom_property_dtor, __apn_payload_custom_property_ctor))) {
+apn_payload_t *apn_payload_init_arena() {
+    apn_payload_t *payload = NULL;
+    payload = malloc(sizeof(apn_payload_t));
+    if (!payload) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    payload->arena = 1;
+    payload->frame = NULL;
+    payload->frame_capacity = 0;
+    payload->frame_valid = 0;
+    payload->alert = NULL;
+    /* the property array is also the arena which the strings and properties are allocated from */
+    if (NULL == (payload->custom_properties = apn_array_init_arena(20))) {
+        free(payload);
+        return NULL;
+    }
+    if (APN_ERROR == __apn_payload_init_content(payload)) {
         apn_payload_free(payload);
         return NULL;
     }
-
-    payload->badge = -1;
-    payload->sound = NULL;
-    payload->category = NULL;
-    payload->expiry = 0;
-    payload->content_available = 0;
-    payload->priority = APN_NOTIFICATION_PRIORITY_DEFAULT;
-
     return payload;
 }
 
 void apn_payload_free(apn_payload_t *payload) {
     if (payload) {
-        if (payload->alert) {
-            apn_mem_free(payload->alert->action_loc_key);
-            apn_mem_free(payload->alert->body);
-            apn_mem_free(payload->alert->launch_image);
-            apn_mem_free(payload->alert->loc_key);
-            apn_array_free(payload->alert->loc_args);
-            free(payload->alert);
-        }
-        apn_mem_free(payload->sound);
-        apn_mem_free(payload->category);
+        __apn_payload_free_content(payload);
         apn_array_free(payload->custom_properties);
+        apn_binary_message_free(payload->frame);
         free(payload);
     }
 }
 
+apn_return apn_payload_reset(apn_payload_t *const payload) {
+    assert(payload);
+    __apn_payload_invalidate(payload);
+    __apn_payload_free_content(payload);
+    apn_array_clear(payload->custom_properties);
+    return __apn_payload_init_content(payload);
+}
+
 void apn_payload_set_priority(apn_payload_t *const payload, apn_notification_priority_t priority) {
     assert(payload);
+    __apn_payload_invalidate(payload);
     if (APN_NOTIFICATION_PRIORITY_DEFAULT != priority && APN_NOTIFICATION_PRIORITY_HIGH != priority) {
         priority = APN_NOTIFICATION_PRIORITY_DEFAULT;
     }
@@ -101,11 +141,13 @@ void apn_payload_set_priority(apn_payload_t *const payload, apn_notification_pri
 
 void apn_payload_set_expiry(apn_payload_t *const payload, time_t expiry) {
     assert(payload);
+    __apn_payload_invalidate(payload);
     payload->expiry = expiry;
 }
 
 apn_return apn_payload_set_badge(apn_payload_t *const payload, int32_t badge) {
     assert(payload);
+    __apn_payload_invalidate(payload);
     if (badge < 0 || badge > UINT16_MAX) {
         errno = APN_ERR_PAYLOAD_BADGE_INVALID_VALUE;
         return APN_ERROR;
@@ -116,11 +158,16 @@ apn_return apn_payload_set_badge(apn_payload_t *const payload, int32_t badge) {
 
 apn_return apn_payload_set_sound(apn_payload_t *const payload, const char *const sound) {
     assert(payload);
+    if (sound && !apn_string_is_utf8(sound)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    __apn_payload_invalidate(payload);
     if (payload->sound) {
-        apn_strfree(&payload->sound);
+        __apn_payload_strfree(payload, &payload->sound);
     }
     if (sound && strlen(sound)) {
-        if (NULL == (payload->sound = apn_strndup(sound, strlen(sound)))) {
+        if (NULL == (payload->sound = __apn_payload_strndup(payload, sound, strlen(sound)))) {
             errno = ENOMEM;
             return APN_ERROR;
         }
@@ -130,20 +177,22 @@ apn_return apn_payload_set_sound(apn_payload_t *const payload, const char *const
 
 void apn_payload_set_content_available(apn_payload_t *const payload, uint8_t content_available) {
     assert(payload);
+    __apn_payload_invalidate(payload);
     payload->content_available = (uint8_t) ((content_available == 1) ? 1 : 0);
 }
 
 apn_return apn_payload_set_body(apn_payload_t *const payload, const char *const body) {
     assert(payload);
+    __apn_payload_invalidate(payload);
     if (payload->alert->body) {
-        apn_strfree(&payload->alert->body);
+        __apn_payload_strfree(payload, &payload->alert->body);
     }
     if (body && strlen(body) > 0) {
         if (!apn_string_is_utf8(body)) {
             errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
             return APN_ERROR;
         }
-        if (NULL == (payload->alert->body = apn_strndup(body, strlen(body)))) {
+        if (NULL == (payload->alert->body = __apn_payload_strndup(payload, body, strlen(body)))) {
             errno = ENOMEM;
             return APN_ERROR;
         }
@@ -151,13 +200,24 @@ apn_return apn_payload_set_body(apn_payload_t *const payload, const char *const
     return APN_SUCCESS;
 }
 
+void apn_payload_set_body_fit(apn_payload_t *const payload, apn_payload_body_fit_t body_fit) {
+    assert(payload);
+    __apn_payload_invalidate(payload);
+    payload->body_fit = body_fit;
+}
+
 apn_return apn_payload_set_localized_action_key(apn_payload_t *const payload, const char *const key) {
     assert(payload);
+    if (key && !apn_string_is_utf8(key)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    __apn_payload_invalidate(payload);
     if (payload->alert->action_loc_key) {
-        apn_strfree(&payload->alert->action_loc_key);
+        __apn_payload_strfree(payload, &payload->alert->action_loc_key);
     }
     if (key && strlen(key) > 0) {
-        if ((payload->alert->action_loc_key = apn_strndup(key, strlen(key))) == NULL) {
+        if ((payload->alert->action_loc_key = __apn_payload_strndup(payload, key, strlen(key))) == NULL) {
             errno = ENOMEM;
             return APN_ERROR;
         }
@@ -167,11 +227,16 @@ apn_return apn_payload_set_localized_action_key(apn_payload_t *const payload, co
 
 apn_return apn_payload_set_launch_image(apn_payload_t *const payload, const char *const image) {
     assert(payload);
-    if (payload->alert->action_loc_key) {
-        apn_strfree(&payload->alert->action_loc_key);
+    if (image && !apn_string_is_utf8(image)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    __apn_payload_invalidate(payload);
+    if (payload->alert->launch_image) {
+        __apn_payload_strfree(payload, &payload->alert->launch_image);
     }
     if (image && strlen(image)) {
-        if ((payload->alert->launch_image = apn_strndup(image, strlen(image))) == NULL) {
+        if ((payload->alert->launch_image = __apn_payload_strndup(payload, image, strlen(image))) == NULL) {
             errno = ENOMEM;
             return APN_ERROR;
         }
@@ -180,26 +245,47 @@ apn_return apn_payload_set_launch_image(apn_payload_t *const payload, const char
 }
 
 apn_return apn_payload_set_localized_key(apn_payload_t *const payload, const char *const key, apn_array_t * const args) {
+    uint32_t i = 0;
     assert(payload);
     assert(key && strlen(key) > 0);
 
+    if (!apn_string_is_utf8(key)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    for (i = 0; args && i < apn_array_count(args); i++) {
+        if (!apn_string_is_utf8(apn_array_item_at_index(args, i))) {
+            errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+            return APN_ERROR;
+        }
+    }
+    __apn_payload_invalidate(payload);
+
     if (payload->alert->loc_key) {
-        apn_strfree(&payload->alert->loc_key);
+        __apn_payload_strfree(payload, &payload->alert->loc_key);
         apn_array_free(payload->alert->loc_args);
+        payload->alert->loc_args = NULL;
     }
 
-    payload->alert->loc_key = apn_strndup(key, strlen(key));
+    if (NULL == (payload->alert->loc_key = __apn_payload_strndup(payload, key, strlen(key)))) {
+        return APN_ERROR;
+    }
     payload->alert->loc_args = apn_array_copy(args);
     return APN_SUCCESS;
 }
 
 apn_return apn_payload_set_category(apn_payload_t *const payload, const char *const category) {
     assert(payload);
+    if (category && !apn_string_is_utf8(category)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    __apn_payload_invalidate(payload);
     if (payload->category) {
-        apn_strfree(&payload->category);
+        __apn_payload_strfree(payload, &payload->category);
     }
     if (category && strlen(category)) {
-        if ((payload->category = apn_strndup(category, strlen(category))) == NULL) {
+        if ((payload->category = __apn_payload_strndup(payload, category, strlen(category))) == NULL) {
             errno = ENOMEM;
             return APN_ERROR;
         }
@@ -224,13 +310,13 @@ apn_return apn_payload_add_custom_property_integer(apn_payload_t *const payload,
     assert(payload);
     assert(name);
     APN_PAYLOAD_CHECK_KEY(payload, name);
-    property = __apn_payload_custom_property_init(name);
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_NUMERIC;
     property->value.numeric_value = value;
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
 }
 
 apn_return apn_payload_add_custom_property_double(apn_payload_t *const payload, const char *const name, double value) {
@@ -238,13 +324,13 @@ apn_return apn_payload_add_custom_property_double(apn_payload_t *const payload,
     assert(payload);
     assert(name);
     APN_PAYLOAD_CHECK_KEY(payload, name);
-    property = __apn_payload_custom_property_init(name);
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_DOUBLE;
     property->value.double_value = value;
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
 }
 
 apn_return apn_payload_add_custom_property_bool(apn_payload_t *const payload, const char *const name, unsigned char value) {
@@ -252,13 +338,13 @@ apn_return apn_payload_add_custom_property_bool(apn_payload_t *const payload, co
     assert(payload);
     assert(name);
     APN_PAYLOAD_CHECK_KEY(payload, name);
-    property = __apn_payload_custom_property_init(name);
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_BOOL;
     property->value.bool_value = (uint8_t) ((value == 0) ? 0 : 1);
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
 }
 
 apn_return apn_payload_add_custom_property_null(apn_payload_t *const payload, const char *const name) {
@@ -266,14 +352,14 @@ apn_return apn_payload_add_custom_property_null(apn_payload_t *const payload, co
     assert(payload);
     assert(name);
     APN_PAYLOAD_CHECK_KEY(payload, name);
-    property = __apn_payload_custom_property_init(name);
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_NULL;
     property->value.string_value.value = NULL;
     property->value.string_value.length = 0;
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
 }
 
 apn_return apn_payload_add_custom_property_string(apn_payload_t *const payload, const char *const name, const char *value) {
@@ -281,19 +367,22 @@ apn_return apn_payload_add_custom_property_string(apn_payload_t *const payload,
     assert(payload);
     assert(name);
     APN_PAYLOAD_CHECK_KEY(payload, name);
-    property = __apn_payload_custom_property_init(name);
+    if (!apn_string_is_utf8(value)) {
+        errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+        return APN_ERROR;
+    }
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_STRING;
-    property->value.string_value.value = apn_strndup(value, strlen(value));
+    property->value.string_value.value = __apn_payload_strndup(payload, value, strlen(value));
     if (!property->value.string_value.value) {
-        __apn_payload_custom_property_free(property);
-        errno = ENOMEM;
+        __apn_payload_custom_property_discard(payload, property);
         return APN_ERROR;
     }
     property->value.string_value.length = strlen(value);
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
 }
 
 apn_return apn_payload_add_custom_property_array(apn_payload_t *const payload, const char *const name, const char **array,
@@ -305,29 +394,65 @@ apn_return apn_payload_add_custom_property_array(apn_payload_t *const payload, c
     assert(name);
     assert(array);
     APN_PAYLOAD_CHECK_KEY(payload, name);
+    for (i = 0; i < array_size; i++) {
+        if (!apn_string_is_utf8(array[i])) {
+            errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+            return APN_ERROR;
+        }
+    }
 
-    property = __apn_payload_custom_property_init(name);
+    property = __apn_payload_custom_property_init(payload, name);
     if (!property) {
         return APN_ERROR;
     }
     property->value_type = APN_CUSTOM_PROPERTY_TYPE_ARRAY;
+    property->value.array_value.array = NULL;
+    property->value.array_value.array_size = 0;
 
     if (array_size) {
-        _array = (char **) malloc(sizeof(char *) * array_size);
-        if (!_array) {
-            errno = ENOMEM;
+        if (NULL == (_array = __apn_payload_alloc(payload, sizeof(char *) * array_size))) {
+            __apn_payload_custom_property_discard(payload, property);
             return APN_ERROR;
         }
+        property->value.array_value.array = _array;
         for (i = 0; i < array_size; i++) {
-            if ((_array[i] = apn_strndup(_array[i], strlen(_array[i]))) == NULL) {
-                errno = ENOMEM;
+            if ((_array[i] = __apn_payload_strndup(payload, array[i], strlen(array[i]))) == NULL) {
+                __apn_payload_custom_property_discard(payload, property);
                 return APN_ERROR;
             }
+            property->value.array_value.array_size = (uint32_t) i + 1;
         }
-        property->value.array_value.array = _array;
-        property->value.array_value.array_size = array_size;
     }
-    return apn_array_insert(payload->custom_properties, property);
+    return __apn_payload_custom_property_add(payload, property);
+}
+
+apn_return apn_payload_set_raw_json(apn_payload_t *const payload, const char *const json) {
+    size_t json_size = 0;
+    char *raw_json = NULL;
+    assert(payload);
+
+    if (json && (json_size = strlen(json)) > 0) {
+        if (json_size > APN_PAYLOAD_MAX_SIZE) {
+            errno = APN_ERR_INVALID_PAYLOAD_SIZE;
+            return APN_ERROR;
+        }
+        if (APN_ERROR == apn_json_validate_payload(json, json_size)) {
+            return APN_ERROR;
+        }
+        if (NULL == (raw_json = __apn_payload_strndup(payload, json, json_size))) {
+            return APN_ERROR;
+        }
+    }
+    __apn_payload_invalidate(payload);
+    __apn_payload_strfree(payload, &payload->raw_json);
+    payload->raw_json = raw_json;
+    payload->raw_json_size = (uint32_t) json_size;
+    return APN_SUCCESS;
+}
+
+const char *apn_payload_raw_json(const apn_payload_t *const payload) {
+    assert(payload);
+    return payload->raw_json;
 }
 
 uint8_t apn_payload_content_available(const apn_payload_t *const payload) {
@@ -375,6 +500,11 @@ time_t apn_payload_expiry(const apn_payload_t *const payload) {
     return payload->expiry;
 }
 
+apn_payload_body_fit_t apn_payload_body_fit(const apn_payload_t *const payload) {
+    assert(payload);
+    return payload->body_fit;
+}
+
 apn_notification_priority_t apn_payload_priority(const apn_payload_t *const payload) {
     assert(payload);
     return payload->priority;
@@ -386,142 +516,328 @@ const char *apn_payload_category(const apn_payload_t *const payload) {
 }
 
 char *apn_create_json_document_from_payload(const apn_payload_t *const payload) {
-    json_t *root = NULL;
-    json_t *aps = NULL;
-    json_t *alert = NULL;
-    json_t *args = NULL;
-    json_t *array = NULL;
-    char *json_document = NULL;
-    uint32_t i = 0;
-    uint32_t j = 0;
+    uint8_t buffer[APN_PAYLOAD_MAX_FRAME_SIZE];
+    apn_binary_message_t scratch;
+    const apn_binary_message_t *frame = NULL;
+    assert(payload);
+
+    scratch.message = buffer;
+    if (NULL == (frame = apn_payload_frame(payload, &scratch))) {
+        return NULL;
+    }
+    return apn_strndup((const char *) frame->message + APN_BINARY_MESSAGE_PAYLOAD_OFFSET, frame->payload_size);
+}
+
+apn_return apn_payload_prepare(apn_payload_t *const payload) {
+    char json[APN_PAYLOAD_MAX_SIZE];
+    uint32_t json_size = 0;
+    uint32_t frame_size = 0;
+    uint32_t capacity = 0;
+    assert(payload);
+
+    if (payload->frame_valid) {
+        return APN_SUCCESS;
+    }
+    if (0 == (json_size = apn_payload_serialize(payload, json, sizeof(json)))) {
+        return APN_ERROR;
+    }
+    frame_size = apn_binary_message_frame_size(json_size);
+
+    /* the frame is kept across changes, an arena payload takes room for the largest one up front */
+    if (frame_size > payload->frame_capacity) {
+        capacity = payload->arena ? (uint32_t) APN_PAYLOAD_MAX_FRAME_SIZE : frame_size;
+        apn_binary_message_free(payload->frame);
+        payload->frame_capacity = 0;
+        if (NULL == (payload->frame = apn_binary_message_init(capacity))) {
+            return APN_ERROR;
+        }
+        payload->frame_capacity = capacity;
+    }
+    apn_binary_message_encode(payload->frame->message, NULL, json, json_size, 0,
+                              (uint32_t) payload->expiry, (uint8_t) payload->priority);
+    payload->frame->size = frame_size;
+    payload->frame->payload_size = json_size;
+    payload->frame_valid = 1;
+    return APN_SUCCESS;
+}
 
+const apn_binary_message_t *apn_payload_frame(const apn_payload_t *const payload, apn_binary_message_t *const scratch) {
+    char *json = NULL;
+    uint32_t json_size = 0;
     assert(payload);
+    assert(scratch);
 
-    root = json_object();
-    aps = json_object();
-    if (!root || !aps) {
-        errno = APN_ERR_PAYLOAD_COULD_NOT_CREATE_JSON_DOCUMENT;
+    if (payload->frame_valid) {
+        return payload->frame;
+    }
+    /* rendered in place, the encoder leaves a document at the payload offset where it is */
+    json = (char *) scratch->message + APN_BINARY_MESSAGE_PAYLOAD_OFFSET;
+    if (0 == (json_size = apn_payload_serialize(payload, json, APN_PAYLOAD_MAX_SIZE))) {
         return NULL;
     }
+    scratch->size = apn_binary_message_encode(scratch->message, NULL, json, json_size, 0,
+                                              (uint32_t) payload->expiry, (uint8_t) payload->priority);
+    scratch->payload_size = json_size;
+    return scratch;
+}
+
+uint32_t apn_payload_serialize(const apn_payload_t *const payload, char *const buffer, uint32_t size) {
+    apn_json_writer_t writer;
+    assert(payload);
+    assert(buffer);
+
+    if (payload->raw_json) {
+        /* validated when it was set */
+        if (payload->raw_json_size > size) {
+            errno = APN_ERR_INVALID_PAYLOAD_SIZE;
+            return 0;
+        }
+        memcpy(buffer, payload->raw_json, payload->raw_json_size);
+        return payload->raw_json_size;
+    }
 
     if (!payload->alert || (!payload->alert->loc_key && !payload->alert->body && !payload->content_available)) {
-        json_decref(root);
-        json_decref(aps);
         errno = APN_ERR_PAYLOAD_ALERT_IS_NOT_SET;
-        return NULL;
+        return 0;
     }
 
-    if (!payload->alert->action_loc_key && !payload->alert->launch_image && !payload->alert->loc_args &&
-        !payload->alert->loc_key) {
-        json_object_set_new(aps, "alert", json_string(payload->alert->body));
-    } else {
-        alert = json_object();
-        if (!alert) {
-            json_decref(root);
-            json_decref(aps);
-            errno = APN_ERR_PAYLOAD_COULD_NOT_CREATE_JSON_DOCUMENT;
-            return NULL;
+    if (size > APN_PAYLOAD_MAX_SIZE) {
+        size = APN_PAYLOAD_MAX_SIZE;
+    }
+    apn_json_writer_init(&writer, buffer, size);
+    __apn_payload_write(payload, &writer, size);
+
+    if (writer.overflow) {
+        errno = APN_ERR_INVALID_PAYLOAD_SIZE;
+        return 0;
+    }
+    return (uint32_t) writer.length;
+}
+
+uint32_t apn_payload_serialized_size(const apn_payload_t *const payload) {
+    apn_json_writer_t writer;
+    assert(payload);
+
+    if (payload->raw_json) {
+        return payload->raw_json_size;
+    }
+    if (!payload->alert || (!payload->alert->loc_key && !payload->alert->body && !payload->content_available)) {
+        errno = APN_ERR_PAYLOAD_ALERT_IS_NOT_SET;
+        return 0;
+    }
+
+    apn_json_writer_init_measure(&writer);
+    __apn_payload_write(payload, &writer, APN_PAYLOAD_MAX_SIZE);
+    return (uint32_t) writer.length;
+}
+
+static void __apn_payload_write(const apn_payload_t *const payload, apn_json_writer_t *const writer, size_t limit) {
+    size_t body_length = (payload->alert->body) ? strlen(payload->alert->body) : 0;
+    uint8_t ellipsis = 0;
+
+    if (APN_PAYLOAD_BODY_FIT_NONE != payload->body_fit && body_length > 0) {
+        __apn_payload_fit_body(payload, limit, &body_length, &ellipsis);
+    }
+    __apn_payload_write_aps(payload, body_length, ellipsis, writer);
+    __apn_payload_write_custom_properties(payload, writer);
+    apn_json_write_raw(writer, "}", 1);
+}
+
+/* Shortens the body so that the document takes at most `limit` bytes, the rest of the document is measured once */
+static void __apn_payload_fit_body(const apn_payload_t *const payload, size_t limit, size_t *body_length, uint8_t *ellipsis) {
+    apn_json_writer_t writer;
+    size_t budget = 0;
+    size_t fit = 0;
+
+    apn_json_writer_init_measure(&writer);
+    __apn_payload_write_aps(payload, 0, 0, &writer);
+    __apn_payload_write_custom_properties(payload, &writer);
+    apn_json_write_raw(&writer, "}", 1);
+    if (writer.length > limit) {
+        /* does not fit even without the body */
+        return;
+    }
+
+    budget = limit - writer.length;
+    fit = apn_json_escaped_prefix(payload->alert->body, *body_length, budget);
+    if (fit == *body_length) {
+        return;
+    }
+    if (APN_PAYLOAD_BODY_FIT_ELLIPSIS == payload->body_fit && budget >= APN_PAYLOAD_ELLIPSIS_SIZE) {
+        fit = apn_json_escaped_prefix(payload->alert->body, *body_length, budget - APN_PAYLOAD_ELLIPSIS_SIZE);
+        *ellipsis = 1;
+    }
+    *body_length = fit;
+}
+
+static void __apn_payload_write_aps(const apn_payload_t *const payload, size_t body_length, uint8_t ellipsis,
+                                    apn_json_writer_t *const writer) {
+    const apn_payload_alert_t *alert = payload->alert;
+    uint8_t first = 1;
+    uint32_t i = 0;
+
+    apn_json_write_raw(writer, "{\"aps\":{", 8);
+
+    if (!alert->action_loc_key && !alert->launch_image && !alert->loc_args && !alert->loc_key) {
+        if (alert->body) {
+            apn_json_write_key(writer, "alert", 1);
+            __apn_payload_write_body(writer, alert->body, body_length, ellipsis);
+            first = 0;
         }
-        if (payload->alert->body) {
-            json_object_set_new(alert, "body", json_string(payload->alert->body));
+    } else {
+        apn_json_write_key(writer, "alert", 1);
+        apn_json_write_raw(writer, "{", 1);
+        if (alert->body) {
+            apn_json_write_key(writer, "body", first);
+            __apn_payload_write_body(writer, alert->body, body_length, ellipsis);
+            first = 0;
         }
-
-        if (payload->alert->launch_image) {
-            json_object_set_new(alert, "launch-image", json_string(payload->alert->launch_image));
+        if (alert->launch_image) {
+            apn_json_write_key(writer, "launch-image", first);
+            apn_json_write_string(writer, alert->launch_image, strlen(alert->launch_image));
+            first = 0;
         }
-
-        if (payload->alert->action_loc_key) {
-            json_object_set_new(alert, "action-loc-key", json_string(payload->alert->action_loc_key));
+        if (alert->action_loc_key) {
+            apn_json_write_key(writer, "action-loc-key", first);
+            apn_json_write_string(writer, alert->action_loc_key, strlen(alert->action_loc_key));
+            first = 0;
         }
-
-        if (payload->alert->loc_key) {
-            json_object_set_new(alert, "loc-key", json_string(payload->alert->loc_key));
+        if (alert->loc_key) {
+            apn_json_write_key(writer, "loc-key", first);
+            apn_json_write_string(writer, alert->loc_key, strlen(alert->loc_key));
+            first = 0;
         }
-
-        if (payload->alert->loc_args) {
-            args = json_array();
-            for (i = 0; i < apn_array_count(payload->alert->loc_args); i++) {
-                json_array_append(args, json_string(apn_array_item_at_index(payload->alert->loc_args, i)));
+        if (alert->loc_args) {
+            apn_json_write_key(writer, "loc-args", first);
+            apn_json_write_raw(writer, "[", 1);
+            for (i = 0; i < apn_array_count(alert->loc_args); i++) {
+                const char *arg = apn_array_item_at_index(alert->loc_args, i);
+                if (i > 0) {
+                    apn_json_write_raw(writer, ",", 1);
+                }
+                apn_json_write_string(writer, arg, strlen(arg));
             }
-            json_object_set_new(alert, "loc-args", args);
+            apn_json_write_raw(writer, "]", 1);
         }
-
-        json_object_set_new(aps, "alert", alert);
+        apn_json_write_raw(writer, "}", 1);
+        first = 0;
     }
 
     if (payload->content_available == 1) {
-        json_object_set_new(aps, "content-available", json_integer(payload->content_available));
+        apn_json_write_key(writer, "content-available", first);
+        apn_json_write_integer(writer, payload->content_available);
+        first = 0;
     }
-
     if (payload->badge > -1) {
-        json_object_set_new(aps, "badge", json_integer(payload->badge));
+        apn_json_write_key(writer, "badge", first);
+        apn_json_write_integer(writer, payload->badge);
+        first = 0;
     }
-
     if (payload->sound) {
-        json_object_set_new(aps, "sound", json_string(payload->sound));
+        apn_json_write_key(writer, "sound", first);
+        apn_json_write_string(writer, payload->sound, strlen(payload->sound));
+        first = 0;
     }
-
     if (payload->category) {
-        json_object_set_new(aps, "category", json_string(payload->category));
-    }
-
-    json_object_set_new(root, "aps", aps);
-
-    if(payload->custom_properties) {
-        for (i = 0; i < apn_array_count(payload->custom_properties); i++) {
-            apn_payload_custom_property_t *property = apn_array_item_at_index(payload->custom_properties, i);
-            switch (property->value_type) {
-                case APN_CUSTOM_PROPERTY_TYPE_BOOL:
-                    json_object_set_new(root, property->name,
-                                        ((property->value.bool_value == 0) ? json_false() : json_true()));
-                    break;
-                case APN_CUSTOM_PROPERTY_TYPE_NUMERIC:
-                    json_object_set_new(root, property->name, json_integer((json_int_t) property->value.numeric_value));
-                    break;
-                case APN_CUSTOM_PROPERTY_TYPE_NULL:
-                    json_object_set_new(root, property->name, json_null());
-                    break;
-                case APN_CUSTOM_PROPERTY_TYPE_STRING:
-                    json_object_set_new(root, property->name, json_string(property->value.string_value.value));
-                    break;
-                case APN_CUSTOM_PROPERTY_TYPE_DOUBLE:
-                    json_object_set_new(root, property->name, json_real(property->value.double_value));
-                    break;
-                case APN_CUSTOM_PROPERTY_TYPE_ARRAY: {
-                    for (j = 0; j < property->value.array_value.array_size; j++) {
-                        json_array_append(array, json_string(*(property->value.array_value.array + j)));
+        apn_json_write_key(writer, "category", first);
+        apn_json_write_string(writer, payload->category, strlen(payload->category));
+    }
+    apn_json_write_raw(writer, "}", 1);
+}
+
+static void __apn_payload_write_body(apn_json_writer_t *const writer, const char *const body, size_t length, uint8_t ellipsis) {
+    apn_json_write_raw(writer, "\"", 1);
+    apn_json_write_escaped(writer, body, length);
+    if (ellipsis) {
+        apn_json_write_raw(writer, APN_PAYLOAD_ELLIPSIS, APN_PAYLOAD_ELLIPSIS_SIZE);
+    }
+    apn_json_write_raw(writer, "\"", 1);
+}
+
+static void __apn_payload_write_custom_properties(const apn_payload_t *const payload, apn_json_writer_t *const writer) {
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!payload->custom_properties) {
+        return;
+    }
+    for (i = 0; i < apn_array_count(payload->custom_properties) && !writer->overflow; i++) {
+        const apn_payload_custom_property_t *property = apn_array_item_at_index(payload->custom_properties, i);
+        /* a real which is not finite cannot be written, the property is left out as before */
+        if (APN_CUSTOM_PROPERTY_TYPE_DOUBLE == property->value_type
+            && (property->value.double_value != property->value.double_value
+                || property->value.double_value > DBL_MAX || property->value.double_value < -DBL_MAX)) {
+            continue;
+        }
+        apn_json_write_key(writer, property->name, 0);
+        switch (property->value_type) {
+            case APN_CUSTOM_PROPERTY_TYPE_BOOL:
+                if (property->value.bool_value) {
+                    apn_json_write_raw(writer, "true", 4);
+                } else {
+                    apn_json_write_raw(writer, "false", 5);
+                }
+                break;
+            case APN_CUSTOM_PROPERTY_TYPE_NUMERIC:
+                apn_json_write_integer(writer, property->value.numeric_value);
+                break;
+            case APN_CUSTOM_PROPERTY_TYPE_NULL:
+                apn_json_write_raw(writer, "null", 4);
+                break;
+            case APN_CUSTOM_PROPERTY_TYPE_STRING:
+                apn_json_write_string(writer, property->value.string_value.value, property->value.string_value.length);
+                break;
+            case APN_CUSTOM_PROPERTY_TYPE_DOUBLE:
+                apn_json_write_real(writer, property->value.double_value);
+                break;
+            case APN_CUSTOM_PROPERTY_TYPE_ARRAY:
+                apn_json_write_raw(writer, "[", 1);
+                for (j = 0; j < property->value.array_value.array_size; j++) {
+                    const char *item = property->value.array_value.array[j];
+                    if (j > 0) {
+                        apn_json_write_raw(writer, ",", 1);
                     }
-                    json_object_set_new(root, property->name, array);
+                    apn_json_write_string(writer, item, strlen(item));
                 }
-                    break;
-            }
+                apn_json_write_raw(writer, "]", 1);
+                break;
         }
     }
-    json_document = json_dumps(root, JSON_COMPACT);
-    json_decref(root);
-    return json_document;
 }
 
-static apn_payload_custom_property_t *__apn_payload_custom_property_init(const char *name) {
-    apn_payload_custom_property_t *property = malloc(sizeof(apn_payload_custom_property_t));
+static apn_payload_custom_property_t *__apn_payload_custom_property_init(apn_payload_t *payload, const char *name) {
+    apn_payload_custom_property_t *property = __apn_payload_alloc(payload, sizeof(apn_payload_custom_property_t));
     if (!property) {
-        errno = ENOMEM;
         return NULL;
     }
-    if ((property->name = apn_strndup(name, strlen(name))) == NULL) {
-        errno = ENOMEM;
-        __apn_payload_custom_property_free(property);
+    property->value_type = APN_CUSTOM_PROPERTY_TYPE_NULL;
+    if ((property->name = __apn_payload_strndup(payload, name, strlen(name))) == NULL) {
+        __apn_payload_custom_property_discard(payload, property);
         return NULL;
     }
     return property;
 }
 
+static apn_return __apn_payload_custom_property_add(apn_payload_t *payload, apn_payload_custom_property_t *property) {
+    __apn_payload_invalidate(payload);
+    if (APN_ERROR == apn_array_insert(payload->custom_properties, property)) {
+        __apn_payload_custom_property_discard(payload, property);
+        return APN_ERROR;
+    }
+    return APN_SUCCESS;
+}
+
+/* Frees a property which is not in the array, arena memory is reused after apn_payload_reset() */
+static void __apn_payload_custom_property_discard(apn_payload_t *payload, apn_payload_custom_property_t *property) {
+    if (!payload || !payload->arena) {
+        __apn_payload_custom_property_free(property);
+    }
+}
+
 static uint8_t __apn_payload_custom_property_name_already_is_used(apn_payload_t *payload, const char *property_key) {
     apn_payload_custom_property_t *property = NULL;
     uint32_t i = 0;
-    if (apn_array_count(payload->custom_properties)) {
-        return 0;
-    } else if (strcasecmp(property_key, "aps") == 0) {
+    if (strcasecmp(property_key, "aps") == 0) {
         return 1;
     }
     for (i = 0; i < apn_array_count(payload->custom_properties); i++) {
@@ -571,7 +887,8 @@ static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const a
     uint32_t array_size = 0;
     uint32_t i = 0;
     if (property) {
-        new_property =__apn_payload_custom_property_init(property->name);
+        array_size = (property->value_type == APN_CUSTOM_PROPERTY_TYPE_ARRAY) ? property->value.array_value.array_size : 0;
+        new_property =__apn_payload_custom_property_init(NULL, property->name);
         if(!new_property) {
             return NULL;
         }
@@ -580,6 +897,12 @@ static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const a
             case APN_CUSTOM_PROPERTY_TYPE_STRING: {
                 new_property->value.string_value.value = apn_strndup(property->value.string_value.value, property->value.string_value.length);
                 new_property->value.string_value.length = property->value.string_value.length;
+                if (!new_property->value.string_value.value) {
+                    errno = ENOMEM;
+                    new_property->value_type = APN_CUSTOM_PROPERTY_TYPE_NULL;
+                    __apn_payload_custom_property_free(new_property);
+                    return NULL;
+                }
             } break;
             case APN_CUSTOM_PROPERTY_TYPE_NULL: {
                 new_property->value.string_value.value = NULL;
@@ -589,12 +912,14 @@ static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const a
                 new_property->value.bool_value = property->value.bool_value;
             } break;
             case APN_CUSTOM_PROPERTY_TYPE_DOUBLE: {
-                new_property->value.double_value = property->value.bool_value;
+                new_property->value.double_value = property->value.double_value;
             } break;
             case APN_CUSTOM_PROPERTY_TYPE_NUMERIC: {
                 new_property->value.numeric_value = property->value.numeric_value;
             } break;
             case APN_CUSTOM_PROPERTY_TYPE_ARRAY: {
+                new_property->value.array_value.array = NULL;
+                new_property->value.array_value.array_size = 0;
                 if (property->value.array_value.array && property->value.array_value.array_size > 0) {
                     char **array = (char **) malloc(sizeof(char *) * array_size);
                     if (!array) {
@@ -602,15 +927,15 @@ static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const a
                         __apn_payload_custom_property_free(new_property);
                         return NULL;
                     }
+                    new_property->value.array_value.array = array;
                     for (i = 0; i < array_size; i++) {
                         if(NULL == (array[i] = apn_strndup(property->value.array_value.array[i], strlen(property->value.array_value.array[i])))){
                             errno = ENOMEM;
                             __apn_payload_custom_property_free(new_property);
                             return NULL;
                         }
+                        new_property->value.array_value.array_size = i + 1;
                     }
-                    new_property->value.array_value.array_size = property->value.array_value.array_size;
-                    new_property->value.array_value.array = array;
                 }
             }break;
         }
@@ -618,16 +943,90 @@ static apn_payload_custom_property_t *__apn_payload_custom_property_copy(const a
     return new_property;
 }
 
-static apn_payload_alert_t *__apn_payload_alert_init() {
-    apn_payload_alert_t *alert = malloc(sizeof(apn_payload_alert_t));
-    if (!alert) {
+static void __apn_payload_invalidate(apn_payload_t *payload) {
+    payload->frame_valid = 0;
+}
+
+/* Sets the fields to their defaults, the custom properties are left as they are */
+static apn_return __apn_payload_init_content(apn_payload_t *payload) {
+    payload->badge = -1;
+    payload->sound = NULL;
+    payload->category = NULL;
+    payload->expiry = 0;
+    payload->content_available = 0;
+    payload->priority = APN_NOTIFICATION_PRIORITY_DEFAULT;
+    payload->body_fit = APN_PAYLOAD_BODY_FIT_NONE;
+    payload->raw_json = NULL;
+    payload->raw_json_size = 0;
+
+    if (NULL == (payload->alert = __apn_payload_alloc(payload, sizeof(apn_payload_alert_t)))) {
+        return APN_ERROR;
+    }
+    payload->alert->action_loc_key = NULL;
+    payload->alert->body = NULL;
+    payload->alert->launch_image = NULL;
+    payload->alert->loc_args = NULL;
+    payload->alert->loc_key = NULL;
+    return APN_SUCCESS;
+}
+
+/* Frees the fields, in arena mode their memory goes with the custom property array */
+static void __apn_payload_free_content(apn_payload_t *payload) {
+    if (payload->alert) {
+        apn_array_free(payload->alert->loc_args);
+        if (!payload->arena) {
+            apn_mem_free(payload->alert->action_loc_key);
+            apn_mem_free(payload->alert->body);
+            apn_mem_free(payload->alert->launch_image);
+            apn_mem_free(payload->alert->loc_key);
+            free(payload->alert);
+        }
+        payload->alert = NULL;
+    }
+    if (!payload->arena) {
+        apn_mem_free(payload->sound);
+        apn_mem_free(payload->category);
+        apn_mem_free(payload->raw_json);
+    }
+    payload->sound = NULL;
+    payload->category = NULL;
+    payload->raw_json = NULL;
+    payload->raw_json_size = 0;
+}
+
+static void *__apn_payload_alloc(apn_payload_t *payload, size_t size) {
+    void *memory = NULL;
+    if (payload && payload->arena) {
+        memory = apn_array_alloc(payload->custom_properties, size);
+    } else {
+        memory = malloc(size);
+    }
+    if (!memory) {
         errno = ENOMEM;
-        return NULL;
     }
-    alert->action_loc_key = NULL;
-    alert->body = NULL;
-    alert->launch_image = NULL;
-    alert->loc_args = NULL;
-    alert->loc_key = NULL;
-    return alert;
+    return memory;
+}
+
+static char *__apn_payload_strndup(apn_payload_t *payload, const char *str, size_t length) {
+    char *copy = NULL;
+    if (!payload || !payload->arena) {
+        if (NULL == (copy = apn_strndup(str, length))) {
+            errno = ENOMEM;
+        }
+        return copy;
+    }
+    if (NULL != (copy = __apn_payload_alloc(payload, length + 1))) {
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+/* Arena strings are not freed one by one, their memory is reused after apn_payload_reset() */
+static void __apn_payload_strfree(apn_payload_t *payload, char **str) {
+    if (payload->arena) {
+        *str = NULL;
+    } else {
+        apn_strfree(str);
+    }
 }
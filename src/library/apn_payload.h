@@ -43,6 +43,18 @@ typedef enum __apn_notification_priority_t {
     APN_NOTIFICATION_PRIORITY_HIGH = 10
 } apn_notification_priority_t;
 
+/**
+ * How an alert body which makes the payload too large is handled
+ */
+typedef enum __apn_payload_body_fit_t {
+    /* The payload is rejected with ::APN_ERR_INVALID_PAYLOAD_SIZE */
+    APN_PAYLOAD_BODY_FIT_NONE = 0,
+    /* The body is cut at a character boundary so that the payload fits */
+    APN_PAYLOAD_BODY_FIT_TRUNCATE = 1,
+    /* The body is cut at a character boundary and ends with an ellipsis (U+2026) */
+    APN_PAYLOAD_BODY_FIT_ELLIPSIS = 2
+} apn_payload_body_fit_t;
+
 typedef union __apn_payload_custom_value_t apn_payload_custom_value_t;
 typedef struct __apn_payload_custom_property_t apn_payload_custom_property_t;
 typedef struct __apn_payload_alert_t apn_payload_alert_t;
@@ -63,6 +75,20 @@ typedef struct __apn_payload_t apn_payload_t;
 __apn_export__ apn_payload_t *apn_payload_init()
         __apn_attribute_warn_unused_result__;
 
+/**
+ * Creates a new payload which allocates its strings and custom properties from a single arena
+ * instead of one allocation each. Arena memory is only returned by ::apn_payload_free(), values
+ * which are replaced keep their room until ::apn_payload_reset().
+ *
+ * Meant for a payload which is filled, sent and reset over and over.
+ *
+ * @return
+ *      - Pointer to new `payload` structure on success
+ *      - NULL on failure with error information stored to `errno`
+ */
+__apn_export__ apn_payload_t *apn_payload_init_arena()
+        __apn_attribute_warn_unused_result__;
+
 /**
  * Frees memory allocated for `payload`
  *
@@ -70,6 +96,38 @@ __apn_export__ apn_payload_t *apn_payload_init()
  */
 __apn_export__ void apn_payload_free(apn_payload_t *payload);
 
+/**
+ * Clears all fields and custom properties of `payload` and restores the defaults of ::apn_payload_init().
+ * An arena payload keeps its arena and its rendered frame, so refilling it does not allocate memory.
+ *
+ * @param[in, out] payload - Pointer to `payload` structure
+ *
+ * @return
+ *      - ::APN_SUCCESS on success
+ *      - ::APN_ERROR on failure with error information stored to `errno`
+ */
+__apn_export__ apn_return apn_payload_reset(apn_payload_t * const payload)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Renders the notification frame of `payload` and keeps it until the payload is modified.
+ *
+ * Functions which take a `const apn_payload_t *`, such as ::apn_send() or ::apn_create_binary_message(),
+ * only read the payload: they reuse the prepared frame, or render the payload on their own stack when it
+ * was not prepared or has been modified since. A payload which nobody modifies can therefore be used by
+ * several threads at once. Preparing it first saves each of them the rendering.
+ *
+ * Like the setters, this modifies `payload` and must not run while another thread uses it.
+ *
+ * @param[in, out] payload - Pointer to `payload` structure
+ *
+ * @return
+ *      - ::APN_SUCCESS on success
+ *      - ::APN_ERROR on failure with error information stored to `errno`
+ */
+__apn_export__ apn_return apn_payload_prepare(apn_payload_t * const payload)
+        __apn_attribute_nonnull__((1));
+
 /**
  * Sets expiration time of notification.
  *
@@ -159,6 +217,17 @@ __apn_export__ void apn_payload_set_priority(apn_payload_t *const payload, apn_n
 __apn_export__ apn_return apn_payload_set_body(apn_payload_t *const payload, const char *const body)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Makes the payload fit into the size limit by shortening the alert body instead of failing.
+ * The size of everything except the body is computed first, so the body is cut and the payload encoded in a single pass.
+ * Default is ::APN_PAYLOAD_BODY_FIT_NONE
+ *
+ * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
+ * @param[in] body_fit - How the body is shortened
+ */
+__apn_export__ void apn_payload_set_body_fit(apn_payload_t *const payload, apn_payload_body_fit_t body_fit)
+        __apn_attribute_nonnull__((1));
+
 /**
  * Sets a key used to get a localized string to use for the right button’s
  * caption instead of "View".
@@ -169,7 +238,7 @@ __apn_export__ apn_return apn_payload_set_body(apn_payload_t *const payload, con
  * @sa <a href="http://developer.apple.com/library/mac/documentation/NetworkingInternet/Conceptual/RemoteNotificationsPG/ApplePushService/ApplePushService.html#//apple_ref/doc/uid/TP40008194-CH100-SW21">Localized Formatted Strings</a> for more information
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
- * @param[in] key - Key for localized string
+ * @param[in] key - Key for localized string. Must be a valid UTF-8 encoded Unicode string
  *
  * @return
  *      - ::APN_SUCCESS on success
@@ -187,7 +256,7 @@ __apn_export__ apn_return apn_payload_set_localized_action_key(apn_payload_t *co
  * Info.plist file, or falls back to Default.png
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
- * @param[in] image - A filename of an image file
+ * @param[in] image - A filename of an image file. Must be a valid UTF-8 encoded Unicode string
  *
  * @return
  *      - ::APN_SUCCESS on success
@@ -205,8 +274,9 @@ __apn_export__ apn_return apn_payload_set_launch_image(apn_payload_t *const payl
  * @see <a href="http://developer.apple.com/library/mac/documentation/NetworkingInternet/Conceptual/RemoteNotificationsPG/ApplePushService/ApplePushService.html#//apple_ref/doc/uid/TP40008194-CH100-SW21">Localized Formatted Strings</a> for more information
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
- * @param[in] key - Key of localized string
- * @param[in] args - Array of string values to appear in place of the format specifiers in `key`
+ * @param[in] key - Key of localized string. Must be a valid UTF-8 encoded Unicode string
+ * @param[in] args - Array of string values to appear in place of the format specifiers in `key`,
+ * each must be a valid UTF-8 encoded Unicode string
  *
  * @return
  *      - ::APN_SUCCESS on success
@@ -219,7 +289,7 @@ __apn_export__ apn_return apn_payload_set_localized_key(apn_payload_t *const pay
  * Sets a category name of notification.
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
- * @param[in] category - Category name
+ * @param[in] category - Category name. Must be a valid UTF-8 encoded Unicode string
  *
  * @return
  *      - ::APN_SUCCESS on success
@@ -288,7 +358,7 @@ __apn_export__ apn_return apn_payload_add_custom_property_null(apn_payload_t *co
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
  * @param[in] name - Property name
- * @param[in] value - Property value
+ * @param[in] value - Property value. Must be a valid UTF-8 encoded Unicode string
  *
  * @return
  *      - ::APN_SUCCESS on success
@@ -302,7 +372,7 @@ __apn_export__ apn_return apn_payload_add_custom_property_string(apn_payload_t *
  *
  * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
  * @param[in] key - Property name
- * @param[in] array - Array
+ * @param[in] array - Array of strings, each must be a valid UTF-8 encoded Unicode string
  * @param[in] array_size - Count elements in `array`
  *
  * @return
@@ -312,6 +382,38 @@ __apn_export__ apn_return apn_payload_add_custom_property_string(apn_payload_t *
 __apn_export__ apn_return apn_payload_add_custom_property_array(apn_payload_t * const payload, const char *const key, const char **array, uint8_t array_size)
         __apn_attribute_nonnull__((1, 2, 3));
 
+/**
+ * Sets a complete JSON document as notification payload. The document is validated once and then
+ * sent as it is: while it is set, alert, badge, sound, category, content available flag and custom properties
+ * of the payload are ignored. Expiration time and priority still apply.
+ *
+ * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
+ * @param[in] json - JSON document, NULL or an empty string removes it
+ *
+ * @return
+ *      - ::APN_SUCCESS on success
+ *      - ::APN_ERROR on failure with error information stored to `errno`:
+ *      ::APN_ERR_INVALID_PAYLOAD_SIZE if the document is too large,
+ *      ::APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS if it is not valid UTF-8,
+ *      ::APN_ERR_PAYLOAD_JSON_INVALID if it is malformed or has no `aps` dictionary.
+ *      The previous document is kept.
+ */
+__apn_export__ apn_return apn_payload_set_raw_json(apn_payload_t * const payload, const char *const json)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns a JSON document set with ::apn_payload_set_raw_json().
+ *
+ * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
+ *
+ * @return Pointer to NULL-terminated string or NULL if the document is not set
+ *
+ * The returned value is read-only and must not be modified or freed
+ */
+__apn_export__ const char *apn_payload_raw_json(const apn_payload_t * const payload)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
 /**
  * Returns a content available flag.
  *
@@ -431,6 +533,27 @@ __apn_export__ const char *apn_payload_body(const apn_payload_t * const payload)
         __apn_attribute_nonnull__((1))
         __apn_attribute_warn_unused_result__;
 
+/**
+ * Returns how the alert body is shortened to fit the payload size limit.
+ *
+ * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
+ */
+__apn_export__ apn_payload_body_fit_t apn_payload_body_fit(const apn_payload_t * const payload)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Returns size of the JSON document of the payload, as it is sent: with the alert body shortened
+ * if ::apn_payload_set_body_fit() is used. The document is measured, not rendered.
+ *
+ * @param[in] payload - Pointer to an initialized `payload` structure. Cannot be NULL
+ *
+ * @return Size in bytes, may exceed the payload size limit, or 0 on failure with error information stored to `errno`
+ */
+__apn_export__ uint32_t apn_payload_serialized_size(const apn_payload_t * const payload)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
 /**
  * Returns a notification's priority.
  *
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_payload_template.h"
+#include "apn_paload_private.h"
+#include "apn_binary_message_private.h"
+#include "apn_strings.h"
+#include "apn_json.h"
+#include "apn.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#define APN_PAYLOAD_TEMPLATE_NO_PLACEHOLDER UINT32_MAX
+#define APN_PAYLOAD_TEMPLATE_MAX_NAME_LENGTH 64
+
+typedef struct __apn_payload_template_segment_t {
+    /** Literal text, points into `document` */
+    const char *literal;
+    uint32_t length;
+    /** Index of the placeholder which follows the literal, or APN_PAYLOAD_TEMPLATE_NO_PLACEHOLDER */
+    uint32_t placeholder;
+} apn_payload_template_segment_t;
+
+typedef struct __apn_payload_template_placeholder_t {
+    /** Name, points into `document` and is not NUL-terminated */
+    const char *name;
+    uint32_t name_length;
+    uint8_t integer;
+} apn_payload_template_placeholder_t;
+
+struct __apn_payload_template_t {
+    char *document;
+    apn_payload_template_segment_t *segments;
+    uint32_t segment_count;
+    apn_payload_template_placeholder_t *placeholders;
+    uint32_t placeholder_count;
+    time_t expiry;
+    apn_notification_priority_t priority;
+};
+
+static apn_return __apn_payload_template_parse(apn_payload_template_t *const payload_template);
+static apn_return __apn_payload_template_check(const apn_payload_template_t *const payload_template);
+static int32_t __apn_payload_template_find(const apn_payload_template_t *const payload_template,
+                                           const char *const name, uint32_t name_length);
+static uint8_t __apn_payload_template_name_char(char c);
+
+apn_payload_template_t *apn_payload_template_init(const char *const json) {
+    apn_payload_template_t *payload_template = NULL;
+    const char *p = json;
+    uint32_t opening_count = 0;
+    assert(json);
+
+    /* every placeholder starts with "{{", which bounds the number of segments and placeholders */
+    while (NULL != (p = strstr(p, "{{"))) {
+        opening_count++;
+        p += 2;
+    }
+
+    payload_template = malloc(sizeof(apn_payload_template_t));
+    if (!payload_template) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    payload_template->segment_count = 0;
+    payload_template->placeholder_count = 0;
+    payload_template->expiry = 0;
+    payload_template->priority = APN_NOTIFICATION_PRIORITY_DEFAULT;
+    payload_template->document = apn_strndup(json, strlen(json));
+    payload_template->segments = malloc(sizeof(apn_payload_template_segment_t) * (opening_count + 1));
+    payload_template->placeholders = malloc(sizeof(apn_payload_template_placeholder_t) * (opening_count + 1));
+    if (!payload_template->document || !payload_template->segments || !payload_template->placeholders) {
+        apn_payload_template_free(payload_template);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (APN_ERROR == __apn_payload_template_parse(payload_template)
+        || APN_ERROR == __apn_payload_template_check(payload_template)) {
+        apn_payload_template_free(payload_template);
+        return NULL;
+    }
+    return payload_template;
+}
+
+void apn_payload_template_free(apn_payload_template_t *payload_template) {
+    if (payload_template) {
+        free(payload_template->document);
+        free(payload_template->segments);
+        free(payload_template->placeholders);
+        free(payload_template);
+    }
+}
+
+void apn_payload_template_set_expiry(apn_payload_template_t *const payload_template, time_t expiry) {
+    assert(payload_template);
+    payload_template->expiry = expiry;
+}
+
+void apn_payload_template_set_priority(apn_payload_template_t *const payload_template,
+                                       apn_notification_priority_t priority) {
+    assert(payload_template);
+    if (APN_NOTIFICATION_PRIORITY_DEFAULT != priority && APN_NOTIFICATION_PRIORITY_HIGH != priority) {
+        priority = APN_NOTIFICATION_PRIORITY_DEFAULT;
+    }
+    payload_template->priority = priority;
+}
+
+uint32_t apn_payload_template_placeholder_count(const apn_payload_template_t *const payload_template) {
+    assert(payload_template);
+    return payload_template->placeholder_count;
+}
+
+int32_t apn_payload_template_placeholder_index(const apn_payload_template_t *const payload_template,
+                                               const char *const name) {
+    assert(payload_template);
+    assert(name);
+    return __apn_payload_template_find(payload_template, name, (uint32_t) strlen(name));
+}
+
+uint32_t apn_payload_template_write(const apn_payload_template_t *const payload_template,
+                                    const apn_payload_template_value_t *const values,
+                                    const uint8_t *const token, uint32_t id,
+                                    uint8_t *const buffer, uint32_t buffer_size) {
+    apn_json_writer_t writer;
+    uint32_t frame_overhead = apn_binary_message_frame_size(0);
+    uint32_t capacity = 0;
+    uint32_t i = 0;
+    assert(payload_template);
+    assert(values || 0 == payload_template->placeholder_count);
+    assert(buffer);
+
+    if (buffer_size < frame_overhead) {
+        errno = ENOBUFS;
+        return 0;
+    }
+    capacity = buffer_size - frame_overhead;
+    if (capacity > APN_PAYLOAD_MAX_SIZE) {
+        capacity = APN_PAYLOAD_MAX_SIZE;
+    }
+
+    /* the payload is rendered in place, the frame header is encoded around it */
+    apn_json_writer_init(&writer, (char *) buffer + APN_BINARY_MESSAGE_PAYLOAD_OFFSET, capacity);
+    for (i = 0; i < payload_template->segment_count && !writer.overflow; i++) {
+        const apn_payload_template_segment_t *segment = &payload_template->segments[i];
+        const apn_payload_template_value_t *value = NULL;
+
+        apn_json_write_raw(&writer, segment->literal, segment->length);
+        if (APN_PAYLOAD_TEMPLATE_NO_PLACEHOLDER == segment->placeholder) {
+            continue;
+        }
+        value = &values[segment->placeholder];
+        if (payload_template->placeholders[segment->placeholder].integer) {
+            apn_json_write_integer(&writer, value->integer);
+        } else if (value->string) {
+            if (!apn_string_is_utf8(value->string)) {
+                errno = APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS;
+                return 0;
+            }
+            apn_json_write_escaped(&writer, value->string, strlen(value->string));
+        }
+    }
+
+    if (writer.overflow) {
+        errno = (capacity < APN_PAYLOAD_MAX_SIZE) ? ENOBUFS : APN_ERR_INVALID_PAYLOAD_SIZE;
+        return 0;
+    }
+    return apn_binary_message_encode(buffer, token, writer.buffer, (uint32_t) writer.length, id,
+                                     (uint32_t) payload_template->expiry, (uint8_t) payload_template->priority);
+}
+
+static apn_return __apn_payload_template_parse(apn_payload_template_t *const payload_template) {
+    const char *p = payload_template->document;
+    const char *literal = p;
+    size_t literal_size = 0;
+    uint8_t in_string = 0;
+
+    while (*p) {
+        if ('{' == p[0] && '{' == p[1]) {
+            /* "{{" is never valid JSON outside a string literal, so it always opens a placeholder */
+            uint8_t integer = (uint8_t) ('#' == p[2]);
+            const char *name = p + 2 + integer;
+            const char *name_end = name;
+            apn_payload_template_segment_t *segment = NULL;
+            int32_t index = 0;
+
+            while (__apn_payload_template_name_char(*name_end)) {
+                name_end++;
+            }
+            if (name_end == name || name_end - name > APN_PAYLOAD_TEMPLATE_MAX_NAME_LENGTH
+                || '}' != name_end[0] || '}' != name_end[1] || (!integer && !in_string)) {
+                errno = APN_ERR_PAYLOAD_TEMPLATE_INVALID;
+                return APN_ERROR;
+            }
+
+            index = __apn_payload_template_find(payload_template, name, (uint32_t) (name_end - name));
+            if (index < 0) {
+                apn_payload_template_placeholder_t *placeholder =
+                        &payload_template->placeholders[payload_template->placeholder_count];
+                placeholder->name = name;
+                placeholder->name_length = (uint32_t) (name_end - name);
+                placeholder->integer = integer;
+                index = (int32_t) payload_template->placeholder_count++;
+            } else if (payload_template->placeholders[index].integer != integer) {
+                errno = APN_ERR_PAYLOAD_TEMPLATE_INVALID;
+                return APN_ERROR;
+            }
+
+            segment = &payload_template->segments[payload_template->segment_count++];
+            segment->literal = literal;
+            segment->length = (uint32_t) (p - literal);
+            segment->placeholder = (uint32_t) index;
+            literal_size += segment->length;
+
+            p = name_end + 2;
+            literal = p;
+            continue;
+        }
+        if (in_string) {
+            if ('\\' == *p && p[1]) {
+                p++;
+            } else if ('"' == *p) {
+                in_string = 0;
+            }
+        } else if ('"' == *p) {
+            in_string = 1;
+        }
+        p++;
+    }
+
+    if (in_string) {
+        errno = APN_ERR_PAYLOAD_TEMPLATE_INVALID;
+        return APN_ERROR;
+    }
+    payload_template->segments[payload_template->segment_count].literal = literal;
+    payload_template->segments[payload_template->segment_count].length = (uint32_t) (p - literal);
+    payload_template->segments[payload_template->segment_count].placeholder = APN_PAYLOAD_TEMPLATE_NO_PLACEHOLDER;
+    payload_template->segment_count++;
+    literal_size += (size_t) (p - literal);
+
+    if (literal_size > APN_PAYLOAD_MAX_SIZE) {
+        errno = APN_ERR_INVALID_PAYLOAD_SIZE;
+        return APN_ERROR;
+    }
+    return APN_SUCCESS;
+}
+
+/* Validates a sample with empty strings and zeros, so a broken document is rejected once instead of on the wire */
+static apn_return __apn_payload_template_check(const apn_payload_template_t *const payload_template) {
+    char *sample = NULL;
+    size_t length = 0;
+    uint32_t i = 0;
+    apn_return ret = APN_SUCCESS;
+
+    for (i = 0; i < payload_template->segment_count; i++) {
+        length += payload_template->segments[i].length + 1;
+    }
+    if (NULL == (sample = malloc(length))) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    length = 0;
+    for (i = 0; i < payload_template->segment_count; i++) {
+        const apn_payload_template_segment_t *segment = &payload_template->segments[i];
+        memcpy(sample + length, segment->literal, segment->length);
+        length += segment->length;
+        if (APN_PAYLOAD_TEMPLATE_NO_PLACEHOLDER != segment->placeholder
+            && payload_template->placeholders[segment->placeholder].integer) {
+            sample[length++] = '0';
+        }
+    }
+
+    if (APN_ERROR == (ret = apn_json_validate_payload(sample, length))
+        && APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS != errno) {
+        errno = APN_ERR_PAYLOAD_TEMPLATE_INVALID;
+    }
+    free(sample);
+    return ret;
+}
+
+static int32_t __apn_payload_template_find(const apn_payload_template_t *const payload_template,
+                                           const char *const name, uint32_t name_length) {
+    uint32_t i = 0;
+    for (i = 0; i < payload_template->placeholder_count; i++) {
+        const apn_payload_template_placeholder_t *placeholder = &payload_template->placeholders[i];
+        if (placeholder->name_length == name_length && 0 == memcmp(placeholder->name, name, name_length)) {
+            return (int32_t) i;
+        }
+    }
+    return -1;
+}
+
+static uint8_t __apn_payload_template_name_char(char c) {
+    return (uint8_t) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                      || '_' == c || '-' == c || '.' == c);
+}
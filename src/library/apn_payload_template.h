@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_PAYLOAD_TEMPLATE_H__
+#define __APN_PAYLOAD_TEMPLATE_H__
+
+#include "apn_platform.h"
+#include "apn_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Payload template: a JSON document with placeholders, split into literal segments when it is created.
+ * Rendering a notification splices the values of one recipient between the segments straight into a frame,
+ * no payload structure is built.
+ *
+ * Placeholders are written as `{{name}}` and `{{#name}}`:
+ *      - `{{name}}` is a string placeholder and must be inside a JSON string literal, the value is escaped;
+ *      - `{{#name}}` is an integer placeholder and can be used as a JSON value or inside a string literal.
+ *
+ * E.g. `{"aps":{"alert":"Hello, {{name}}!","badge":{{#unread}}},"id":"{{#id}}"}`.
+ * `{{` always starts a placeholder, also inside a string; a literal `{{` is written as `{\u007b`.
+ */
+typedef struct __apn_payload_template_t apn_payload_template_t;
+
+/**
+ * Value of a placeholder. `string` is used by string placeholders (UTF-8, NULL is rendered as an empty string),
+ * `integer` by integer placeholders.
+ */
+typedef struct __apn_payload_template_value_t {
+    const char *string;
+    int64_t integer;
+} apn_payload_template_value_t;
+
+/**
+ * Creates a template from a JSON document.
+ *
+ * @param[in] json - JSON document with placeholders. Cannot be NULL.
+ *
+ * The document is checked with every string placeholder empty and every integer placeholder 0, it must be
+ * valid JSON with an `aps` object, see ::apn_payload_set_raw_json().
+ *
+ * @return Pointer to new `template` structure on success, or NULL on failure with error information stored in `errno`,
+ * ::APN_ERR_PAYLOAD_TEMPLATE_INVALID if a placeholder is malformed or misplaced or the document is not a valid payload,
+ * ::APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS if the document is not valid UTF-8,
+ * ::APN_ERR_INVALID_PAYLOAD_SIZE if the literal text alone does not fit into a payload.
+ */
+__apn_export__ apn_payload_template_t *apn_payload_template_init(const char *const json)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Frees memory allocated for the template.
+ *
+ * @param[in] payload_template - Pointer to `template` structure.
+ */
+__apn_export__ void apn_payload_template_free(apn_payload_template_t *payload_template);
+
+/**
+ * Sets expiration time of notifications rendered from the template, see ::apn_payload_set_expiry().
+ *
+ * @param[in] payload_template - Pointer to `template` structure. Cannot be NULL.
+ * @param[in] expiry - UNIX epoch date expressed in seconds (UTC).
+ */
+__apn_export__ void apn_payload_template_set_expiry(apn_payload_template_t *const payload_template, time_t expiry)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sets priority of notifications rendered from the template, see ::apn_payload_set_priority().
+ *
+ * @param[in] payload_template - Pointer to `template` structure. Cannot be NULL.
+ * @param[in] priority - Priority.
+ */
+__apn_export__ void apn_payload_template_set_priority(apn_payload_template_t *const payload_template,
+                                                      apn_notification_priority_t priority)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns number of distinct placeholders. Values are passed as an array of this size,
+ * in the order in which the placeholders first appear in the document.
+ *
+ * @param[in] payload_template - Pointer to `template` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_payload_template_placeholder_count(const apn_payload_template_t *const payload_template)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns index of the value of placeholder `name` in the value array.
+ *
+ * @param[in] payload_template - Pointer to `template` structure. Cannot be NULL.
+ * @param[in] name - Placeholder name, without braces and `#`. Cannot be NULL.
+ *
+ * @return Index of the placeholder, or -1 if the template has no such placeholder.
+ */
+__apn_export__ int32_t apn_payload_template_placeholder_index(const apn_payload_template_t *const payload_template,
+                                                              const char *const name)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Renders a notification frame for one recipient directly into a caller-provided buffer,
+ * see ::apn_binary_message_write().
+ *
+ * @param[in] payload_template - Pointer to `template` structure. Cannot be NULL.
+ * @param[in] values - Placeholder values, see ::apn_payload_template_placeholder_count(). Can be NULL if the template
+ * has no placeholders.
+ * @param[in] token - Binary device token (32 bytes). Can be NULL, then the token is zeroed.
+ * @param[in] id - Notification identifier.
+ * @param[out] buffer - Buffer for the frame. Cannot be NULL.
+ * @param[in] buffer_size - Size of `buffer`.
+ *
+ * @return Size of the frame on success, or 0 on failure with error information stored in `errno`,
+ * ::APN_ERR_INVALID_PAYLOAD_SIZE if the rendered payload is too large, `ENOBUFS` if the frame does not fit
+ * into `buffer`, ::APN_ERR_STRING_CONTAINS_NON_UTF8_CHARACTERS if a string value is not valid UTF-8.
+ */
+__apn_export__ uint32_t apn_payload_template_write(const apn_payload_template_t *const payload_template,
+                                                   const apn_payload_template_value_t *const values,
+                                                   const uint8_t *const token, uint32_t id,
+                                                   uint8_t *const buffer, uint32_t buffer_size)
+        __apn_attribute_nonnull__((1,5));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
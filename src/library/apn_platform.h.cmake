@@ -34,6 +34,11 @@
 #cmakedefine APN_HAVE_STRINGS_H
 #cmakedefine APN_HAVE_NETINET_IN_H
 #cmakedefine APN_HAVE_SYS_SOCKET_H
+#cmakedefine APN_HAVE_POLL_H
+#cmakedefine APN_HAVE_SYS_EPOLL_H
+#cmakedefine APN_HAVE_NETINET_TCP_H
+#cmakedefine APN_HAVE_IMMINTRIN_H
+#cmakedefine APN_HAVE_SYS_MMAN_H
 
 #cmakedefine APN_HAVE_STRERROR_R
 #cmakedefine APN_HAVE_GLIBC_STRERROR_R
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+/* struct tcp_info */
+#define _DEFAULT_SOURCE
+#endif
+
+#include "apn_poll.h"
+
+#include <errno.h>
+#include <time.h>
+
+#ifdef APN_HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef APN_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#ifdef APN_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
+#ifdef APN_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#endif
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+int apn_poll(SOCKET sock, uint32_t events, int timeout) {
+    struct pollfd pfd;
+    int ret = 0;
+    int revents = 0;
+
+    pfd.fd = sock;
+    pfd.events = 0;
+    pfd.revents = 0;
+    if (events & APN_POLL_READ) {
+        pfd.events |= POLLIN;
+    }
+    if (events & APN_POLL_WRITE) {
+        pfd.events |= POLLOUT;
+    }
+
+    for (;;) {
+#ifdef _WIN32
+        if (sock == INVALID_SOCKET) {
+            Sleep(timeout < 0 ? INFINITE : (DWORD) timeout);
+            return 0;
+        }
+#endif
+        ret = poll(&pfd, 1, timeout);
+        if (ret < 0 && EINTR == errno) {
+            continue;
+        }
+        break;
+    }
+
+    if (ret <= 0) {
+        return ret;
+    }
+    if (pfd.revents & POLLIN) {
+        revents |= APN_POLL_READ;
+    }
+    if (pfd.revents & POLLOUT) {
+        revents |= APN_POLL_WRITE;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        /* Let the SSL layer find out what happened */
+        revents |= APN_POLL_ERROR | (events & APN_POLL_READ);
+    }
+    return revents;
+}
+
+void apn_socket_stats(SOCKET sock, uint32_t *rtt, uint32_t *unacked) {
+#if defined(__linux__) && defined(APN_HAVE_NETINET_TCP_H) && defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t info_size = sizeof(info);
+
+    if (sock < 0 || 0 != getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &info_size)) {
+        return;
+    }
+    if (info.tcpi_rtt > 0) {
+        *rtt = info.tcpi_rtt < 1000 ? 1 : info.tcpi_rtt / 1000;
+    }
+    *unacked = info.tcpi_unacked * info.tcpi_snd_mss;
+#else
+    (void) sock;
+    (void) rtt;
+    (void) unacked;
+#endif
+}
+
+uint32_t apn_socket_pending(SOCKET sock) {
+#if defined(__linux__) && defined(TIOCOUTQ)
+    /* SIOCOUTQ (same value as TIOCOUTQ) counts both unsent and unacknowledged bytes */
+    int pending = 0;
+    if (sock < 0 || 0 != ioctl(sock, TIOCOUTQ, &pending) || pending < 0) {
+        return 0;
+    }
+    return (uint32_t) pending;
+#else
+    (void) sock;
+    return 0;
+#endif
+}
+
+uint64_t apn_time_ms(void) {
+#ifdef _WIN32
+    return (uint64_t) GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) (ts.tv_nsec / 1000000);
+#endif
+}
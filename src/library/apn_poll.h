@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_POLL_H__
+#define __APN_POLL_H__
+
+#include "apn_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APN_POLL_READ  (1 << 0)
+#define APN_POLL_WRITE (1 << 1)
+#define APN_POLL_ERROR (1 << 2)
+
+/**
+ * Waits until a socket becomes ready for reading and/or writing.
+ *
+ * Unlike select() works with any descriptor value. A negative `sock` is ignored,
+ * the function just waits for `timeout` in that case.
+ *
+ * @param[in] sock - Socket.
+ * @param[in] events - Bit mask of ::APN_POLL_READ and ::APN_POLL_WRITE.
+ * @param[in] timeout - Timeout in milliseconds, -1 to wait infinitely.
+ *
+ * @return
+ *      - Bit mask of ready events on success.
+ *      - 0 on timeout.
+ *      - -1 on failure with error information stored in `errno`.
+ */
+int apn_poll(SOCKET sock, uint32_t events, int timeout);
+
+/**
+ * Reads round-trip time (in milliseconds) and amount of sent but unacknowledged data (in bytes)
+ * from the TCP stack. Values are left unchanged where this is not supported.
+ */
+void apn_socket_stats(SOCKET sock, uint32_t *rtt, uint32_t *unacked)
+        __apn_attribute_nonnull__((2,3));
+
+/**
+ * Returns number of bytes written to a socket and not yet acknowledged by the peer,
+ * or 0 where this is not supported.
+ */
+uint32_t apn_socket_pending(SOCKET sock);
+
+/**
+ * Returns monotonic time in milliseconds.
+ */
+uint64_t apn_time_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_pool.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "apn_private.h"
+#include "apn_array_private.h"
+#include "apn_engine_private.h"
+#include "apn_loop.h"
+
+struct __apn_pool_t {
+    apn_ctx_t **connections;
+    uint32_t size;
+    apn_loop_t *loop;
+    apn_rate_limiter_t rate_limiter;
+};
+
+static apn_return __apn_pool_configure(apn_ctx_t *const dst, const apn_ctx_t *const src);
+static apn_return __apn_pool_merge_tokens(apn_array_t **dst, apn_array_t *src);
+
+apn_pool_t *apn_pool_init(const apn_ctx_t *const ctx, uint32_t size) {
+    apn_pool_t *pool = NULL;
+    uint32_t i = 0;
+    assert(ctx);
+    assert(size > 0);
+
+    pool = malloc(sizeof(apn_pool_t));
+    if (!pool) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    pool->size = 0;
+    pool->loop = NULL;
+    apn_rate_limiter_init(&pool->rate_limiter, 0, 0);
+    pool->connections = calloc(size, sizeof(apn_ctx_t *));
+    if (!pool->connections) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (NULL == (pool->loop = apn_loop_init())) {
+        apn_pool_free(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        apn_ctx_t *connection = apn_init();
+        if (!connection) {
+            apn_pool_free(pool);
+            return NULL;
+        }
+        pool->connections[pool->size++] = connection;
+        connection->shared_rate_limiter = &pool->rate_limiter;
+        if (APN_ERROR == __apn_pool_configure(connection, ctx)
+            || APN_ERROR == apn_loop_add(pool->loop, connection, NULL, NULL)) {
+            apn_pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void apn_pool_free(apn_pool_t *pool) {
+    uint32_t i = 0;
+    if (pool) {
+        apn_loop_free(pool->loop);
+        for (i = 0; i < pool->size; i++) {
+            apn_free(pool->connections[i]);
+        }
+        free(pool->connections);
+        free(pool);
+    }
+}
+
+apn_return apn_pool_connect(apn_pool_t *const pool) {
+    uint32_t i = 0;
+    assert(pool);
+
+    for (i = 0; i < pool->size; i++) {
+        if (APN_ERROR == apn_connect(pool->connections[i])) {
+            int error = errno;
+            apn_pool_close(pool);
+            errno = error;
+            return APN_ERROR;
+        }
+    }
+    return APN_SUCCESS;
+}
+
+void apn_pool_close(apn_pool_t *const pool) {
+    uint32_t i = 0;
+    assert(pool);
+
+    for (i = 0; i < pool->size; i++) {
+        apn_close(pool->connections[i]);
+    }
+}
+
+void apn_pool_set_rate_limit(apn_pool_t *const pool, uint32_t notifications_per_second, uint32_t bytes_per_second) {
+    assert(pool);
+    apn_rate_limiter_init(&pool->rate_limiter, notifications_per_second, bytes_per_second);
+}
+
+uint32_t apn_pool_size(const apn_pool_t *const pool) {
+    assert(pool);
+    return pool->size;
+}
+
+apn_ctx_t *apn_pool_ctx(const apn_pool_t *const pool, uint32_t index) {
+    assert(pool);
+    assert(index < pool->size);
+    return pool->connections[index];
+}
+
+apn_return apn_pool_send(apn_pool_t *const pool, const apn_payload_t *payload, apn_array_t *tokens,
+                         apn_array_t **invalid_tokens) {
+    uint32_t count = 0;
+    uint32_t shard_size = 0;
+    uint32_t remainder = 0;
+    uint32_t first_index = 0;
+    uint32_t i = 0;
+    int error = 0;
+    apn_array_t *_invalid_tokens = NULL;
+    apn_return ret = APN_SUCCESS;
+
+    assert(pool);
+    assert(payload);
+    assert(tokens);
+
+    count = apn_array_count(tokens);
+    assert(count > 0);
+
+    shard_size = count / pool->size;
+    remainder = count % pool->size;
+
+    for (i = 0; i < pool->size && first_index < count; i++) {
+        apn_ctx_t *connection = pool->connections[i];
+        uint32_t end_index = first_index + shard_size + (i < remainder ? 1 : 0);
+
+        if (APN_ERROR == apn_send_range_async(connection, payload, tokens, first_index, end_index)) {
+            if (!error) {
+                error = errno;
+            }
+            ret = APN_ERROR;
+        }
+        first_index = end_index;
+    }
+
+    if (APN_ERROR == apn_loop_run(pool->loop)) {
+        /* Finish whatever is left without the loop */
+        for (i = 0; i < pool->size; i++) {
+            apn_engine_wait(pool->connections[i]);
+        }
+    }
+
+    for (i = 0; i < pool->size; i++) {
+        apn_array_t *connection_invalid_tokens = NULL;
+        if (APN_ERROR == apn_send_result(pool->connections[i], &connection_invalid_tokens)) {
+            if (!error) {
+                error = errno;
+            }
+            ret = APN_ERROR;
+        }
+        if (connection_invalid_tokens) {
+            if (APN_ERROR == __apn_pool_merge_tokens(&_invalid_tokens, connection_invalid_tokens)) {
+                if (!error) {
+                    error = errno;
+                }
+                ret = APN_ERROR;
+            }
+        }
+    }
+
+    if (invalid_tokens && _invalid_tokens) {
+        *invalid_tokens = _invalid_tokens;
+    } else {
+        apn_array_free(_invalid_tokens);
+    }
+
+    errno = error;
+    return ret;
+}
+
+static apn_return __apn_pool_configure(apn_ctx_t *const dst, const apn_ctx_t *const src) {
+    dst->mode = src->mode;
+    dst->options = src->options;
+    dst->send_buffer_size = src->send_buffer_size;
+    dst->replay_buffer_size = src->replay_buffer_size;
+    dst->replay_window = src->replay_window;
+    dst->drain_timeout = src->drain_timeout;
+    dst->reconnect_delay = src->reconnect_delay;
+    dst->reconnect_max_delay = src->reconnect_max_delay;
+    dst->reconnect_max_attempts = src->reconnect_max_attempts;
+    dst->feedback_timeout = src->feedback_timeout;
+    dst->inflight_limit = src->inflight_limit;
+    apn_rate_limiter_init(&dst->rate_limiter, src->rate_limiter.notifications.rate, src->rate_limiter.bytes.rate);
+    dst->log_level = src->log_level;
+    dst->log_callback = src->log_callback;
+    dst->invalid_token_callback = src->invalid_token_callback;
+    dst->suppression = src->suppression;
+
+    if (APN_ERROR == apn_set_certificate(dst, src->certificate_file, src->private_key_file, src->private_key_pass)) {
+        return APN_ERROR;
+    }
+    if (src->pkcs12_file) {
+        if (APN_ERROR == apn_set_pkcs12_file(dst, src->pkcs12_file, src->pkcs12_pass)) {
+            return APN_ERROR;
+        }
+    }
+    return APN_SUCCESS;
+}
+
+static apn_return __apn_pool_merge_tokens(apn_array_t **dst, apn_array_t *src) {
+    uint32_t i = 0;
+    apn_return ret = APN_SUCCESS;
+
+    if (!*dst) {
+        *dst = apn_array_init_arena(src->count > 10 ? src->count : 10);
+        if (!*dst) {
+            apn_array_free(src);
+            return APN_ERROR;
+        }
+    }
+
+    /* Copy strings to the arena of the merged array */
+    for (i = 0; i < src->count && APN_SUCCESS == ret; i++) {
+        const char *token = apn_array_item_at_index(src, i);
+        if (token) {
+            ret = apn_array_insert_copy(*dst, token, strlen(token) + 1);
+        }
+    }
+    apn_array_free(src);
+    return ret;
+}
+
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_POOL_H__
+#define __APN_POOL_H__
+
+#include "apn_platform.h"
+#include "apn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct __apn_pool_t apn_pool_t;
+
+/**
+ * Creates a pool of connections to Apple Push Notification Service.
+ *
+ * Each connection is configured as `ctx`: mode, certificate, private key or PKCS#12 file,
+ * behavior options, buffer sizes, timeouts, per-connection rate and in-flight limits, log level and callbacks are copied.
+ * Apple allows opening multiple connections to the gateway, notifications
+ * are sent on all of them in parallel.
+ *
+ * @param[in] ctx - Pointer to a configured `ctx` structure which is used as a template. Cannot be NULL.
+ * @param[in] size - Number of connections. Must be greater than zero.
+ *
+ * @return Pointer to new `pool` structure on success, or NULL on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_pool_t *apn_pool_init(const apn_ctx_t *const ctx, uint32_t size)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Closes all connections and frees memory allocated for the pool.
+ *
+ * @param[in] pool - Pointer to `pool` structure.
+ */
+__apn_export__ void apn_pool_free(apn_pool_t *pool);
+
+/**
+ * Opens all connections of the pool.
+ *
+ * @param[in] pool - Pointer to an initialized `pool` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`. Opened connections are closed.
+ */
+__apn_export__ apn_return apn_pool_connect(apn_pool_t *const pool)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Closes all connections of the pool.
+ *
+ * @param[in] pool - Pointer to an initialized `pool` structure. Cannot be NULL.
+ */
+__apn_export__ void apn_pool_close(apn_pool_t *const pool)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Limits how fast notifications are written by all connections of the pool together,
+ * in addition to the limits of each connection (see ::apn_set_rate_limit()). Default is no limit.
+ *
+ * @param[in] pool - Pointer to an initialized `pool` structure. Cannot be NULL.
+ * @param[in] notifications_per_second - Maximum number of notifications per second, 0 for no limit.
+ * @param[in] bytes_per_second - Maximum number of bytes per second, 0 for no limit.
+ */
+__apn_export__ void apn_pool_set_rate_limit(apn_pool_t *const pool, uint32_t notifications_per_second, uint32_t bytes_per_second)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns number of connections in the pool.
+ *
+ * @param[in] pool - Pointer to an initialized `pool` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_pool_size(const apn_pool_t *const pool)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns connection at `index`, e.g. to change its settings.
+ *
+ * @param[in] pool - Pointer to an initialized `pool` structure. Cannot be NULL.
+ * @param[in] index - Index of the connection, less than ::apn_pool_size().
+ */
+__apn_export__ apn_ctx_t *apn_pool_ctx(const apn_pool_t *const pool, uint32_t index)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sends a push notification to the devices, splitting `tokens` into contiguous
+ * ranges of nearly equal size, one range per connection.
+ *
+ * Indexes reported to the invalid token callback refer to `tokens`.
+ *
+ * @param[in] pool - Pointer to a connected `pool` structure. Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL. Only read, so it can be shared
+ * by threads as long as nobody modifies it, see ::apn_payload_prepare().
+ * @param[in] tokens - Array of device tokens. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Array of invalid tokens collected from all connections. Each item is string.
+ * The array should be freed - call ::apn_array_free() function for it. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if any connection failed, with error information of the first failure stored in `errno`.
+ */
+__apn_export__ apn_return apn_pool_send(apn_pool_t *const pool, const apn_payload_t *payload, apn_array_t *tokens, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1,2,3));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
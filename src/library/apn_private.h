@@ -27,17 +27,46 @@
 #include <time.h>
 #include "apn_platform.h"
 #include "apn.h"
+#include "apn_engine_private.h"
+#include "apn_rate.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+
+typedef enum __apn_connect_phase {
+    APN_CONNECT_PHASE_NONE = 0,
+    APN_CONNECT_PHASE_TCP,
+    APN_CONNECT_PHASE_SSL
+} apn_connect_phase;
+
 struct __apn_ctx_t {
     uint8_t feedback;
     uint16_t log_level;
     apn_connection_mode mode;
     SOCKET sock;
+    /** Incremented for each new socket */
+    uint32_t connection_id;
+    apn_connect_phase connect_phase;
+    uint64_t connect_started;
+    struct addrinfo *addrinfo;
+    struct addrinfo *addrinfo_next;
     uint32_t options;
+    uint32_t send_buffer_size;
+    uint32_t replay_buffer_size;
+    uint32_t replay_window;
+    uint32_t drain_timeout;
+    uint32_t reconnect_delay;
+    uint32_t reconnect_max_delay;
+    uint32_t reconnect_max_attempts;
+    uint32_t feedback_timeout;
+    uint32_t inflight_limit;
+    apn_rate_limiter_t rate_limiter;
+    /** Limiter shared by all connections of a pool. Can be NULL */
+    apn_rate_limiter_t *shared_rate_limiter;
+    /** Smoothed round-trip time measured while connecting, in milliseconds */
+    uint32_t rtt;
     char *certificate_file;
     char *private_key_file;
     char *private_key_pass;
@@ -46,8 +75,39 @@ struct __apn_ctx_t {
     SSL *ssl;
     log_callback log_callback;
     invalid_token_callback invalid_token_callback;
+    /** Not owned. Can be NULL */
+    apn_suppression_t *suppression;
+    apn_engine_t engine;
 };
 
+/**
+ * Starts connecting to Apple Push Notification Service without blocking on the socket.
+ * Hostname resolution is still synchronous.
+ */
+apn_return apn_connect_async(apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Advances a connection started with ::apn_connect_async().
+ *
+ * @return
+ *      - 1 if the connection is established.
+ *      - 0 if it is in progress, `want` receives ::APN_POLL_READ or ::APN_POLL_WRITE.
+ *      - -1 on failure with error information stored in `errno`. The connection is closed.
+ */
+int apn_connect_process(apn_ctx_t *const ctx, uint32_t *want)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Starts sending a push notification to devices from `tokens` with indexes in range [`first_index`, `end_index`).
+ * Indexes are used as notification identifiers and reported to the invalid token callback as is.
+ */
+apn_return apn_send_range_async(apn_ctx_t *const ctx, const apn_payload_t *payload, apn_array_t *tokens,
+                                uint32_t first_index, uint32_t end_index)
+        __apn_attribute_nonnull__((1,2,3))
+        __apn_attribute_warn_unused_result__;
+
 
 #ifdef __cplusplus
 }
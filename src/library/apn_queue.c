@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_queue.h"
+#include "apn_private.h"
+#include "apn_binary_message_private.h"
+#include "apn_paload_private.h"
+#include "apn_engine_private.h"
+#include "apn_tokens.h"
+#include "apn_strings.h"
+#include "apn_poll.h"
+#include "apn_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#endif
+
+#ifdef _WIN32
+#define __apn_atomic_cas_ptr(__ptr, __expected, __desired) \
+    (InterlockedCompareExchangePointer((PVOID volatile *) (__ptr), (__desired), (__expected)) == (__expected))
+#define __apn_atomic_xchg_ptr(__ptr, __value) InterlockedExchangePointer((PVOID volatile *) (__ptr), (__value))
+#define __apn_atomic_fetch_add(__ptr, __value) ((uint32_t) InterlockedExchangeAdd((LONG volatile *) (__ptr), (LONG) (__value)))
+#define __apn_atomic_xchg(__ptr, __value) ((uint32_t) InterlockedExchange((LONG volatile *) (__ptr), (LONG) (__value)))
+#define __apn_atomic_load(__ptr) ((uint32_t) InterlockedCompareExchange((LONG volatile *) (__ptr), 0, 0))
+#else
+#define __apn_atomic_cas_ptr(__ptr, __expected, __desired) \
+    __atomic_compare_exchange_n((__ptr), &(__expected), (__desired), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define __apn_atomic_xchg_ptr(__ptr, __value) __atomic_exchange_n((__ptr), (__value), __ATOMIC_ACQ_REL)
+#define __apn_atomic_fetch_add(__ptr, __value) __atomic_fetch_add((__ptr), (__value), __ATOMIC_ACQ_REL)
+#define __apn_atomic_xchg(__ptr, __value) __atomic_exchange_n((__ptr), (__value), __ATOMIC_ACQ_REL)
+#define __apn_atomic_load(__ptr) __atomic_load_n((__ptr), __ATOMIC_ACQUIRE)
+#endif
+
+typedef struct __apn_queue_item_t {
+    struct __apn_queue_item_t *next;
+    uint8_t *frame;
+    uint32_t size;
+    uint32_t id_offset;
+    char token_hex[APN_TOKEN_LENGTH + 1];
+} apn_queue_item_t;
+
+struct __apn_queue_t {
+    apn_ctx_t *ctx;
+    uint32_t capacity;
+    /** Newest submitted item, items are linked from the newest to the oldest */
+    apn_queue_item_t *volatile head;
+    /** Number of submitted items, counted before an item is linked */
+    volatile uint32_t size;
+    /** Set once the consumer has been woken up and cleared by the consumer before it takes items */
+    volatile uint32_t signaled;
+#ifdef _WIN32
+    HANDLE event;
+#else
+    int pipe[2];
+#endif
+};
+
+typedef struct __apn_queue_source_data_t {
+    apn_queue_item_t **items;
+    uint32_t count;
+} apn_queue_source_data_t;
+
+static apn_return __apn_queue_push(apn_queue_t *const queue, const char *const token,
+                                   const uint8_t *const message, uint32_t size, uint32_t id_offset);
+static void __apn_queue_clear_signal(apn_queue_t *const queue) {
+#ifndef _WIN32
+    uint8_t buffer[64];
+    while (0 < read(queue->pipe[0], buffer, sizeof(buffer))) {
+    }
+#endif
+    /* cleared after the drain, so a producer signalling in between leaves its wake byte in the pipe */
+    __apn_atomic_xchg(&queue->signaled, 0);
+}
+
+static apn_queue_item_t *__apn_queue_take(apn_queue_t *const queue, uint32_t *count);
+static void __apn_queue_items_free(apn_queue_item_t *item);
+static void __apn_queue_signal(apn_queue_t *const queue);
+static void __apn_queue_clear_signal(apn_queue_t *const queue);
+static int __apn_queue_source_next(void *data, uint32_t index, apn_frame_t *frame);
+static apn_return __apn_queue_source_token(void *data, uint32_t index, char *token_hex);
+static void __apn_queue_source_free(void *data);
+
+apn_queue_t *apn_queue_init(apn_ctx_t *const ctx, uint32_t capacity) {
+    apn_queue_t *queue = NULL;
+    assert(ctx);
+
+    queue = calloc(1, sizeof(apn_queue_t));
+    if (!queue) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    queue->ctx = ctx;
+    queue->capacity = capacity;
+
+#ifdef _WIN32
+    if (NULL == (queue->event = CreateEvent(NULL, FALSE, FALSE, NULL))) {
+        free(queue);
+        errno = ENOMEM;
+        return NULL;
+    }
+#else
+    if (0 != pipe(queue->pipe)) {
+        free(queue);
+        return NULL;
+    }
+    fcntl(queue->pipe[0], F_SETFL, fcntl(queue->pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(queue->pipe[1], F_SETFL, fcntl(queue->pipe[1], F_GETFL) | O_NONBLOCK);
+#endif
+    return queue;
+}
+
+void apn_queue_free(apn_queue_t *queue) {
+    if (queue) {
+        __apn_queue_items_free(queue->head);
+#ifdef _WIN32
+        CloseHandle(queue->event);
+#else
+        close(queue->pipe[0]);
+        close(queue->pipe[1]);
+#endif
+        free(queue);
+    }
+}
+
+apn_return apn_queue_submit(apn_queue_t *const queue, const char *const token,
+                            const apn_binary_message_t *const binary_message) {
+    assert(queue);
+    assert(token);
+    assert(binary_message);
+
+    return __apn_queue_push(queue, token, binary_message->message, binary_message->size,
+                            (uint32_t) (binary_message->id_position - binary_message->message));
+}
+
+apn_return apn_queue_submit_payload(apn_queue_t *const queue, const char *const token,
+                                    const apn_payload_t *const payload) {
+    uint8_t buffer[APN_PAYLOAD_MAX_FRAME_SIZE];
+    apn_binary_message_t scratch;
+    const apn_binary_message_t *frame = NULL;
+    assert(queue);
+    assert(token);
+    assert(payload);
+
+    scratch.message = buffer;
+    if (NULL == (frame = apn_payload_frame(payload, &scratch))) {
+        return APN_ERROR;
+    }
+    return __apn_queue_push(queue, token, frame->message, frame->size, APN_BINARY_MESSAGE_ID_OFFSET(frame->payload_size));
+}
+
+uint32_t apn_queue_size(apn_queue_t *const queue) {
+    assert(queue);
+    return __apn_atomic_load(&queue->size);
+}
+
+uint32_t apn_queue_wait(apn_queue_t *const queue, int timeout) {
+    uint32_t size = 0;
+    uint64_t deadline = 0;
+    uint64_t now = 0;
+    int remaining = timeout;
+    assert(queue);
+
+    if (timeout > 0) {
+        deadline = apn_time_ms() + (uint64_t) timeout;
+    }
+    while (0 == (size = __apn_atomic_load(&queue->size)) && 0 != remaining) {
+#ifdef _WIN32
+        WaitForSingleObject(queue->event, (remaining < 0) ? INFINITE : (DWORD) remaining);
+#else
+        apn_poll(queue->pipe[0], APN_POLL_READ, remaining);
+#endif
+        if (0 != (size = __apn_atomic_load(&queue->size))) {
+            break;
+        }
+        /* woken by a signal whose items were already taken, clear it so the next wait blocks */
+        __apn_queue_clear_signal(queue);
+        if (timeout > 0) {
+            now = apn_time_ms();
+            remaining = (now >= deadline) ? 0 : (int) (deadline - now);
+        }
+    }
+    return size;
+}
+
+apn_return apn_queue_send(apn_queue_t *const queue, apn_array_t **invalid_tokens) {
+    apn_ctx_t *ctx = NULL;
+    assert(queue);
+
+    if (APN_ERROR == apn_queue_send_async(queue)) {
+        return APN_ERROR;
+    }
+    ctx = queue->ctx;
+    if (!apn_engine_busy(ctx)) {
+        return APN_SUCCESS;
+    }
+    apn_engine_wait(ctx);
+    return apn_engine_result(ctx, invalid_tokens);
+}
+
+apn_return apn_queue_send_async(apn_queue_t *const queue) {
+    apn_ctx_t *ctx = NULL;
+    apn_queue_source_data_t *data = NULL;
+    apn_queue_item_t *item = NULL;
+    apn_frame_source_t source;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    assert(queue);
+
+    ctx = queue->ctx;
+    if (!ctx->ssl || ctx->feedback) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Connection was not opened");
+        errno = APN_ERR_NOT_CONNECTED;
+        return APN_ERROR;
+    }
+    if (apn_engine_busy(ctx)) {
+        apn_log(ctx, APN_LOG_LEVEL_ERROR, "Previous notification is still being sent");
+        errno = EBUSY;
+        return APN_ERROR;
+    }
+
+    data = malloc(sizeof(apn_queue_source_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    if (NULL == (item = __apn_queue_take(queue, &count))) {
+        free(data);
+        return APN_SUCCESS;
+    }
+    data->count = count;
+    data->items = malloc(count * sizeof(apn_queue_item_t *));
+    if (!data->items) {
+        __apn_queue_items_free(item);
+        free(data);
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    for (; item; item = item->next) {
+        data->items[i++] = item;
+    }
+
+    source.data = data;
+    source.next = __apn_queue_source_next;
+    source.token = __apn_queue_source_token;
+    source.free = __apn_queue_source_free;
+
+    apn_log(ctx, APN_LOG_LEVEL_INFO, "Sending %u queued notification(s)...", count);
+    return apn_engine_start(ctx, &source, 0);
+}
+
+static apn_return __apn_queue_push(apn_queue_t *const queue, const char *const token,
+                                   const uint8_t *const message, uint32_t size, uint32_t id_offset) {
+    apn_queue_item_t *item = NULL;
+
+    if (!apn_hex_token_is_valid(token)) {
+        errno = APN_ERR_TOKEN_INVALID;
+        return APN_ERROR;
+    }
+    if (__apn_atomic_fetch_add(&queue->size, 1) >= queue->capacity && queue->capacity) {
+        __apn_atomic_fetch_add(&queue->size, (uint32_t) -1);
+        errno = EAGAIN;
+        return APN_ERROR;
+    }
+
+    /* frame is stored right after the item */
+    item = malloc(sizeof(apn_queue_item_t) + size);
+    if (!item) {
+        __apn_atomic_fetch_add(&queue->size, (uint32_t) -1);
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    item->frame = (uint8_t *) (item + 1);
+    item->size = size;
+    item->id_offset = id_offset;
+    memcpy(item->frame, message, size);
+    /* the token was validated above */
+    apn_token_hex_decode(token, item->frame + APN_FRAME_TOKEN_OFFSET);
+    memcpy(item->token_hex, token, APN_TOKEN_LENGTH + 1);
+
+    item->next = queue->head;
+    while (!__apn_atomic_cas_ptr(&queue->head, item->next, item)) {
+#ifdef _WIN32
+        item->next = queue->head;
+#endif
+    }
+    __apn_queue_signal(queue);
+    return APN_SUCCESS;
+}
+
+static void __apn_queue_signal(apn_queue_t *const queue) {
+    if (0 == __apn_atomic_xchg(&queue->signaled, 1)) {
+#ifdef _WIN32
+        SetEvent(queue->event);
+#else
+        const uint8_t byte = 1;
+        /* a full pipe already wakes the consumer */
+        ssize_t written = write(queue->pipe[1], &byte, 1);
+        (void) written;
+#endif
+    }
+}
+
+static apn_queue_item_t *__apn_queue_take(apn_queue_t *const queue, uint32_t *count) {
+    apn_queue_item_t *item = NULL;
+    apn_queue_item_t *oldest = NULL;
+    uint32_t taken = 0;
+
+    __apn_queue_clear_signal(queue);
+    item = __apn_atomic_xchg_ptr(&queue->head, NULL);
+
+    /* reverse to submission order */
+    while (item) {
+        apn_queue_item_t *next = item->next;
+        item->next = oldest;
+        oldest = item;
+        item = next;
+        taken++;
+    }
+    if (taken) {
+        __apn_atomic_fetch_add(&queue->size, (uint32_t) -taken);
+    }
+    *count = taken;
+    return oldest;
+}
+
+static void __apn_queue_items_free(apn_queue_item_t *item) {
+    while (item) {
+        apn_queue_item_t *next = item->next;
+        free(item);
+        item = next;
+    }
+}
+
+static int __apn_queue_source_next(void *data, uint32_t index, apn_frame_t *frame) {
+    apn_queue_source_data_t *source = (apn_queue_source_data_t *) data;
+    apn_queue_item_t *item = NULL;
+    uint32_t id_n = 0;
+
+    if (index >= source->count) {
+        return 0;
+    }
+    item = source->items[index];
+    id_n = htonl(index);
+    memcpy(item->frame + item->id_offset, &id_n, sizeof(uint32_t));
+
+    frame->data = item->frame;
+    frame->size = item->size;
+    frame->token_hex = item->token_hex;
+    return 1;
+}
+
+static apn_return __apn_queue_source_token(void *data, uint32_t index, char *token_hex) {
+    apn_queue_source_data_t *source = (apn_queue_source_data_t *) data;
+    if (index >= source->count) {
+        return APN_ERROR;
+    }
+    apn_strncpy(token_hex, source->items[index]->token_hex, APN_TOKEN_LENGTH + 1, APN_TOKEN_LENGTH);
+    return APN_SUCCESS;
+}
+
+static void __apn_queue_source_free(void *data) {
+    apn_queue_source_data_t *source = (apn_queue_source_data_t *) data;
+    uint32_t i = 0;
+    if (source) {
+        for (; i < source->count; i++) {
+            free(source->items[i]);
+        }
+        free(source->items);
+        free(source);
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_QUEUE_H__
+#define __APN_QUEUE_H__
+
+#include "apn_platform.h"
+#include "apn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct __apn_queue_t apn_queue_t;
+
+/**
+ * Creates a submission queue in front of a connection.
+ *
+ * Any number of threads can submit notifications with ::apn_queue_submit() and ::apn_queue_submit_payload()
+ * without locking. One thread, which owns `ctx`, drains the queue with ::apn_queue_send() and writes
+ * all pending notifications to the connection in a single pass.
+ *
+ * @param[in] ctx - Pointer to an initialized `ctx` structure. Cannot be NULL.
+ * @param[in] capacity - Maximum number of pending notifications, 0 for no limit.
+ *
+ * @return Pointer to new `queue` structure on success, or NULL on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_queue_t *apn_queue_init(apn_ctx_t *const ctx, uint32_t capacity)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Frees memory allocated for the queue, pending notifications are dropped.
+ * Must not be called while other threads submit notifications or the queue is being sent.
+ *
+ * @param[in] queue - Pointer to `queue` structure.
+ */
+__apn_export__ void apn_queue_free(apn_queue_t *queue);
+
+/**
+ * Submits a notification. Can be called from any thread.
+ *
+ * The message is copied together with the device token, so one binary message can be shared
+ * by many threads as long as nobody modifies it.
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ * @param[in] token - Device token (hex). Cannot be NULL.
+ * @param[in] binary_message - Binary message, see ::apn_create_binary_message(). Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, `EAGAIN` if the queue is full.
+ */
+__apn_export__ apn_return apn_queue_submit(apn_queue_t *const queue, const char *const token,
+                                           const apn_binary_message_t *const binary_message)
+        __apn_attribute_nonnull__((1,2,3));
+
+/**
+ * Submits a notification built from a payload. Can be called from any thread, the payload
+ * is serialized by the calling thread.
+ *
+ * The same payload can be submitted by several threads at once as long as nobody modifies it,
+ * see ::apn_payload_prepare().
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ * @param[in] token - Device token (hex). Cannot be NULL.
+ * @param[in] payload - Pointer to `payload` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, `EAGAIN` if the queue is full.
+ */
+__apn_export__ apn_return apn_queue_submit_payload(apn_queue_t *const queue, const char *const token,
+                                                   const apn_payload_t *const payload)
+        __apn_attribute_nonnull__((1,2,3));
+
+/**
+ * Returns number of notifications waiting in the queue.
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_queue_size(apn_queue_t *const queue)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Blocks the owning thread until notifications are submitted or `timeout` expires.
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ * @param[in] timeout - Timeout in milliseconds, -1 to wait infinitely.
+ *
+ * @return Number of notifications waiting in the queue, 0 on timeout.
+ */
+__apn_export__ uint32_t apn_queue_wait(apn_queue_t *const queue, int timeout)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Takes all notifications waiting in the queue and sends them down the connection in one pipelined pass,
+ * see ::apn_send_batch(). Must be called from the thread which owns the connection.
+ *
+ * Notification identifiers (and indexes reported to the invalid token callback) are positions in the drained batch.
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ * @param[in, out] invalid_tokens - Array of invalid tokens. Each item is string.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success, also when the queue is empty.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_queue_send(apn_queue_t *const queue, apn_array_t **invalid_tokens)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Takes all notifications waiting in the queue and starts sending them without blocking,
+ * see ::apn_send_async(). Must be called from the thread which owns the connection.
+ *
+ * @param[in] queue - Pointer to an initialized `queue` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success, also when the queue is empty.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_queue_send_async(apn_queue_t *const queue)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
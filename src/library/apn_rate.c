@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_rate.h"
+#include "apn.h"
+
+#include <assert.h>
+
+/** Bucket holds this many milliseconds worth of units */
+#define APN_RATE_BURST_MS 100
+
+static void __apn_rate_init(apn_rate_t *const rate, uint32_t units_per_second, uint32_t min_burst);
+static uint32_t __apn_rate_delay(apn_rate_t *const rate, uint64_t now);
+
+void apn_rate_limiter_init(apn_rate_limiter_t *const limiter, uint32_t notifications_per_second, uint32_t bytes_per_second) {
+    assert(limiter);
+    __apn_rate_init(&limiter->notifications, notifications_per_second, 1);
+    /* a full send buffer can go out at once */
+    __apn_rate_init(&limiter->bytes, bytes_per_second, APN_SEND_BUFFER_SIZE_DEFAULT);
+}
+
+uint32_t apn_rate_limiter_delay(apn_rate_limiter_t *const limiter, uint64_t now) {
+    uint32_t notifications_delay = 0;
+    uint32_t bytes_delay = 0;
+    assert(limiter);
+
+    notifications_delay = __apn_rate_delay(&limiter->notifications, now);
+    bytes_delay = __apn_rate_delay(&limiter->bytes, now);
+    return notifications_delay > bytes_delay ? notifications_delay : bytes_delay;
+}
+
+void apn_rate_limiter_take(apn_rate_limiter_t *const limiter, uint32_t size) {
+    assert(limiter);
+    if (limiter->notifications.rate) {
+        limiter->notifications.level -= 1000;
+    }
+    if (limiter->bytes.rate) {
+        limiter->bytes.level -= (int64_t) size * 1000;
+    }
+}
+
+static void __apn_rate_init(apn_rate_t *const rate, uint32_t units_per_second, uint32_t min_burst) {
+    rate->rate = units_per_second;
+    rate->burst = (uint32_t) (((uint64_t) units_per_second * APN_RATE_BURST_MS) / 1000);
+    if (rate->burst < min_burst) {
+        rate->burst = min_burst;
+    }
+    rate->level = (int64_t) rate->burst * 1000;
+    rate->time = 0;
+}
+
+static uint32_t __apn_rate_delay(apn_rate_t *const rate, uint64_t now) {
+    if (0 == rate->rate) {
+        return 0;
+    }
+    if (now > rate->time) {
+        /* units * 1000 per millisecond equals units per second */
+        if (rate->time) {
+            rate->level += (int64_t) (now - rate->time) * rate->rate;
+            if (rate->level > (int64_t) rate->burst * 1000) {
+                rate->level = (int64_t) rate->burst * 1000;
+            }
+        }
+        rate->time = now;
+    }
+    if (rate->level >= 0) {
+        return 0;
+    }
+    return (uint32_t) ((-rate->level + rate->rate - 1) / rate->rate);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_RATE_H__
+#define __APN_RATE_H__
+
+#include "apn_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Token bucket.
+ *
+ * The bucket is refilled with `rate` units per second up to `burst` units. Taking units is allowed
+ * while the bucket is not in debt, so a unit larger than the bucket still passes and is paid off later.
+ */
+typedef struct __apn_rate_t {
+    /** Units per second, 0 for no limit */
+    uint32_t rate;
+    uint32_t burst;
+    /** Available units multiplied by 1000, negative while in debt */
+    int64_t level;
+    /** Time of the last refill, in milliseconds */
+    uint64_t time;
+} apn_rate_t;
+
+/**
+ * Limits both number of notifications and number of bytes per second.
+ */
+typedef struct __apn_rate_limiter_t {
+    apn_rate_t notifications;
+    apn_rate_t bytes;
+} apn_rate_limiter_t;
+
+/**
+ * Sets limits of the limiter and fills its buckets. 0 disables a limit.
+ */
+void apn_rate_limiter_init(apn_rate_limiter_t *const limiter, uint32_t notifications_per_second, uint32_t bytes_per_second)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns time in milliseconds until a notification can be sent, 0 if it can be sent now.
+ */
+uint32_t apn_rate_limiter_delay(apn_rate_limiter_t *const limiter, uint64_t now)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Takes one notification of `size` bytes from the limiter.
+ */
+void apn_rate_limiter_take(apn_rate_limiter_t *const limiter, uint32_t size)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+static void __apn_ring_evict(apn_ring_t *const ring);
+static apn_return __apn_ring_reserve_record(apn_ring_t *const ring);
+
+void apn_ring_init(apn_ring_t *const ring) {
+    assert(ring);
+    memset(ring, 0, sizeof(apn_ring_t));
+}
+
+void apn_ring_free(apn_ring_t *const ring) {
+    assert(ring);
+    free(ring->data);
+    free(ring->records);
+    apn_ring_init(ring);
+}
+
+apn_return apn_ring_set_size(apn_ring_t *const ring, uint32_t size) {
+    assert(ring);
+    apn_ring_reset(ring, ring->complete_from);
+    if (size == ring->data_size) {
+        return APN_SUCCESS;
+    }
+    free(ring->data);
+    ring->data = NULL;
+    ring->data_size = 0;
+    if (size > 0) {
+        if (NULL == (ring->data = malloc(size))) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        ring->data_size = size;
+    }
+    return APN_SUCCESS;
+}
+
+void apn_ring_reset(apn_ring_t *const ring, uint32_t id) {
+    assert(ring);
+    ring->tail = 0;
+    ring->first = 0;
+    ring->count = 0;
+    ring->complete_from = id;
+}
+
+void apn_ring_push(apn_ring_t *const ring, uint32_t id, const uint8_t *const data, uint32_t size, uint64_t time) {
+    apn_ring_record_t *record = NULL;
+    uint32_t offset = 0;
+    assert(ring);
+    assert(data);
+
+    if (size == 0 || size > ring->data_size || APN_ERROR == __apn_ring_reserve_record(ring)) {
+        apn_ring_reset(ring, id + 1);
+        return;
+    }
+
+    for (;;) {
+        uint32_t first_offset = 0;
+        if (0 == ring->count) {
+            offset = 0;
+            break;
+        }
+        first_offset = ring->records[ring->first].offset;
+        if (ring->tail > first_offset) {
+            if (ring->data_size - ring->tail >= size) {
+                offset = ring->tail;
+                break;
+            }
+            if (first_offset >= size) {
+                offset = 0;
+                break;
+            }
+        } else if (first_offset - ring->tail >= size) {
+            offset = ring->tail;
+            break;
+        }
+        __apn_ring_evict(ring);
+    }
+
+    record = &ring->records[(ring->first + ring->count) % ring->records_allocated];
+    record->id = id;
+    record->offset = offset;
+    record->size = size;
+    record->time = time;
+    memcpy(ring->data + offset, data, size);
+    ring->tail = offset + size;
+    ring->count++;
+}
+
+void apn_ring_drop_before(apn_ring_t *const ring, uint32_t id) {
+    assert(ring);
+    while (ring->count > 0 && ring->records[ring->first].id < id) {
+        __apn_ring_evict(ring);
+    }
+}
+
+void apn_ring_drop_older(apn_ring_t *const ring, uint64_t time) {
+    assert(ring);
+    while (ring->count > 0 && ring->records[ring->first].time <= time) {
+        __apn_ring_evict(ring);
+    }
+}
+
+const apn_ring_record_t *apn_ring_at(const apn_ring_t *const ring, uint32_t position) {
+    assert(ring);
+    assert(position < ring->count);
+    return &ring->records[(ring->first + position) % ring->records_allocated];
+}
+
+const apn_ring_record_t *apn_ring_find(const apn_ring_t *const ring, uint32_t id) {
+    uint32_t low = 0;
+    uint32_t high = 0;
+    assert(ring);
+
+    /* identifiers increase from the oldest to the newest frame */
+    high = ring->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const apn_ring_record_t *record = apn_ring_at(ring, middle);
+        if (record->id == id) {
+            return record;
+        } else if (record->id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+static void __apn_ring_evict(apn_ring_t *const ring) {
+    ring->complete_from = ring->records[ring->first].id + 1;
+    ring->first = (ring->first + 1) % ring->records_allocated;
+    ring->count--;
+    if (0 == ring->count) {
+        ring->first = 0;
+        ring->tail = 0;
+    }
+}
+
+static apn_return __apn_ring_reserve_record(apn_ring_t *const ring) {
+    apn_ring_record_t *records = NULL;
+    uint32_t allocated = 0;
+    uint32_t i = 0;
+
+    if (ring->count < ring->records_allocated) {
+        return APN_SUCCESS;
+    }
+
+    allocated = ring->records_allocated ? ring->records_allocated * 2 : 64;
+    records = malloc(allocated * sizeof(apn_ring_record_t));
+    if (!records) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    for (i = 0; i < ring->count; i++) {
+        records[i] = ring->records[(ring->first + i) % ring->records_allocated];
+    }
+    free(ring->records);
+    ring->records = records;
+    ring->records_allocated = allocated;
+    ring->first = 0;
+    return APN_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_RING_H__
+#define __APN_RING_H__
+
+#include "apn_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct __apn_ring_record_t {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+    /** Time the frame was stored, in milliseconds */
+    uint64_t time;
+} apn_ring_record_t;
+
+/**
+ * Bounded FIFO of encoded frames which were already handed to the socket.
+ *
+ * Frames are stored contiguously in a circular byte buffer and addressed by notification identifier,
+ * which increases from the oldest to the newest frame. Oldest frames are evicted when space is needed.
+ */
+typedef struct __apn_ring_t {
+    uint8_t *data;
+    uint32_t data_size;
+    uint32_t tail;
+
+    apn_ring_record_t *records;
+    uint32_t records_allocated;
+    uint32_t first;
+    uint32_t count;
+
+    /** Every frame with identifier >= complete_from stored since the last reset is still in the ring */
+    uint32_t complete_from;
+} apn_ring_t;
+
+void apn_ring_init(apn_ring_t *const ring)
+        __apn_attribute_nonnull__((1));
+
+void apn_ring_free(apn_ring_t *const ring)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Changes capacity of the ring in bytes, 0 disables retention. Drops all frames.
+ */
+apn_return apn_ring_set_size(apn_ring_t *const ring, uint32_t size)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Drops all frames, the next stored frame is expected to have identifier `id`.
+ */
+void apn_ring_reset(apn_ring_t *const ring, uint32_t id)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Stores a copy of the frame, evicting the oldest frames if needed.
+ * A frame which does not fit at all resets the ring.
+ */
+void apn_ring_push(apn_ring_t *const ring, uint32_t id, const uint8_t *const data, uint32_t size, uint64_t time)
+        __apn_attribute_nonnull__((1,3));
+
+/**
+ * Drops frames with identifier less than `id`.
+ */
+void apn_ring_drop_before(apn_ring_t *const ring, uint32_t id)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Drops frames stored at or before `time`.
+ */
+void apn_ring_drop_older(apn_ring_t *const ring, uint64_t time)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns record at `position`, 0 is the oldest frame.
+ */
+const apn_ring_record_t *apn_ring_at(const apn_ring_t *const ring, uint32_t position)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns record of the frame with identifier `id`, or NULL if the frame is not in the ring.
+ */
+const apn_ring_record_t *apn_ring_find(const apn_ring_t *const ring, uint32_t id)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,7 @@
 #include "apn_private.h"
 #include "apn_log.h"
 #include "apn_strings.h"
+#include "apn_poll.h"
 
 #ifndef _WIN32
 #include <signal.h>
@@ -88,6 +89,26 @@ void apn_ssl_free() {
 apn_return apn_ssl_connect(apn_ctx_t *const ctx) {
     assert(ctx);
 
+    if (APN_ERROR == apn_ssl_prepare(ctx)) {
+        return APN_ERROR;
+    }
+    for (;;) {
+        uint32_t want = 0;
+        int ret = apn_ssl_try_connect(ctx, &want);
+        if (ret > 0) {
+            return APN_SUCCESS;
+        } else if (ret < 0) {
+            return APN_ERROR;
+        }
+        if (0 > apn_poll(ctx->sock, want, -1)) {
+            return APN_ERROR;
+        }
+    }
+}
+
+apn_return apn_ssl_prepare(apn_ctx_t *const ctx) {
+    assert(ctx);
+
     SSL_CTX *ssl_ctx = NULL;
     if (NULL == (ssl_ctx = SSL_CTX_new(TLSv1_client_method()))) {
         apn_log(ctx, APN_LOG_LEVEL_ERROR, "Could not initialize SSL context: %s",
@@ -284,17 +305,6 @@ apn_return apn_ssl_connect(apn_ctx_t *const ctx) {
         return APN_ERROR;
     }
 
-    if (1 > (ret = SSL_connect(ctx->ssl))) {
-        char *error = apn_error_string(errno);
-        apn_log(ctx, APN_LOG_LEVEL_ERROR,
-                  "Could not initialize SSL connection: SSL_connect() failed: %s, %s (errno: %d):",
-                  ERR_error_string((unsigned long) SSL_get_error(ctx->ssl, ret), NULL), error, errno);
-        free(error);
-        return APN_ERROR;
-    }
-    apn_log(ctx, APN_LOG_LEVEL_INFO, "SSL connection has been established");
-
-
     return APN_SUCCESS;
 
 
@@ -304,39 +314,114 @@ apn_return apn_ssl_connect(apn_ctx_t *const ctx) {
     return APN_ERROR;
 }
 
-int apn_ssl_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t length) {
-    int bytes_written = 0;
-    int bytes_written_total = 0;
+int apn_ssl_try_connect(const apn_ctx_t *const ctx, uint32_t *want) {
+    int ret = 0;
+    assert(ctx);
+    assert(ctx->ssl);
+    assert(want);
 
-    while (length > 0) {
-        bytes_written = SSL_write(ctx->ssl, message, (int) length);
-        if (bytes_written <= 0) {
-            switch (SSL_get_error(ctx->ssl, bytes_written)) {
-                case SSL_ERROR_WANT_WRITE:
-                case SSL_ERROR_WANT_READ:
-                    continue;
-                case SSL_ERROR_SYSCALL:
-                    switch (errno) {
-                        case EINTR:
-                            continue;
-                        case EPIPE:
-                            errno = APN_ERR_NETWORK_UNREACHABLE;
-                            return -1;
-                        case ETIMEDOUT:
-                            errno = APN_ERR_NETWORK_TIMEDOUT;
-                            return -1;
-                        default:
-                            errno = APN_ERR_SSL_WRITE_FAILED;
-                            return -1;
-                    }
-                case SSL_ERROR_ZERO_RETURN:
-                case SSL_ERROR_NONE:
+    ret = SSL_connect(ctx->ssl);
+    if (1 == ret) {
+        apn_log(ctx, APN_LOG_LEVEL_INFO, "SSL connection has been established");
+        return 1;
+    }
+
+    switch (SSL_get_error(ctx->ssl, ret)) {
+        case SSL_ERROR_WANT_WRITE:
+            *want = APN_POLL_WRITE;
+            return 0;
+        case SSL_ERROR_WANT_READ:
+            *want = APN_POLL_READ;
+            return 0;
+        default: {
+            char *error = apn_error_string(errno);
+            apn_log(ctx, APN_LOG_LEVEL_ERROR,
+                    "Could not initialize SSL connection: SSL_connect() failed: %s, %s (errno: %d):",
+                    ERR_error_string((unsigned long) SSL_get_error(ctx->ssl, ret), NULL), error, errno);
+            free(error);
+            errno = APN_ERR_UNABLE_TO_ESTABLISH_SSL_CONNECTION;
+            return -1;
+        }
+    }
+}
+
+static int __apn_ssl_error(const apn_ctx_t *const ctx, int ret, int failed_errno, uint32_t *want) {
+    switch (SSL_get_error(ctx->ssl, ret)) {
+        case SSL_ERROR_WANT_WRITE:
+            *want = APN_POLL_WRITE;
+            return 0;
+        case SSL_ERROR_WANT_READ:
+            *want = APN_POLL_READ;
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            switch (errno) {
+                case EINTR:
+                case EAGAIN:
+                    return 0;
+                case 0:
+                case ECONNRESET:
                     errno = APN_ERR_CONNECTION_CLOSED;
                     return -1;
+                case EPIPE:
+                    errno = APN_ERR_NETWORK_UNREACHABLE;
+                    return -1;
+                case ETIMEDOUT:
+                    errno = APN_ERR_NETWORK_TIMEDOUT;
+                    return -1;
                 default:
-                    errno = APN_ERR_SSL_WRITE_FAILED;
+                    errno = failed_errno;
                     return -1;
             }
+        case SSL_ERROR_ZERO_RETURN:
+        case SSL_ERROR_NONE:
+            errno = APN_ERR_CONNECTION_CLOSED;
+            return -1;
+        default:
+            errno = failed_errno;
+            return -1;
+    }
+}
+
+int apn_ssl_try_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t length, uint32_t *want) {
+    int bytes_written = 0;
+    assert(ctx);
+    assert(want);
+
+    *want = APN_POLL_WRITE;
+    errno = 0;
+    bytes_written = SSL_write(ctx->ssl, message, (int) length);
+    if (bytes_written > 0) {
+        return bytes_written;
+    }
+    return __apn_ssl_error(ctx, bytes_written, APN_ERR_SSL_WRITE_FAILED, want);
+}
+
+int apn_ssl_try_read(const apn_ctx_t *const ctx, char *buff, size_t length, uint32_t *want) {
+    int bytes_read = 0;
+    assert(ctx);
+    assert(want);
+
+    *want = APN_POLL_READ;
+    errno = 0;
+    bytes_read = SSL_read(ctx->ssl, buff, (int) length);
+    if (bytes_read > 0) {
+        return bytes_read;
+    }
+    return __apn_ssl_error(ctx, bytes_read, APN_ERR_SSL_READ_FAILED, want);
+}
+
+int apn_ssl_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t length) {
+    int bytes_written = 0;
+    int bytes_written_total = 0;
+    uint32_t want = 0;
+
+    while (length > 0) {
+        bytes_written = apn_ssl_try_write(ctx, message, length, &want);
+        if (bytes_written < 0) {
+            return -1;
+        } else if (bytes_written == 0) {
+            apn_poll(ctx->sock, want, -1);
+            continue;
         }
         message += bytes_written;
         bytes_written_total += bytes_written;
@@ -346,38 +431,14 @@ int apn_ssl_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t len
 }
 
 int apn_ssl_read(const apn_ctx_t *const ctx, char *buff, size_t length) {
-    int read;
+    int read = 0;
+    uint32_t want = 0;
     for (; ;) {
-        read = SSL_read(ctx->ssl, buff, (int) length);
-        if (read > 0) {
+        read = apn_ssl_try_read(ctx, buff, length, &want);
+        if (read != 0) {
             break;
         }
-        switch (SSL_get_error(ctx->ssl, read)) {
-            case SSL_ERROR_WANT_WRITE:
-            case SSL_ERROR_WANT_READ:
-                continue;
-            case SSL_ERROR_SYSCALL:
-                switch (errno) {
-                    case EINTR:
-                        continue;
-                    case EPIPE:
-                        errno = APN_ERR_NETWORK_UNREACHABLE;
-                        return -1;
-                    case ETIMEDOUT:
-                        errno = APN_ERR_NETWORK_TIMEDOUT;
-                        return -1;
-                    default:
-                        errno = APN_ERR_SSL_READ_FAILED;
-                        return -1;
-                }
-            case SSL_ERROR_ZERO_RETURN:
-            case SSL_ERROR_NONE:
-                errno = APN_ERR_CONNECTION_CLOSED;
-                return -1;
-            default:
-                errno = APN_ERR_SSL_READ_FAILED;
-                return -1;
-        }
+        apn_poll(ctx->sock, want, -1);
     }
     return read;
 }
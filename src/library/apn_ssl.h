@@ -34,6 +34,23 @@ void apn_ssl_free();
 apn_return apn_ssl_connect(apn_ctx_t *const ctx)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Loads the certificate and attaches a new SSL object to the connected socket, without handshaking.
+ */
+apn_return apn_ssl_prepare(apn_ctx_t *const ctx)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Advances the SSL handshake on a non-blocking socket.
+ *
+ * @return
+ *      - 1 if the handshake is done.
+ *      - 0 if the handshake would block, `want` receives ::APN_POLL_READ or ::APN_POLL_WRITE.
+ *      - -1 on failure with error information stored in `errno`.
+ */
+int apn_ssl_try_connect(const apn_ctx_t *const ctx, uint32_t *want)
+        __apn_attribute_nonnull__((1,2));
+
 void apn_ssl_close(apn_ctx_t *const ctx)
         __apn_attribute_nonnull__((1));
 
@@ -43,4 +60,27 @@ int apn_ssl_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t len
 int apn_ssl_read(const apn_ctx_t *const ctx, char *buff, size_t length)
         __apn_attribute_nonnull__((1,2));
 
+/**
+ * Writes data without blocking.
+ *
+ * @return
+ *      - Number of written bytes on success.
+ *      - 0 if the operation would block, `want` receives ::APN_POLL_READ or ::APN_POLL_WRITE
+ *      to wait for before retrying with the same arguments.
+ *      - -1 on failure with error information stored in `errno`.
+ */
+int apn_ssl_try_write(const apn_ctx_t *const ctx, const uint8_t *message, size_t length, uint32_t *want)
+        __apn_attribute_nonnull__((1,2,4));
+
+/**
+ * Reads data without blocking.
+ *
+ * @return
+ *      - Number of read bytes on success.
+ *      - 0 if there is no data yet, `want` receives ::APN_POLL_READ or ::APN_POLL_WRITE.
+ *      - -1 on failure with error information stored in `errno`.
+ */
+int apn_ssl_try_read(const apn_ctx_t *const ctx, char *buff, size_t length, uint32_t *want)
+        __apn_attribute_nonnull__((1,2,4));
+
 #endif
@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_suppression.h"
+#include "apn_tokens.h"
+#include "apn_mmap.h"
+#include "apn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef APN_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+/*
+ * File layout, integers are in network byte order:
+ *
+ *     magic (8) | version (4) | token count (4) | log2 of Bloom filter bits (4) | offset of Bloom filter (4) | offset of tokens (4) | reserved (4)
+ *     Bloom filter
+ *     sorted binary tokens
+ */
+#define APN_SUPPRESSION_MAGIC "CAPNSUPP"
+#define APN_SUPPRESSION_MAGIC_SIZE 8
+#define APN_SUPPRESSION_VERSION 1
+#define APN_SUPPRESSION_HEADER_SIZE 32
+
+/* 16 bits and 7 probes per token give a false positive rate below 0.1% */
+#define APN_SUPPRESSION_BLOOM_BITS_PER_TOKEN 16
+#define APN_SUPPRESSION_BLOOM_HASHES 7
+#define APN_SUPPRESSION_BLOOM_MIN_LOG2 16
+#define APN_SUPPRESSION_BLOOM_MAX_LOG2 32
+
+#define APN_SUPPRESSION_MIN_CAPACITY 64
+
+struct __apn_suppression_t {
+    uint8_t *bloom;
+    uint32_t bloom_log2;
+
+    /** Sorted tokens of the loaded file */
+    apn_mmap_t map;
+    const uint8_t *loaded;
+    uint32_t loaded_count;
+
+    /** Tokens added after loading, open addressing with linear probing */
+    uint8_t *slots;
+    uint8_t *used;
+    uint32_t capacity;
+    uint32_t count;
+};
+
+static void __apn_suppression_hash(const uint8_t *const token, uint64_t *h1, uint64_t *h2);
+static uint32_t __apn_suppression_bloom_log2(uint64_t count);
+static void __apn_suppression_bloom_set(uint8_t *const bloom, uint32_t bloom_log2, const uint8_t *const token);
+static uint8_t __apn_suppression_bloom_test(const uint8_t *const bloom, uint32_t bloom_log2, const uint8_t *const token);
+static apn_return __apn_suppression_bloom_resize(apn_suppression_t *const suppression, uint32_t bloom_log2);
+static uint32_t __apn_suppression_slot(const apn_suppression_t *const suppression, const uint8_t *const token);
+static apn_return __apn_suppression_grow(apn_suppression_t *const suppression);
+static uint8_t __apn_suppression_find_loaded(const apn_suppression_t *const suppression, const uint8_t *const token);
+static apn_return __apn_suppression_write(const apn_suppression_t *const suppression, FILE *const stream);
+static uint32_t __apn_suppression_header_field(const uint8_t *const header, uint32_t offset);
+static int __apn_suppression_compare(const void *a, const void *b);
+
+apn_suppression_t *apn_suppression_init(uint32_t expected_count) {
+    apn_suppression_t *suppression = calloc(1, sizeof(apn_suppression_t));
+    if (!suppression) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (APN_ERROR == __apn_suppression_bloom_resize(suppression, __apn_suppression_bloom_log2(expected_count))) {
+        free(suppression);
+        return NULL;
+    }
+    return suppression;
+}
+
+apn_suppression_t *apn_suppression_load(const char *const file) {
+    apn_suppression_t *suppression = NULL;
+    const uint8_t *header = NULL;
+    uint32_t bloom_offset = 0;
+    uint32_t tokens_offset = 0;
+    size_t bloom_size = 0;
+    assert(file);
+
+    suppression = calloc(1, sizeof(apn_suppression_t));
+    if (!suppression) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (APN_ERROR == apn_mmap_open(&suppression->map, file)) {
+        free(suppression);
+        return NULL;
+    }
+
+    header = suppression->map.data;
+    if (suppression->map.size < APN_SUPPRESSION_HEADER_SIZE
+        || 0 != memcmp(header, APN_SUPPRESSION_MAGIC, APN_SUPPRESSION_MAGIC_SIZE)
+        || APN_SUPPRESSION_VERSION != __apn_suppression_header_field(header, 8)) {
+        apn_suppression_free(suppression);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    suppression->loaded_count = __apn_suppression_header_field(header, 12);
+    suppression->bloom_log2 = __apn_suppression_header_field(header, 16);
+    bloom_offset = __apn_suppression_header_field(header, 20);
+    tokens_offset = __apn_suppression_header_field(header, 24);
+
+    if (suppression->bloom_log2 < APN_SUPPRESSION_BLOOM_MIN_LOG2 || suppression->bloom_log2 > APN_SUPPRESSION_BLOOM_MAX_LOG2) {
+        apn_suppression_free(suppression);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    bloom_size = (size_t) 1 << (suppression->bloom_log2 - 3);
+    if (bloom_offset < APN_SUPPRESSION_HEADER_SIZE
+        || (uint64_t) bloom_offset + bloom_size > (uint64_t) suppression->map.size
+        || tokens_offset < APN_SUPPRESSION_HEADER_SIZE
+        || (uint64_t) tokens_offset + (uint64_t) suppression->loaded_count * APN_TOKEN_BINARY_SIZE > (uint64_t) suppression->map.size) {
+        apn_suppression_free(suppression);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+
+    /* the filter is copied, tokens added later set its bits */
+    suppression->bloom = malloc(bloom_size);
+    if (!suppression->bloom) {
+        apn_suppression_free(suppression);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(suppression->bloom, suppression->map.data + bloom_offset, bloom_size);
+    suppression->loaded = suppression->map.data + tokens_offset;
+    return suppression;
+}
+
+apn_return apn_suppression_save(const apn_suppression_t *const suppression, const char *const file) {
+    char *temp_file = NULL;
+    size_t file_length = 0;
+    FILE *stream = NULL;
+    apn_return ret = APN_ERROR;
+    int error = 0;
+    assert(suppression);
+    assert(file);
+
+    file_length = strlen(file);
+    temp_file = malloc(file_length + sizeof(".tmp"));
+    if (!temp_file) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    memcpy(temp_file, file, file_length);
+    memcpy(temp_file + file_length, ".tmp", sizeof(".tmp"));
+
+    stream = fopen(temp_file, "wb");
+    if (!stream) {
+        free(temp_file);
+        return APN_ERROR;
+    }
+    ret = __apn_suppression_write(suppression, stream);
+    error = errno;
+    if (0 != fclose(stream) && APN_SUCCESS == ret) {
+        ret = APN_ERROR;
+        error = errno;
+    }
+    if (APN_SUCCESS == ret) {
+#ifdef _WIN32
+        /* rename() does not replace existing files on Windows */
+        remove(file);
+#endif
+        if (0 != rename(temp_file, file)) {
+            ret = APN_ERROR;
+            error = errno;
+        }
+    }
+    if (APN_ERROR == ret) {
+        remove(temp_file);
+        errno = error;
+    }
+    free(temp_file);
+    return ret;
+}
+
+void apn_suppression_free(apn_suppression_t *suppression) {
+    if (suppression) {
+        apn_mmap_close(&suppression->map);
+        free(suppression->bloom);
+        free(suppression->slots);
+        free(suppression->used);
+        free(suppression);
+    }
+}
+
+apn_return apn_suppression_add(apn_suppression_t *const suppression, const uint8_t *const token) {
+    uint64_t total = 0;
+    uint32_t slot = 0;
+    assert(suppression);
+    assert(token);
+
+    if (apn_suppression_contains(suppression, token)) {
+        return APN_SUCCESS;
+    }
+    if ((uint64_t) (suppression->count + 1) * 2 > suppression->capacity && APN_ERROR == __apn_suppression_grow(suppression)) {
+        return APN_ERROR;
+    }
+
+    slot = __apn_suppression_slot(suppression, token);
+    memcpy(suppression->slots + (size_t) slot * APN_TOKEN_BINARY_SIZE, token, APN_TOKEN_BINARY_SIZE);
+    suppression->used[slot] = 1;
+    suppression->count++;
+
+    /* a filter loaded with twice the tokens it was sized for is rebuilt, which keeps false positives rare */
+    total = (uint64_t) suppression->loaded_count + suppression->count;
+    if (total * APN_SUPPRESSION_BLOOM_BITS_PER_TOKEN > ((uint64_t) 1 << suppression->bloom_log2) * 2
+        && suppression->bloom_log2 < APN_SUPPRESSION_BLOOM_MAX_LOG2) {
+        return __apn_suppression_bloom_resize(suppression, __apn_suppression_bloom_log2(total * 2));
+    }
+    __apn_suppression_bloom_set(suppression->bloom, suppression->bloom_log2, token);
+    return APN_SUCCESS;
+}
+
+apn_return apn_suppression_add_hex(apn_suppression_t *const suppression, const char *const token) {
+    uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
+    assert(suppression);
+    assert(token);
+
+    if (APN_ERROR == apn_token_hex_decode(token, binary_token)) {
+        return APN_ERROR;
+    }
+    return apn_suppression_add(suppression, binary_token);
+}
+
+uint8_t apn_suppression_contains(const apn_suppression_t *const suppression, const uint8_t *const token) {
+    assert(suppression);
+    assert(token);
+
+    if (!__apn_suppression_bloom_test(suppression->bloom, suppression->bloom_log2, token)) {
+        return 0;
+    }
+    if (suppression->count && suppression->used[__apn_suppression_slot(suppression, token)]) {
+        return 1;
+    }
+    return __apn_suppression_find_loaded(suppression, token);
+}
+
+uint8_t apn_suppression_contains_hex(const apn_suppression_t *const suppression, const char *const token) {
+    uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
+    assert(suppression);
+    assert(token);
+
+    if (APN_ERROR == apn_token_hex_decode(token, binary_token)) {
+        return 0;
+    }
+    return apn_suppression_contains(suppression, binary_token);
+}
+
+uint32_t apn_suppression_count(const apn_suppression_t *const suppression) {
+    assert(suppression);
+    return suppression->loaded_count + suppression->count;
+}
+
+static void __apn_suppression_hash(const uint8_t *const token, uint64_t *h1, uint64_t *h2) {
+    uint64_t words[4];
+    memcpy(words, token, sizeof(words));
+
+    /* tokens are mostly random already, mixing protects against patterned ones */
+    *h1 = (words[0] ^ (words[2] << 29 | words[2] >> 35)) * UINT64_C(0x9E3779B97F4A7C15);
+    *h1 ^= *h1 >> 32;
+    *h2 = (words[1] ^ (words[3] << 17 | words[3] >> 47)) * UINT64_C(0xC2B2AE3D27D4EB4F);
+    *h2 ^= *h2 >> 29;
+    *h2 |= 1;
+}
+
+static uint32_t __apn_suppression_bloom_log2(uint64_t count) {
+    uint32_t bloom_log2 = APN_SUPPRESSION_BLOOM_MIN_LOG2;
+    while (bloom_log2 < APN_SUPPRESSION_BLOOM_MAX_LOG2 && ((uint64_t) 1 << bloom_log2) < count * APN_SUPPRESSION_BLOOM_BITS_PER_TOKEN) {
+        bloom_log2++;
+    }
+    return bloom_log2;
+}
+
+static void __apn_suppression_bloom_set(uint8_t *const bloom, uint32_t bloom_log2, const uint8_t *const token) {
+    uint64_t mask = ((uint64_t) 1 << bloom_log2) - 1;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    uint32_t i = 0;
+
+    __apn_suppression_hash(token, &h1, &h2);
+    for (; i < APN_SUPPRESSION_BLOOM_HASHES; i++) {
+        uint64_t bit = (h1 + i * h2) & mask;
+        bloom[bit >> 3] |= (uint8_t) (1 << (bit & 7));
+    }
+}
+
+static uint8_t __apn_suppression_bloom_test(const uint8_t *const bloom, uint32_t bloom_log2, const uint8_t *const token) {
+    uint64_t mask = ((uint64_t) 1 << bloom_log2) - 1;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    uint32_t i = 0;
+
+    __apn_suppression_hash(token, &h1, &h2);
+    for (; i < APN_SUPPRESSION_BLOOM_HASHES; i++) {
+        uint64_t bit = (h1 + i * h2) & mask;
+        if (0 == (bloom[bit >> 3] & (1 << (bit & 7)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static apn_return __apn_suppression_bloom_resize(apn_suppression_t *const suppression, uint32_t bloom_log2) {
+    uint8_t *bloom = calloc((size_t) 1 << (bloom_log2 - 3), 1);
+    uint32_t i = 0;
+    if (!bloom) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    for (i = 0; i < suppression->loaded_count; i++) {
+        __apn_suppression_bloom_set(bloom, bloom_log2, suppression->loaded + (size_t) i * APN_TOKEN_BINARY_SIZE);
+    }
+    for (i = 0; i < suppression->capacity; i++) {
+        if (suppression->used[i]) {
+            __apn_suppression_bloom_set(bloom, bloom_log2, suppression->slots + (size_t) i * APN_TOKEN_BINARY_SIZE);
+        }
+    }
+    free(suppression->bloom);
+    suppression->bloom = bloom;
+    suppression->bloom_log2 = bloom_log2;
+    return APN_SUCCESS;
+}
+
+static uint32_t __apn_suppression_slot(const apn_suppression_t *const suppression, const uint8_t *const token) {
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    uint32_t slot = 0;
+
+    __apn_suppression_hash(token, &h1, &h2);
+    slot = (uint32_t) (h1 & (suppression->capacity - 1));
+    while (suppression->used[slot]
+           && 0 != memcmp(suppression->slots + (size_t) slot * APN_TOKEN_BINARY_SIZE, token, APN_TOKEN_BINARY_SIZE)) {
+        slot = (slot + 1) & (suppression->capacity - 1);
+    }
+    return slot;
+}
+
+static apn_return __apn_suppression_grow(apn_suppression_t *const suppression) {
+    apn_suppression_t grown;
+    uint32_t i = 0;
+
+    if (suppression->capacity > UINT32_MAX / 2) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    grown = *suppression;
+    grown.capacity = suppression->capacity ? suppression->capacity * 2 : APN_SUPPRESSION_MIN_CAPACITY;
+    grown.slots = malloc((size_t) grown.capacity * APN_TOKEN_BINARY_SIZE);
+    grown.used = calloc(grown.capacity, 1);
+    if (!grown.slots || !grown.used) {
+        free(grown.slots);
+        free(grown.used);
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    for (; i < suppression->capacity; i++) {
+        if (suppression->used[i]) {
+            const uint8_t *token = suppression->slots + (size_t) i * APN_TOKEN_BINARY_SIZE;
+            uint32_t slot = __apn_suppression_slot(&grown, token);
+            memcpy(grown.slots + (size_t) slot * APN_TOKEN_BINARY_SIZE, token, APN_TOKEN_BINARY_SIZE);
+            grown.used[slot] = 1;
+        }
+    }
+    free(suppression->slots);
+    free(suppression->used);
+    suppression->slots = grown.slots;
+    suppression->used = grown.used;
+    suppression->capacity = grown.capacity;
+    return APN_SUCCESS;
+}
+
+static uint8_t __apn_suppression_find_loaded(const apn_suppression_t *const suppression, const uint8_t *const token) {
+    uint32_t low = 0;
+    uint32_t high = suppression->loaded_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        int cmp = memcmp(suppression->loaded + (size_t) middle * APN_TOKEN_BINARY_SIZE, token, APN_TOKEN_BINARY_SIZE);
+        if (0 == cmp) {
+            return 1;
+        } else if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return 0;
+}
+
+static apn_return __apn_suppression_write(const apn_suppression_t *const suppression, FILE *const stream) {
+    uint8_t header[APN_SUPPRESSION_HEADER_SIZE];
+    uint32_t fields[6];
+    uint32_t count = apn_suppression_count(suppression);
+    uint32_t bloom_log2 = __apn_suppression_bloom_log2(count);
+    size_t bloom_size = (size_t) 1 << (bloom_log2 - 3);
+    uint8_t *tokens = NULL;
+    uint8_t *bloom = NULL;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    apn_return ret = APN_SUCCESS;
+
+    tokens = malloc((size_t) (count ? count : 1) * APN_TOKEN_BINARY_SIZE);
+    bloom = calloc(bloom_size, 1);
+    if (!tokens || !bloom) {
+        free(tokens);
+        free(bloom);
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+
+    if (suppression->loaded_count) {
+        memcpy(tokens, suppression->loaded, (size_t) suppression->loaded_count * APN_TOKEN_BINARY_SIZE);
+    }
+    n = suppression->loaded_count;
+    for (; i < suppression->capacity; i++) {
+        if (suppression->used[i]) {
+            memcpy(tokens + (size_t) n++ * APN_TOKEN_BINARY_SIZE, suppression->slots + (size_t) i * APN_TOKEN_BINARY_SIZE,
+                   APN_TOKEN_BINARY_SIZE);
+        }
+    }
+    qsort(tokens, count, APN_TOKEN_BINARY_SIZE, __apn_suppression_compare);
+    for (i = 0; i < count; i++) {
+        __apn_suppression_bloom_set(bloom, bloom_log2, tokens + (size_t) i * APN_TOKEN_BINARY_SIZE);
+    }
+
+    fields[0] = htonl(APN_SUPPRESSION_VERSION);
+    fields[1] = htonl(count);
+    fields[2] = htonl(bloom_log2);
+    fields[3] = htonl(APN_SUPPRESSION_HEADER_SIZE);
+    fields[4] = htonl((uint32_t) (APN_SUPPRESSION_HEADER_SIZE + bloom_size));
+    fields[5] = 0;
+    memcpy(header, APN_SUPPRESSION_MAGIC, APN_SUPPRESSION_MAGIC_SIZE);
+    memcpy(header + APN_SUPPRESSION_MAGIC_SIZE, fields, sizeof(fields));
+
+    if (1 != fwrite(header, sizeof(header), 1, stream)
+        || 1 != fwrite(bloom, bloom_size, 1, stream)
+        || (count && 1 != fwrite(tokens, (size_t) count * APN_TOKEN_BINARY_SIZE, 1, stream))) {
+        ret = APN_ERROR;
+    }
+    free(tokens);
+    free(bloom);
+    return ret;
+}
+
+static uint32_t __apn_suppression_header_field(const uint8_t *const header, uint32_t offset) {
+    uint32_t value_n = 0;
+    memcpy(&value_n, header + offset, sizeof(uint32_t));
+    return ntohl(value_n);
+}
+
+static int __apn_suppression_compare(const void *a, const void *b) {
+    return memcmp(a, b, APN_TOKEN_BINARY_SIZE);
+}
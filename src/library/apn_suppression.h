@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_SUPPRESSION_H__
+#define __APN_SUPPRESSION_H__
+
+#include "apn_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Suppression list: device tokens which are known to be invalid.
+ *
+ * Lookups go through a Bloom filter first, so the common case of a token which is not suppressed
+ * costs a few bit tests; tokens which pass the filter are looked up in an exact set.
+ * A list can be saved to a file and loaded back without rebuilding, loaded tokens are memory-mapped.
+ *
+ * A list is not thread-safe. Attach it to connections driven by one thread, see ::apn_set_suppression_list().
+ */
+typedef struct __apn_suppression_t apn_suppression_t;
+
+/**
+ * Creates an empty suppression list.
+ *
+ * @param[in] expected_count - Expected number of tokens, used to size the Bloom filter.
+ *
+ * @return Pointer to new `suppression list` structure on success, or NULL on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_suppression_t *apn_suppression_init(uint32_t expected_count)
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Loads a suppression list saved with ::apn_suppression_save(). The file is memory-mapped and must not be
+ * modified while the list is used.
+ *
+ * @param[in] file - Path to the file. Cannot be NULL.
+ *
+ * @return Pointer to new `suppression list` structure on success, or NULL on failure with error information stored in `errno`,
+ * ::APN_ERR_FILE_FORMAT_INVALID if the file is not a suppression list or is truncated.
+ */
+__apn_export__ apn_suppression_t *apn_suppression_load(const char *const file)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Saves all tokens of the list to `file`. The file is replaced atomically where the platform allows it,
+ * so a list can be saved over the file it was loaded from.
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ * @param[in] file - Path to the file. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_suppression_save(const apn_suppression_t *const suppression, const char *const file)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Frees memory allocated for the list and unmaps its file.
+ *
+ * @param[in] suppression - Pointer to `suppression list` structure.
+ */
+__apn_export__ void apn_suppression_free(apn_suppression_t *suppression);
+
+/**
+ * Adds a binary token (32 bytes). Adding a token which is already in the list does nothing.
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ * @param[in] token - Binary device token. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_suppression_add(apn_suppression_t *const suppression, const uint8_t *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Adds a device token (hex).
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ * @param[in] token - Device token (hex). Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, ::APN_ERR_TOKEN_INVALID if the token is invalid.
+ */
+__apn_export__ apn_return apn_suppression_add_hex(apn_suppression_t *const suppression, const char *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns 1 if the binary token (32 bytes) is in the list, 0 otherwise.
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ * @param[in] token - Binary device token. Cannot be NULL.
+ */
+__apn_export__ uint8_t apn_suppression_contains(const apn_suppression_t *const suppression, const uint8_t *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns 1 if the device token (hex) is in the list, 0 otherwise or if the token is invalid.
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ * @param[in] token - Device token (hex). Cannot be NULL.
+ */
+__apn_export__ uint8_t apn_suppression_contains_hex(const apn_suppression_t *const suppression, const char *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns number of tokens in the list.
+ *
+ * @param[in] suppression - Pointer to an initialized `suppression list` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_suppression_count(const apn_suppression_t *const suppression)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
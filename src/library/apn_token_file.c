@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_token_file.h"
+#include "apn_token_set_private.h"
+#include "apn_tokens.h"
+#include "apn_mmap.h"
+#include "apn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef APN_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+/*
+ * File layout, integers are in network byte order:
+ *
+ *     magic (8) | version (4) | token count (4) | offset of tokens (4) | reserved (12)
+ *     sorted binary tokens
+ */
+#define APN_TOKEN_FILE_MAGIC "CAPNTOKS"
+#define APN_TOKEN_FILE_MAGIC_SIZE 8
+#define APN_TOKEN_FILE_VERSION 1
+#define APN_TOKEN_FILE_HEADER_SIZE 32
+
+struct __apn_token_file_t {
+    apn_mmap_t map;
+    /** View of the mapped tokens, owns no memory */
+    apn_token_set_t tokens;
+};
+
+static apn_return __apn_token_file_write(FILE *const stream, const apn_token_set_t *const tokens);
+static uint32_t __apn_token_file_header_field(const uint8_t *const header, uint32_t offset);
+
+apn_return apn_token_file_convert(const char *const file, const apn_token_source_t *tokens,
+                                  uint32_t *token_count, uint32_t *invalid_count) {
+    apn_token_source_t token_source;
+    apn_token_set_t *token_set = NULL;
+    const char *token = NULL;
+    uint32_t invalid = 0;
+    apn_return ret = APN_SUCCESS;
+    int next = 0;
+    int error = 0;
+    assert(file);
+    assert(tokens);
+
+    token_source = *tokens;
+    if (NULL == (token_set = apn_token_set_init(0))) {
+        apn_token_source_free(&token_source);
+        return APN_ERROR;
+    }
+    while (1 == (next = token_source.next(token_source.data, &token))) {
+        if (APN_ERROR == apn_token_set_add_hex(token_set, token)) {
+            if (APN_ERR_TOKEN_INVALID != errno) {
+                break;
+            }
+            invalid++;
+        }
+    }
+    error = errno;
+    apn_token_source_free(&token_source);
+
+    if (0 != next) {
+        apn_token_set_free(token_set);
+        errno = error;
+        return APN_ERROR;
+    }
+    ret = apn_token_file_save(file, token_set);
+    if (APN_SUCCESS == ret) {
+        if (token_count) {
+            *token_count = apn_token_set_count(token_set);
+        }
+        if (invalid_count) {
+            *invalid_count = invalid;
+        }
+    }
+    apn_token_set_free(token_set);
+    return ret;
+}
+
+apn_return apn_token_file_save(const char *const file, apn_token_set_t *const tokens) {
+    FILE *stream = NULL;
+    apn_return ret = APN_ERROR;
+    int error = 0;
+    assert(file);
+    assert(tokens);
+
+    apn_token_set_dedup(tokens);
+
+    stream = fopen(file, "wb");
+    if (!stream) {
+        return APN_ERROR;
+    }
+    ret = __apn_token_file_write(stream, tokens);
+    error = errno;
+    if (0 != fclose(stream) && APN_SUCCESS == ret) {
+        ret = APN_ERROR;
+        error = errno;
+    }
+    if (APN_ERROR == ret) {
+        remove(file);
+        errno = error;
+    }
+    return ret;
+}
+
+apn_token_file_t *apn_token_file_open(const char *const file) {
+    apn_token_file_t *token_file = NULL;
+    const uint8_t *header = NULL;
+    uint32_t tokens_offset = 0;
+    assert(file);
+
+    token_file = calloc(1, sizeof(apn_token_file_t));
+    if (!token_file) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (APN_ERROR == apn_mmap_open(&token_file->map, file)) {
+        free(token_file);
+        return NULL;
+    }
+
+    header = token_file->map.data;
+    if (token_file->map.size < APN_TOKEN_FILE_HEADER_SIZE
+        || 0 != memcmp(header, APN_TOKEN_FILE_MAGIC, APN_TOKEN_FILE_MAGIC_SIZE)
+        || APN_TOKEN_FILE_VERSION != __apn_token_file_header_field(header, 8)) {
+        apn_token_file_close(token_file);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    token_file->tokens.count = __apn_token_file_header_field(header, 12);
+    tokens_offset = __apn_token_file_header_field(header, 16);
+
+    if (tokens_offset < APN_TOKEN_FILE_HEADER_SIZE
+        || (uint64_t) tokens_offset + (uint64_t) token_file->tokens.count * APN_TOKEN_BINARY_SIZE > (uint64_t) token_file->map.size) {
+        apn_token_file_close(token_file);
+        errno = APN_ERR_FILE_FORMAT_INVALID;
+        return NULL;
+    }
+    /* the set is only handed out as const, so the mapping is never written through it */
+    token_file->tokens.tokens = (uint8_t *) token_file->map.data + tokens_offset;
+    token_file->tokens.capacity = token_file->tokens.count;
+    token_file->tokens.memory = NULL;
+    return token_file;
+}
+
+void apn_token_file_close(apn_token_file_t *token_file) {
+    if (token_file) {
+        apn_mmap_close(&token_file->map);
+        free(token_file);
+    }
+}
+
+uint32_t apn_token_file_count(const apn_token_file_t *const token_file) {
+    assert(token_file);
+    return token_file->tokens.count;
+}
+
+const apn_token_set_t *apn_token_file_tokens(const apn_token_file_t *const token_file) {
+    assert(token_file);
+    return &token_file->tokens;
+}
+
+static apn_return __apn_token_file_write(FILE *const stream, const apn_token_set_t *const tokens) {
+    uint8_t header[APN_TOKEN_FILE_HEADER_SIZE];
+    uint32_t fields[3];
+
+    fields[0] = htonl(APN_TOKEN_FILE_VERSION);
+    fields[1] = htonl(tokens->count);
+    fields[2] = htonl(APN_TOKEN_FILE_HEADER_SIZE);
+    memset(header, 0, sizeof(header));
+    memcpy(header, APN_TOKEN_FILE_MAGIC, APN_TOKEN_FILE_MAGIC_SIZE);
+    memcpy(header + APN_TOKEN_FILE_MAGIC_SIZE, fields, sizeof(fields));
+
+    if (1 != fwrite(header, sizeof(header), 1, stream)) {
+        return APN_ERROR;
+    }
+    if (tokens->count && 1 != fwrite(tokens->tokens, (size_t) tokens->count * APN_TOKEN_BINARY_SIZE, 1, stream)) {
+        return APN_ERROR;
+    }
+    return APN_SUCCESS;
+}
+
+static uint32_t __apn_token_file_header_field(const uint8_t *const header, uint32_t offset) {
+    uint32_t value_n = 0;
+    memcpy(&value_n, header + offset, sizeof(uint32_t));
+    return ntohl(value_n);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_TOKEN_FILE_H__
+#define __APN_TOKEN_FILE_H__
+
+#include "apn_platform.h"
+#include "apn_token_source.h"
+#include "apn_token_set.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Binary token file: a header followed by sorted, unique 32-byte binary tokens.
+ *
+ * An open file is memory-mapped and its tokens are exposed as a read-only token set, so a list
+ * of any size is loaded without reading, parsing or allocating per token.
+ */
+typedef struct __apn_token_file_t apn_token_file_t;
+
+/**
+ * Decodes hex tokens read from `tokens` and writes them to `file` as a binary token file.
+ * Invalid tokens are skipped, duplicates are written once.
+ *
+ * The call takes ownership of `tokens`, which is freed with ::apn_token_source_free().
+ *
+ * @param[in] file - Path to the binary token file, an existing file is replaced. Cannot be NULL.
+ * @param[in] tokens - Pointer to an initialized token source. Cannot be NULL.
+ * @param[out] token_count - Receives number of written tokens. Can be NULL.
+ * @param[out] invalid_count - Receives number of skipped invalid tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the file is removed.
+ */
+__apn_export__ apn_return apn_token_file_convert(const char *const file, const apn_token_source_t *tokens,
+                                                 uint32_t *token_count, uint32_t *invalid_count)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Writes tokens of a set to `file` as a binary token file. The set is sorted and deduplicated in place.
+ *
+ * @param[in] file - Path to the binary token file, an existing file is replaced. Cannot be NULL.
+ * @param[in] tokens - Pointer to an initialized `token set` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the file is removed.
+ */
+__apn_export__ apn_return apn_token_file_save(const char *const file, apn_token_set_t *const tokens)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Maps a binary token file into memory.
+ *
+ * @param[in] file - Path to the binary token file. Cannot be NULL.
+ *
+ * @return Pointer to new `token file` structure on success, or NULL on failure with error information stored in `errno`,
+ * ::APN_ERR_FILE_FORMAT_INVALID if the file is not a binary token file or is truncated.
+ */
+__apn_export__ apn_token_file_t *apn_token_file_open(const char *const file)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Unmaps the file and frees memory allocated for the token file.
+ *
+ * @param[in] token_file - Pointer to `token file` structure.
+ */
+__apn_export__ void apn_token_file_close(apn_token_file_t *token_file);
+
+/**
+ * Returns number of tokens in the file.
+ *
+ * @param[in] token_file - Pointer to an opened `token file` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_token_file_count(const apn_token_file_t *const token_file)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns tokens of the file as a read-only token set which points into the mapping. The set can be passed to
+ * ::apn_send_token_set() and other functions which do not modify it. It is valid until the file is closed
+ * and must not be freed.
+ *
+ * @param[in] token_file - Pointer to an opened `token file` structure. Cannot be NULL.
+ */
+__apn_export__ const apn_token_set_t *apn_token_file_tokens(const apn_token_file_t *const token_file)
+        __apn_attribute_nonnull__((1));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "apn_token_set_private.h"
+#include "apn_tokens.h"
+#include "apn.h"
+
+#define APN_TOKEN_SET_MIN_CAPACITY 16
+/** Tokens looked ahead by apn_token_set_unique(), enough to hide a cache miss on the table */
+#define APN_TOKEN_SET_PREFETCH_DISTANCE 16
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __APN_TOKEN_SET_PREFETCH(__address) __builtin_prefetch((__address))
+#else
+#define __APN_TOKEN_SET_PREFETCH(__address)
+#endif
+
+static apn_return __apn_token_set_grow(apn_token_set_t *const set, uint32_t count);
+static int __apn_token_set_compare(const void *a, const void *b);
+static uint32_t __apn_token_set_hash(const uint8_t *const token);
+
+apn_token_set_t *apn_token_set_init(uint32_t capacity) {
+    apn_token_set_t *set = malloc(sizeof(apn_token_set_t));
+    if (!set) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    set->tokens = NULL;
+    set->memory = NULL;
+    set->count = 0;
+    set->capacity = 0;
+    if (capacity > 0 && APN_ERROR == apn_token_set_reserve(set, capacity)) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void apn_token_set_free(apn_token_set_t *set) {
+    if (set) {
+        free(set->memory);
+        free(set);
+    }
+}
+
+apn_return apn_token_set_reserve(apn_token_set_t *const set, uint32_t capacity) {
+    void *memory = NULL;
+    uint8_t *tokens = NULL;
+    assert(set);
+
+    if (capacity <= set->capacity) {
+        return APN_SUCCESS;
+    }
+    if ((uint64_t) capacity * APN_TOKEN_SET_TOKEN_SIZE > (uint64_t) (SIZE_MAX - APN_TOKEN_SET_ALIGNMENT)) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+
+    /* realloc() does not keep the alignment, so tokens are moved to a new block */
+    memory = malloc((size_t) capacity * APN_TOKEN_SET_TOKEN_SIZE + APN_TOKEN_SET_ALIGNMENT - 1);
+    if (!memory) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    tokens = (uint8_t *) (((uintptr_t) memory + APN_TOKEN_SET_ALIGNMENT - 1) & ~((uintptr_t) APN_TOKEN_SET_ALIGNMENT - 1));
+    if (set->count) {
+        memcpy(tokens, set->tokens, (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE);
+    }
+    free(set->memory);
+    set->memory = memory;
+    set->tokens = tokens;
+    set->capacity = capacity;
+    return APN_SUCCESS;
+}
+
+uint32_t apn_token_set_count(const apn_token_set_t *const set) {
+    assert(set);
+    return set->count;
+}
+
+void apn_token_set_clear(apn_token_set_t *const set) {
+    assert(set);
+    set->count = 0;
+}
+
+apn_return apn_token_set_add(apn_token_set_t *const set, const uint8_t *const token) {
+    assert(set);
+    assert(token);
+
+    if (APN_ERROR == __apn_token_set_grow(set, 1)) {
+        return APN_ERROR;
+    }
+    memcpy(set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE, token, APN_TOKEN_SET_TOKEN_SIZE);
+    set->count++;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_set_add_hex(apn_token_set_t *const set, const char *const token) {
+    assert(set);
+    assert(token);
+
+    if (APN_ERROR == __apn_token_set_grow(set, 1)) {
+        return APN_ERROR;
+    }
+    if (APN_ERROR == apn_token_hex_decode(token, set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE)) {
+        return APN_ERROR;
+    }
+    set->count++;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_set_add_hex_many(apn_token_set_t *const set, const char *const *tokens, uint32_t count,
+                                      uint32_t *invalid) {
+    uint32_t skipped = 0;
+    uint32_t i = 0;
+    assert(set);
+    assert(tokens);
+
+    if (APN_ERROR == __apn_token_set_grow(set, count)) {
+        return APN_ERROR;
+    }
+    /* tokens are decoded in place, an invalid one is overwritten by the next */
+    for (; i < count; i++) {
+        if (tokens[i] && APN_SUCCESS == apn_token_hex_decode(tokens[i], set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE)) {
+            set->count++;
+        } else {
+            skipped++;
+        }
+    }
+    if (invalid) {
+        *invalid = skipped;
+    }
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_set_add_hex_normalized_many(apn_token_set_t *const set, const char *const *tokens, uint32_t count,
+                                                 uint32_t *rejected, uint32_t *rejected_count) {
+    uint32_t skipped = 0;
+    uint32_t i = 0;
+    assert(set);
+    assert(tokens);
+
+    if (APN_ERROR == __apn_token_set_grow(set, count)) {
+        return APN_ERROR;
+    }
+    for (; i < count; i++) {
+        if (tokens[i] && APN_SUCCESS == apn_token_hex_decode_normalized(tokens[i], set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE)) {
+            set->count++;
+        } else {
+            if (rejected) {
+                rejected[skipped] = i;
+            }
+            skipped++;
+        }
+    }
+    if (rejected_count) {
+        *rejected_count = skipped;
+    }
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_set_append(apn_token_set_t *const set, const apn_token_set_t *const source) {
+    assert(set);
+    assert(source);
+
+    if (0 == source->count) {
+        return APN_SUCCESS;
+    }
+    if (APN_ERROR == __apn_token_set_grow(set, source->count)) {
+        return APN_ERROR;
+    }
+    /* memmove, a set can be appended to itself */
+    memmove(set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE, source->tokens,
+            (size_t) source->count * APN_TOKEN_SET_TOKEN_SIZE);
+    set->count += source->count;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_set_add_array(apn_token_set_t *const set, const apn_array_t *const tokens, uint32_t *invalid) {
+    uint32_t count = 0;
+    uint32_t skipped = 0;
+    uint32_t i = 0;
+    assert(set);
+    assert(tokens);
+
+    count = apn_array_count(tokens);
+    if (APN_ERROR == __apn_token_set_grow(set, count)) {
+        return APN_ERROR;
+    }
+    for (; i < count; i++) {
+        const char *token = apn_array_item_at_index(tokens, i);
+        if (token && APN_SUCCESS == apn_token_hex_decode(token, set->tokens + (size_t) set->count * APN_TOKEN_SET_TOKEN_SIZE)) {
+            set->count++;
+        } else {
+            skipped++;
+        }
+    }
+    if (invalid) {
+        *invalid = skipped;
+    }
+    return APN_SUCCESS;
+}
+
+const uint8_t *apn_token_set_at(const apn_token_set_t *const set, uint32_t index) {
+    assert(set);
+    if (index >= set->count) {
+        return NULL;
+    }
+    return set->tokens + (size_t) index * APN_TOKEN_SET_TOKEN_SIZE;
+}
+
+apn_return apn_token_set_hex_at(const apn_token_set_t *const set, uint32_t index, char *const token) {
+    assert(set);
+    assert(token);
+
+    if (index >= set->count) {
+        errno = EINVAL;
+        return APN_ERROR;
+    }
+    apn_token_hex_encode(set->tokens + (size_t) index * APN_TOKEN_SET_TOKEN_SIZE, token);
+    return APN_SUCCESS;
+}
+
+const uint8_t *apn_token_set_data(const apn_token_set_t *const set) {
+    assert(set);
+    return set->tokens;
+}
+
+uint32_t apn_token_set_dedup(apn_token_set_t *const set) {
+    uint32_t removed = 0;
+    uint32_t unique = 0;
+    uint32_t i = 1;
+    assert(set);
+
+    if (set->count < 2) {
+        return 0;
+    }
+    qsort(set->tokens, set->count, APN_TOKEN_SET_TOKEN_SIZE, __apn_token_set_compare);
+    for (; i < set->count; i++) {
+        uint8_t *token = set->tokens + (size_t) i * APN_TOKEN_SET_TOKEN_SIZE;
+        uint8_t *last = set->tokens + (size_t) unique * APN_TOKEN_SET_TOKEN_SIZE;
+        if (0 != memcmp(token, last, APN_TOKEN_SET_TOKEN_SIZE)) {
+            unique++;
+            if (unique != i) {
+                memcpy(last + APN_TOKEN_SET_TOKEN_SIZE, token, APN_TOKEN_SET_TOKEN_SIZE);
+            }
+        }
+    }
+    unique++;
+    removed = set->count - unique;
+    set->count = unique;
+    return removed;
+}
+
+apn_return apn_token_set_unique(apn_token_set_t *const set, uint32_t *removed) {
+    uint64_t *slots = NULL;
+    uint32_t capacity = 1;
+    uint32_t unique = 0;
+    uint32_t i = 0;
+    assert(set);
+
+    if (set->count < 2) {
+        if (removed) {
+            *removed = 0;
+        }
+        return APN_SUCCESS;
+    }
+
+    /* a slot keeps the hash in the high half and index + 1 in the low half, 0 is free;
+     * the hash is compared first, so tokens are only read back on a likely match */
+    while (capacity < set->count + set->count / 2) {
+        if (capacity > UINT32_MAX / 2) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        capacity *= 2;
+    }
+    slots = calloc(capacity, sizeof(uint64_t));
+    if (!slots) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+
+    for (; i < set->count; i++) {
+        const uint8_t *token = set->tokens + (size_t) i * APN_TOKEN_SET_TOKEN_SIZE;
+        uint32_t hash = __apn_token_set_hash(token);
+        uint32_t slot = hash & (capacity - 1);
+        uint8_t duplicate = 0;
+
+        if (i + APN_TOKEN_SET_PREFETCH_DISTANCE < set->count) {
+            const uint8_t *ahead = token + APN_TOKEN_SET_PREFETCH_DISTANCE * APN_TOKEN_SET_TOKEN_SIZE;
+            __APN_TOKEN_SET_PREFETCH(&slots[__apn_token_set_hash(ahead) & (capacity - 1)]);
+        }
+        while (slots[slot]) {
+            if ((uint32_t) (slots[slot] >> 32) == hash) {
+                uint32_t index = (uint32_t) slots[slot] - 1;
+                if (0 == memcmp(set->tokens + (size_t) index * APN_TOKEN_SET_TOKEN_SIZE, token, APN_TOKEN_SET_TOKEN_SIZE)) {
+                    duplicate = 1;
+                    break;
+                }
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (duplicate) {
+            continue;
+        }
+        if (unique != i) {
+            memcpy(set->tokens + (size_t) unique * APN_TOKEN_SET_TOKEN_SIZE, token, APN_TOKEN_SET_TOKEN_SIZE);
+        }
+        slots[slot] = ((uint64_t) hash << 32) | (uint64_t) (unique + 1);
+        unique++;
+    }
+    free(slots);
+
+    if (removed) {
+        *removed = set->count - unique;
+    }
+    set->count = unique;
+    return APN_SUCCESS;
+}
+
+apn_array_t *apn_token_set_to_array(const apn_token_set_t *const set) {
+    apn_array_t *array = NULL;
+    uint32_t i = 0;
+    assert(set);
+
+    /* strings live in the arena of the array, so a large set does not take an allocation per token */
+    array = apn_array_init_arena(set->count > 0 ? set->count : 1);
+    if (!array) {
+        return NULL;
+    }
+    for (; i < set->count; i++) {
+        char *token = apn_array_alloc(array, APN_TOKEN_LENGTH + 1);
+        if (!token) {
+            apn_array_free(array);
+            return NULL;
+        }
+        apn_token_hex_encode(set->tokens + (size_t) i * APN_TOKEN_SET_TOKEN_SIZE, token);
+        apn_array_insert(array, token);
+    }
+    return array;
+}
+
+static apn_return __apn_token_set_grow(apn_token_set_t *const set, uint32_t count) {
+    uint32_t capacity = set->capacity;
+
+    if (count <= set->capacity - set->count) {
+        return APN_SUCCESS;
+    }
+    if (count > UINT32_MAX - set->count) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    if (capacity < APN_TOKEN_SET_MIN_CAPACITY) {
+        capacity = APN_TOKEN_SET_MIN_CAPACITY;
+    }
+    while (capacity < set->count + count) {
+        capacity = (capacity > UINT32_MAX / 2) ? UINT32_MAX : capacity * 2;
+    }
+    return apn_token_set_reserve(set, capacity);
+}
+
+static int __apn_token_set_compare(const void *a, const void *b) {
+    return memcmp(a, b, APN_TOKEN_SET_TOKEN_SIZE);
+}
+
+static uint32_t __apn_token_set_hash(const uint8_t *const token) {
+    uint64_t words[4];
+    uint64_t hash = 0;
+    memcpy(words, token, sizeof(words));
+    hash = (words[0] ^ (words[1] << 31 | words[1] >> 33) ^ words[2] ^ (words[3] << 17 | words[3] >> 47))
+           * UINT64_C(0x9E3779B97F4A7C15);
+    return (uint32_t) (hash >> 32);
+}
+
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_TOKEN_SET_H__
+#define __APN_TOKEN_SET_H__
+
+#include "apn_platform.h"
+#include "apn_array.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of a binary device token in a set */
+#define APN_TOKEN_SET_TOKEN_SIZE 32
+
+/**
+ * Set of binary device tokens.
+ *
+ * Tokens are decoded once and stored back to back in one 32-byte aligned buffer, which takes
+ * a third of the memory of an array of hex strings and is iterated sequentially.
+ */
+typedef struct __apn_token_set_t apn_token_set_t;
+
+/**
+ * Creates an empty token set.
+ *
+ * @param[in] capacity - Number of tokens to allocate memory for, 0 to allocate on first insertion.
+ *
+ * @return Pointer to new `token set` structure on success, or NULL on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_token_set_t *apn_token_set_init(uint32_t capacity)
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Frees memory allocated for the set.
+ *
+ * @param[in] set - Pointer to `token set` structure.
+ */
+__apn_export__ void apn_token_set_free(apn_token_set_t *set);
+
+/**
+ * Allocates memory for at least `capacity` tokens.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] capacity - Number of tokens.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_set_reserve(apn_token_set_t *const set, uint32_t capacity)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Returns number of tokens in the set.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ */
+__apn_export__ uint32_t apn_token_set_count(const apn_token_set_t *const set)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Removes all tokens, keeping allocated memory.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ */
+__apn_export__ void apn_token_set_clear(apn_token_set_t *const set)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Appends a binary token.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] token - ::APN_TOKEN_SET_TOKEN_SIZE bytes of the token. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_set_add(apn_token_set_t *const set, const uint8_t *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Decodes and appends a device token.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] token - Device token (hex). Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, ::APN_ERR_TOKEN_INVALID if the token is invalid.
+ */
+__apn_export__ apn_return apn_token_set_add_hex(apn_token_set_t *const set, const char *const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Decodes and appends `count` device tokens, invalid tokens are skipped.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] tokens - Array of device tokens (hex). Cannot be NULL.
+ * @param[in] count - Number of tokens.
+ * @param[out] invalid - Receives number of skipped tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the set is left unchanged.
+ */
+__apn_export__ apn_return apn_token_set_add_hex_many(apn_token_set_t *const set, const char *const *tokens, uint32_t count,
+                                                     uint32_t *invalid)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Normalizes, decodes and appends `count` device tokens. Whitespace and `<`, `>` brackets are ignored and hex
+ * digits are accepted in either case, tokens which are still invalid are rejected.
+ *
+ * The call only touches `set`, so large inputs can be split into chunks which are added to separate sets
+ * in parallel, then merged with ::apn_token_set_append() and deduplicated with ::apn_token_set_unique().
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] tokens - Array of device tokens (hex). Cannot be NULL.
+ * @param[in] count - Number of tokens.
+ * @param[out] rejected - Receives indexes of rejected tokens in `tokens`, must hold `count` items. Can be NULL.
+ * @param[out] rejected_count - Receives number of rejected tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the set is left unchanged.
+ */
+__apn_export__ apn_return apn_token_set_add_hex_normalized_many(apn_token_set_t *const set, const char *const *tokens,
+                                                                uint32_t count, uint32_t *rejected,
+                                                                uint32_t *rejected_count)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Appends all tokens of `source` to `set`.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] source - Pointer to an initialized `token set` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_set_append(apn_token_set_t *const set, const apn_token_set_t *const source)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Decodes and appends tokens of an array returned by earlier versions of the library, invalid tokens are skipped.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] tokens - Array of device tokens (hex). Cannot be NULL.
+ * @param[out] invalid - Receives number of skipped tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_set_add_array(apn_token_set_t *const set, const apn_array_t *const tokens,
+                                                  uint32_t *invalid)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Returns binary token at `index`, or NULL if `index` is out of range.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] index - Index of the token.
+ */
+__apn_export__ const uint8_t *apn_token_set_at(const apn_token_set_t *const set, uint32_t index)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Copies hex representation of the token at `index` to `token`.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[in] index - Index of the token.
+ * @param[out] token - Buffer of at least 65 bytes. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if `index` is out of range, `errno` is set to `EINVAL`.
+ */
+__apn_export__ apn_return apn_token_set_hex_at(const apn_token_set_t *const set, uint32_t index, char *const token)
+        __apn_attribute_nonnull__((1,3));
+
+/**
+ * Returns pointer to the first token. Tokens follow each other every ::APN_TOKEN_SET_TOKEN_SIZE bytes.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ */
+__apn_export__ const uint8_t *apn_token_set_data(const apn_token_set_t *const set)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Sorts tokens and removes duplicates.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ *
+ * @return Number of removed tokens.
+ */
+__apn_export__ uint32_t apn_token_set_dedup(apn_token_set_t *const set)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Removes duplicates using a hash table, keeping the first occurrence of each token and the order of tokens.
+ * Faster than ::apn_token_set_dedup() on large sets, but needs 12 to 24 bytes of temporary memory per token.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ * @param[out] removed - Receives number of removed tokens. Can be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`, the set is left unchanged.
+ */
+__apn_export__ apn_return apn_token_set_unique(apn_token_set_t *const set, uint32_t *removed)
+        __apn_attribute_nonnull__((1));
+
+/**
+ * Converts the set to an array of hex strings.
+ *
+ * @param[in] set - Pointer to an initialized `token set` structure. Cannot be NULL.
+ *
+ * @return Pointer to new array on success, or NULL on failure with error information stored in `errno`.
+ * The array should be freed - call ::apn_array_free() function for it.
+ */
+__apn_export__ apn_array_t *apn_token_set_to_array(const apn_token_set_t *const set)
+        __apn_attribute_nonnull__((1))
+        __apn_attribute_warn_unused_result__;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "apn_token_source.h"
+#include "apn_token_source_private.h"
+#include "apn_tokens.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/** Size of chunks a file is read in */
+#define APN_TOKEN_SOURCE_CHUNK_SIZE 65536
+/** Offset of every n-th token is remembered, so rewinding does not rescan the whole file */
+#define APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL 4096
+
+typedef struct __apn_token_source_array_data_t {
+    apn_array_t *tokens;
+    uint32_t index;
+    uint32_t end_index;
+} apn_token_source_array_data_t;
+
+typedef struct __apn_token_source_text_data_t {
+    FILE *file;
+    char *chunk;
+    const char *buffer;
+    size_t buffer_size;
+    size_t position;
+    /** Offset of buffer[0] from the beginning of the file */
+    uint64_t buffer_offset;
+    /** Index of the token which is read next */
+    uint32_t index;
+    uint64_t *checkpoints;
+    uint32_t checkpoints_count;
+    uint32_t checkpoints_allocated;
+    /** One extra character, so an overlong token stays invalid */
+    char token[APN_TOKEN_LENGTH + 2];
+} apn_token_source_text_data_t;
+
+typedef struct __apn_token_source_token_set_data_t {
+    const apn_token_set_t *tokens;
+    uint32_t index;
+    char token[APN_TOKEN_LENGTH + 1];
+} apn_token_source_token_set_data_t;
+
+static int __apn_token_source_array_next(void *data, const char **token);
+static apn_return __apn_token_source_array_rewind(void *data, uint32_t index);
+static int __apn_token_source_text_next(void *data, const char **token);
+static apn_return __apn_token_source_text_rewind(void *data, uint32_t index);
+static void __apn_token_source_text_free(void *data);
+static int __apn_token_source_text_fill(apn_token_source_text_data_t *const text);
+static apn_return __apn_token_source_text_seek(apn_token_source_text_data_t *const text, uint32_t checkpoint);
+static apn_return __apn_token_source_text_checkpoint(apn_token_source_text_data_t *const text, uint64_t offset);
+static apn_token_source_text_data_t *__apn_token_source_text_init(apn_token_source_t *const source);
+static int __apn_token_source_token_set_next(void *data, const char **token);
+static apn_return __apn_token_source_token_set_rewind(void *data, uint32_t index);
+
+apn_return apn_token_source_array(apn_token_source_t *const source, apn_array_t *tokens) {
+    assert(source);
+    assert(tokens);
+    return apn_token_source_array_range(source, tokens, apn_array_count(tokens));
+}
+
+apn_return apn_token_source_array_range(apn_token_source_t *const source, apn_array_t *tokens, uint32_t end_index) {
+    apn_token_source_array_data_t *data = NULL;
+    assert(source);
+    assert(tokens);
+
+    data = malloc(sizeof(apn_token_source_array_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->tokens = tokens;
+    data->index = 0;
+    data->end_index = end_index;
+
+    source->data = data;
+    source->next = __apn_token_source_array_next;
+    source->rewind = __apn_token_source_array_rewind;
+    source->free = free;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_source_memory(apn_token_source_t *const source, const char *buffer, size_t size) {
+    apn_token_source_text_data_t *data = NULL;
+    assert(source);
+    assert(buffer);
+
+    if (NULL == (data = __apn_token_source_text_init(source))) {
+        return APN_ERROR;
+    }
+    data->buffer = buffer;
+    data->buffer_size = size;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_source_file(apn_token_source_t *const source, const char *const file) {
+    apn_token_source_text_data_t *data = NULL;
+    FILE *handle = NULL;
+    assert(source);
+    assert(file);
+
+    if (NULL == (handle = fopen(file, "rb"))) {
+        return APN_ERROR;
+    }
+    if (NULL == (data = __apn_token_source_text_init(source))) {
+        fclose(handle);
+        return APN_ERROR;
+    }
+    data->file = handle;
+    if (NULL == (data->chunk = malloc(APN_TOKEN_SOURCE_CHUNK_SIZE))) {
+        apn_token_source_free(source);
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->buffer = data->chunk;
+    return APN_SUCCESS;
+}
+
+apn_return apn_token_source_token_set(apn_token_source_t *const source, const apn_token_set_t *const tokens) {
+    apn_token_source_token_set_data_t *data = NULL;
+    assert(source);
+    assert(tokens);
+
+    data = malloc(sizeof(apn_token_source_token_set_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return APN_ERROR;
+    }
+    data->tokens = tokens;
+    data->index = 0;
+
+    source->data = data;
+    source->next = __apn_token_source_token_set_next;
+    source->rewind = __apn_token_source_token_set_rewind;
+    source->free = free;
+    return APN_SUCCESS;
+}
+
+void apn_token_source_free(apn_token_source_t *const source) {
+    if (source) {
+        if (source->free && source->data) {
+            source->free(source->data);
+        }
+        memset(source, 0, sizeof(apn_token_source_t));
+    }
+}
+
+static int __apn_token_source_array_next(void *data, const char **token) {
+    apn_token_source_array_data_t *array = (apn_token_source_array_data_t *) data;
+    if (array->index >= array->end_index || array->index >= apn_array_count(array->tokens)) {
+        return 0;
+    }
+    *token = (const char *) apn_array_item_at_index(array->tokens, array->index++);
+    if (!*token) {
+        *token = "";
+    }
+    return 1;
+}
+
+static apn_return __apn_token_source_array_rewind(void *data, uint32_t index) {
+    ((apn_token_source_array_data_t *) data)->index = index;
+    return APN_SUCCESS;
+}
+
+static int __apn_token_source_token_set_next(void *data, const char **token) {
+    apn_token_source_token_set_data_t *set = (apn_token_source_token_set_data_t *) data;
+    if (set->index >= apn_token_set_count(set->tokens)) {
+        return 0;
+    }
+    apn_token_hex_encode(apn_token_set_at(set->tokens, set->index++), set->token);
+    *token = set->token;
+    return 1;
+}
+
+static apn_return __apn_token_source_token_set_rewind(void *data, uint32_t index) {
+    ((apn_token_source_token_set_data_t *) data)->index = index;
+    return APN_SUCCESS;
+}
+
+static apn_token_source_text_data_t *__apn_token_source_text_init(apn_token_source_t *const source) {
+    apn_token_source_text_data_t *data = calloc(1, sizeof(apn_token_source_text_data_t));
+    if (!data) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    source->data = data;
+    source->next = __apn_token_source_text_next;
+    source->rewind = __apn_token_source_text_rewind;
+    source->free = __apn_token_source_text_free;
+    return data;
+}
+
+static void __apn_token_source_text_free(void *data) {
+    apn_token_source_text_data_t *text = (apn_token_source_text_data_t *) data;
+    if (text) {
+        if (text->file) {
+            fclose(text->file);
+        }
+        free(text->chunk);
+        free(text->checkpoints);
+        free(text);
+    }
+}
+
+#define __APN_TOKEN_SEPARATOR(__c) (' ' == (__c) || '\n' == (__c) || '\r' == (__c) || '\t' == (__c) || ',' == (__c))
+
+static int __apn_token_source_text_next(void *data, const char **token) {
+    apn_token_source_text_data_t *text = (apn_token_source_text_data_t *) data;
+    size_t length = 0;
+    int ret = 0;
+
+    while (1 == (ret = __apn_token_source_text_fill(text)) && __APN_TOKEN_SEPARATOR(text->buffer[text->position])) {
+        text->position++;
+    }
+    if (ret <= 0) {
+        return ret;
+    }
+
+    if (0 == text->index % APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL &&
+        text->index / APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL == text->checkpoints_count) {
+        if (APN_ERROR == __apn_token_source_text_checkpoint(text, text->buffer_offset + text->position)) {
+            return -1;
+        }
+    }
+
+    while (1 == (ret = __apn_token_source_text_fill(text)) && !__APN_TOKEN_SEPARATOR(text->buffer[text->position])) {
+        if (length < sizeof(text->token) - 1) {
+            text->token[length++] = text->buffer[text->position];
+        }
+        text->position++;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    text->token[length] = '\0';
+    text->index++;
+    *token = text->token;
+    return 1;
+}
+
+static apn_return __apn_token_source_text_rewind(void *data, uint32_t index) {
+    apn_token_source_text_data_t *text = (apn_token_source_text_data_t *) data;
+    uint32_t checkpoint = index / APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL;
+    const char *token = NULL;
+    int ret = 0;
+
+    if (index < text->index) {
+        if (checkpoint >= text->checkpoints_count) {
+            checkpoint = text->checkpoints_count - 1;
+        }
+        if (APN_ERROR == __apn_token_source_text_seek(text, checkpoint)) {
+            return APN_ERROR;
+        }
+    } else if (checkpoint < text->checkpoints_count && checkpoint * APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL > text->index) {
+        if (APN_ERROR == __apn_token_source_text_seek(text, checkpoint)) {
+            return APN_ERROR;
+        }
+    }
+
+    while (text->index < index) {
+        if (0 >= (ret = __apn_token_source_text_next(text, &token))) {
+            return (0 == ret) ? APN_SUCCESS : APN_ERROR;
+        }
+    }
+    return APN_SUCCESS;
+}
+
+static int __apn_token_source_text_fill(apn_token_source_text_data_t *const text) {
+    if (text->position < text->buffer_size) {
+        return 1;
+    }
+    if (!text->file) {
+        return 0;
+    }
+    text->buffer_offset += text->buffer_size;
+    text->position = 0;
+    text->buffer_size = fread(text->chunk, 1, APN_TOKEN_SOURCE_CHUNK_SIZE, text->file);
+    if (0 == text->buffer_size) {
+        if (ferror(text->file)) {
+            errno = EIO;
+            return -1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static apn_return __apn_token_source_text_seek(apn_token_source_text_data_t *const text, uint32_t checkpoint) {
+    uint64_t offset = text->checkpoints[checkpoint];
+
+    text->index = checkpoint * APN_TOKEN_SOURCE_CHECKPOINT_INTERVAL;
+    if (offset >= text->buffer_offset && offset < text->buffer_offset + text->buffer_size) {
+        text->position = (size_t) (offset - text->buffer_offset);
+        return APN_SUCCESS;
+    }
+    if (fseek(text->file, (long) offset, SEEK_SET)) {
+        return APN_ERROR;
+    }
+    text->buffer_offset = offset;
+    text->buffer_size = 0;
+    text->position = 0;
+    return APN_SUCCESS;
+}
+
+static apn_return __apn_token_source_text_checkpoint(apn_token_source_text_data_t *const text, uint64_t offset) {
+    if (text->checkpoints_count == text->checkpoints_allocated) {
+        uint32_t allocated = text->checkpoints_allocated ? text->checkpoints_allocated * 2 : 16;
+        uint64_t *checkpoints = realloc(text->checkpoints, allocated * sizeof(uint64_t));
+        if (!checkpoints) {
+            errno = ENOMEM;
+            return APN_ERROR;
+        }
+        text->checkpoints = checkpoints;
+        text->checkpoints_allocated = allocated;
+    }
+    text->checkpoints[text->checkpoints_count++] = offset;
+    return APN_SUCCESS;
+}
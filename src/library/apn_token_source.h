@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013-2015 Anton Dobkin <anton.dobkin@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __APN_TOKEN_SOURCE_H__
+#define __APN_TOKEN_SOURCE_H__
+
+#include "apn_platform.h"
+#include "apn_array.h"
+#include "apn_token_set.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Sequence of device tokens which is read lazily while notifications are sent.
+ *
+ * A custom source can be made by filling in the callbacks.
+ */
+typedef struct __apn_token_source_t {
+    void *data;
+    /**
+     * Reads the next token. Returns 1 and stores pointer to a NUL-terminated hex token in `token`
+     * (valid until the next call), 0 at the end of the sequence, or -1 on failure with error
+     * information stored in `errno`.
+     */
+    int (*next)(void *data, const char **token);
+    /**
+     * Positions the source so that the next call of `next` reads the token with the given index.
+     */
+    apn_return (*rewind)(void *data, uint32_t index);
+    /**
+     * Frees `data`. Can be NULL.
+     */
+    void (*free)(void *data);
+} apn_token_source_t;
+
+/**
+ * Initializes a token source which reads tokens from an array. The array is not copied
+ * and must stay unchanged until the source is freed.
+ *
+ * @param[in, out] source - Pointer to `source` structure. Cannot be NULL.
+ * @param[in] tokens - Array of tokens. Each item is string. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_source_array(apn_token_source_t *const source, apn_array_t *tokens)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Initializes a token source which reads tokens from a memory buffer. Tokens are separated
+ * by whitespace or commas. The buffer is not copied and must stay unchanged until the source is freed.
+ *
+ * @param[in, out] source - Pointer to `source` structure. Cannot be NULL.
+ * @param[in] buffer - Buffer with tokens. Cannot be NULL.
+ * @param[in] size - Size of buffer in bytes.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_source_memory(apn_token_source_t *const source, const char *buffer, size_t size)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Initializes a token source which reads tokens from a file. Tokens are separated
+ * by whitespace or commas. The file is read in small chunks, so memory use does not depend on its size.
+ *
+ * @param[in, out] source - Pointer to `source` structure. Cannot be NULL.
+ * @param[in] file - Path to file. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_source_file(apn_token_source_t *const source, const char *const file)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Initializes a token source which reads tokens from a token set, e.g. the tokens of a binary token file.
+ * The set is not copied and must stay unchanged until the source is freed.
+ *
+ * @param[in, out] source - Pointer to `source` structure. Cannot be NULL.
+ * @param[in] tokens - Pointer to an initialized `token set` structure. Cannot be NULL.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR on failure with error information stored in `errno`.
+ */
+__apn_export__ apn_return apn_token_source_token_set(apn_token_source_t *const source, const apn_token_set_t *const tokens)
+        __apn_attribute_nonnull__((1,2))
+        __apn_attribute_warn_unused_result__;
+
+/**
+ * Frees memory allocated by the source.
+ *
+ * @param[in] source - Pointer to `source` structure.
+ */
+__apn_export__ void apn_token_source_free(apn_token_source_t *const source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -21,75 +21,360 @@
  */
 
 #include "apn_tokens.h"
-#include "apn_strings.h"
+#include "apn.h"
 
 #include <errno.h>
 #include <assert.h>
 #include <stdlib.h>
-#include <stdio.h>
-#include <ctype.h>
+
+/*
+ * Hex kernels: a table-driven scalar version, SSE2 where the compiler targets it (every x86-64 CPU)
+ * and AVX2 compiled with a function attribute and selected at run time on GCC and Clang.
+ */
+/* Vector loads may read past the terminator of a short token, which address sanitizers report */
+#if defined(__SANITIZE_ADDRESS__)
+#define APN_TOKENS_SCALAR_ONLY
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define APN_TOKENS_SCALAR_ONLY
+#endif
+#endif
+
+#if !defined(APN_TOKENS_SCALAR_ONLY) && defined(APN_HAVE_IMMINTRIN_H) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define APN_TOKENS_SSE2
+#include <immintrin.h>
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define APN_TOKENS_AVX2
+#endif
+#endif
+
+#define APN_TOKENS_PAGE_SIZE 4096
+
+typedef apn_return (*__apn_token_hex_decode_func)(const char *const token, uint8_t *const binary_token);
+typedef void (*__apn_token_hex_encode_func)(const uint8_t *const binary_token, char *const token);
+
+static apn_return __apn_token_hex_decode_resolve(const char *const token, uint8_t *const binary_token);
+static void __apn_token_hex_encode_resolve(const uint8_t *const binary_token, char *const token);
+static void __apn_tokens_resolve(void);
+
+static __apn_token_hex_decode_func __apn_token_hex_decode_impl = __apn_token_hex_decode_resolve;
+static __apn_token_hex_encode_func __apn_token_hex_encode_impl = __apn_token_hex_encode_resolve;
+
+static const char __apn_hex_digits[] = "0123456789ABCDEF";
+
+/* Value of a hex digit, 0xFF for other characters */
+static const uint8_t __apn_hex_values[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
 
 uint8_t *apn_token_hex_to_binary(const char *const token) {
-	assert(token);
+    uint8_t *binary_token = NULL;
+    assert(token);
 
-    uint8_t *binary_token = malloc(APN_TOKEN_BINARY_SIZE);
+    binary_token = malloc(APN_TOKEN_BINARY_SIZE);
     if (!binary_token) {
         errno = ENOMEM;
         return NULL;
     }
-    memset(binary_token, 0, APN_TOKEN_BINARY_SIZE);
-
-    uint16_t j = 0;
-    uint16_t i = 0;
-    for (; i < APN_TOKEN_BINARY_SIZE * 2; i += 2, j++) {
-        char tmp[3] = {token[i], token[i + 1], '\0'};
-        uint32_t tmp_binary = 0;
-#ifdef _WIN32
-        sscanf_s(tmp, "%x", &tmp_binary);
-#else
-        sscanf(tmp, "%x", &tmp_binary);
-#endif
-        binary_token[j] = (uint8_t) tmp_binary;
+    if (APN_ERROR == apn_token_hex_decode(token, binary_token)) {
+        free(binary_token);
+        return NULL;
     }
     return binary_token;
 }
 
 char *apn_token_binary_to_hex(const uint8_t *const binary_token) {
+    char *token = NULL;
     assert(binary_token);
 
-    uint32_t token_size = (APN_TOKEN_BINARY_SIZE * 2) + 1;
-    char *token = malloc(token_size);
+    token = malloc(APN_TOKEN_LENGTH + 1);
     if (!token) {
         errno = ENOMEM;
         return NULL;
     }
-    char *p = token;
-
-    uint16_t i = 0;
-    for (; i < APN_TOKEN_BINARY_SIZE; i++) {
-#ifdef _WIN32
-        _snprintf_s(p, token_size, 3, "%2.2hhX", (unsigned char) binary_token[i]);
-#else
-        snprintf(p, 3, "%2.2hhX", (uint8_t) binary_token[i]);
-#endif
-        p += 2;
-    }
+    apn_token_hex_encode(binary_token, token);
     return token;
 }
 
 uint8_t apn_hex_token_is_valid(const char *const token) {
-	assert(token);
+    uint8_t binary_token[APN_TOKEN_BINARY_SIZE];
+    assert(token);
+    return (uint8_t) (APN_SUCCESS == __apn_token_hex_decode_impl(token, binary_token));
+}
+
+apn_return apn_token_hex_decode(const char *const token, uint8_t *const binary_token) {
+    assert(token);
+    assert(binary_token);
+
+    if (APN_ERROR == __apn_token_hex_decode_impl(token, binary_token)) {
+        errno = APN_ERR_TOKEN_INVALID;
+        return APN_ERROR;
+    }
+    return APN_SUCCESS;
+}
 
-    char *p = (char *) token;
-    size_t token_length = strlen(token);
-    if(token_length < APN_TOKEN_LENGTH || token_length > APN_TOKEN_LENGTH) {
-        return 0;
+apn_return apn_token_hex_decode_normalized(const char *const token, uint8_t *const binary_token) {
+    char canonical[APN_TOKEN_LENGTH + 1];
+    size_t length = 0;
+    const char *p = token;
+    assert(token);
+    assert(binary_token);
+
+    if (APN_SUCCESS == __apn_token_hex_decode_impl(token, binary_token)) {
+        return APN_SUCCESS;
+    }
+    for (; *p; p++) {
+        if (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p || '<' == *p || '>' == *p) {
+            continue;
+        }
+        if (APN_TOKEN_LENGTH == length) {
+            errno = APN_ERR_TOKEN_INVALID;
+            return APN_ERROR;
+        }
+        canonical[length++] = *p;
+    }
+    canonical[length] = '\0';
+    return apn_token_hex_decode(canonical, binary_token);
+}
+
+void apn_token_hex_encode(const uint8_t *const binary_token, char *const token) {
+    assert(binary_token);
+    assert(token);
+    __apn_token_hex_encode_impl(binary_token, token);
+}
+
+uint32_t apn_token_hex_decode_many(const char *const *tokens, uint32_t count, uint8_t *binary_tokens, uint8_t *valid) {
+    uint32_t valid_count = 0;
+    uint32_t i = 0;
+    assert(tokens);
+    assert(binary_tokens);
+
+    for (; i < count; i++) {
+        uint8_t ok = (uint8_t) (tokens[i] &&
+                                APN_SUCCESS == __apn_token_hex_decode_impl(tokens[i], binary_tokens + (size_t) i * APN_TOKEN_BINARY_SIZE));
+        if (valid) {
+            valid[i] = ok;
+        }
+        valid_count += ok;
     }
-    while (*p != '\0') {
-        if (!isxdigit(*p)) {
-            return 0;
+    return valid_count;
+}
+
+void apn_token_hex_encode_many(const uint8_t *binary_tokens, uint32_t count, char *tokens) {
+    uint32_t i = 0;
+    assert(binary_tokens);
+    assert(tokens);
+
+    for (; i < count; i++) {
+        __apn_token_hex_encode_impl(binary_tokens + (size_t) i * APN_TOKEN_BINARY_SIZE, tokens + (size_t) i * (APN_TOKEN_LENGTH + 1));
+    }
+}
+
+static apn_return __apn_token_hex_decode_scalar(const char *const token, uint8_t *const binary_token) {
+    const uint8_t *p = (const uint8_t *) token;
+    uint32_t i = 0;
+
+    /* a NUL terminator maps to 0xFF, so a short token stops at its end */
+    for (; i < APN_TOKEN_BINARY_SIZE; i++) {
+        uint8_t high = __apn_hex_values[p[i * 2]];
+        uint8_t low = 0xFF;
+        if (0xFF == high || 0xFF == (low = __apn_hex_values[p[i * 2 + 1]])) {
+            return APN_ERROR;
         }
-        p++;
+        binary_token[i] = (uint8_t) ((high << 4) | low);
+    }
+    return ('\0' == p[APN_TOKEN_LENGTH]) ? APN_SUCCESS : APN_ERROR;
+}
+
+static void __apn_token_hex_encode_scalar(const uint8_t *const binary_token, char *const token) {
+    uint32_t i = 0;
+    for (; i < APN_TOKEN_BINARY_SIZE; i++) {
+        token[i * 2] = __apn_hex_digits[binary_token[i] >> 4];
+        token[i * 2 + 1] = __apn_hex_digits[binary_token[i] & 0x0F];
+    }
+    token[APN_TOKEN_LENGTH] = '\0';
+}
+
+#ifdef APN_TOKENS_SSE2
+
+/*
+ * Vector kernels load all 64 characters at once. A shorter string may end before that, so they are only
+ * used when the loads stay within one memory page and cannot fault; other tokens take the scalar path.
+ */
+#define __APN_TOKEN_LOAD_IS_SAFE(__p) ((((uintptr_t) (__p)) & (APN_TOKENS_PAGE_SIZE - 1)) <= APN_TOKENS_PAGE_SIZE - APN_TOKEN_LENGTH)
+
+/* Unsigned `a < n` for each byte */
+#define __APN_SSE2_LESS_THAN(__a, __n) \
+    _mm_cmplt_epi8(_mm_xor_si128((__a), _mm_set1_epi8((char) 0x80)), _mm_set1_epi8((char) ((__n) ^ 0x80)))
+
+/* Converts 16 hex digits to their values, `invalid` receives 0xFF for other characters */
+static __m128i __apn_hex_values_sse2(__m128i chars, __m128i *invalid) {
+    __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i letters = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_digit = __APN_SSE2_LESS_THAN(digits, 10);
+    __m128i is_letter = __APN_SSE2_LESS_THAN(letters, 6);
+
+    *invalid = _mm_or_si128(*invalid, _mm_xor_si128(_mm_or_si128(is_digit, is_letter), _mm_set1_epi8((char) 0xFF)));
+    return _mm_or_si128(_mm_and_si128(is_digit, digits),
+                        _mm_and_si128(is_letter, _mm_add_epi8(letters, _mm_set1_epi8(10))));
+}
+
+/* Joins pairs of nibbles into bytes: the first character of a pair is the high nibble */
+static __m128i __apn_hex_join_sse2(__m128i values) {
+    __m128i high = _mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x00FF)), 4);
+    __m128i low = _mm_srli_epi16(values, 8);
+    return _mm_or_si128(high, low);
+}
+
+static apn_return __apn_token_hex_decode_sse2(const char *const token, uint8_t *const binary_token) {
+    __m128i invalid = _mm_setzero_si128();
+    __m128i v0, v1, v2, v3;
+
+    if (!__APN_TOKEN_LOAD_IS_SAFE(token)) {
+        return __apn_token_hex_decode_scalar(token, binary_token);
+    }
+
+    v0 = __apn_hex_values_sse2(_mm_loadu_si128((const __m128i *) token), &invalid);
+    v1 = __apn_hex_values_sse2(_mm_loadu_si128((const __m128i *) (token + 16)), &invalid);
+    v2 = __apn_hex_values_sse2(_mm_loadu_si128((const __m128i *) (token + 32)), &invalid);
+    v3 = __apn_hex_values_sse2(_mm_loadu_si128((const __m128i *) (token + 48)), &invalid);
+    if (0 != _mm_movemask_epi8(invalid) || '\0' != token[APN_TOKEN_LENGTH]) {
+        return APN_ERROR;
+    }
+
+    _mm_storeu_si128((__m128i *) binary_token, _mm_packus_epi16(__apn_hex_join_sse2(v0), __apn_hex_join_sse2(v1)));
+    _mm_storeu_si128((__m128i *) (binary_token + 16), _mm_packus_epi16(__apn_hex_join_sse2(v2), __apn_hex_join_sse2(v3)));
+    return APN_SUCCESS;
+}
+
+/* Converts 16 nibbles to upper case hex digits */
+static __m128i __apn_hex_digits_sse2(__m128i nibbles) {
+    __m128i above_nine = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), _mm_and_si128(above_nine, _mm_set1_epi8('A' - '0' - 10)));
+}
+
+static void __apn_token_hex_encode_sse2(const uint8_t *const binary_token, char *const token) {
+    uint32_t i = 0;
+    for (; i < APN_TOKEN_BINARY_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (binary_token + i));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F));
+        __m128i low = _mm_and_si128(bytes, _mm_set1_epi8(0x0F));
+        _mm_storeu_si128((__m128i *) (token + i * 2), __apn_hex_digits_sse2(_mm_unpacklo_epi8(high, low)));
+        _mm_storeu_si128((__m128i *) (token + i * 2 + 16), __apn_hex_digits_sse2(_mm_unpackhi_epi8(high, low)));
+    }
+    token[APN_TOKEN_LENGTH] = '\0';
+}
+
+#endif
+
+#ifdef APN_TOKENS_AVX2
+
+#define __APN_AVX2_LESS_THAN(__a, __n) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char) ((__n) ^ 0x80)), _mm256_xor_si256((__a), _mm256_set1_epi8((char) 0x80)))
+
+__attribute__((target("avx2")))
+static __m256i __apn_hex_values_avx2(__m256i chars, __m256i *invalid) {
+    __m256i digits = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i letters = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i is_digit = __APN_AVX2_LESS_THAN(digits, 10);
+    __m256i is_letter = __APN_AVX2_LESS_THAN(letters, 6);
+
+    *invalid = _mm256_or_si256(*invalid, _mm256_xor_si256(_mm256_or_si256(is_digit, is_letter), _mm256_set1_epi8((char) 0xFF)));
+    return _mm256_or_si256(_mm256_and_si256(is_digit, digits),
+                           _mm256_and_si256(is_letter, _mm256_add_epi8(letters, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static __m256i __apn_hex_join_avx2(__m256i values) {
+    __m256i high = _mm256_slli_epi16(_mm256_and_si256(values, _mm256_set1_epi16(0x00FF)), 4);
+    __m256i low = _mm256_srli_epi16(values, 8);
+    return _mm256_or_si256(high, low);
+}
+
+__attribute__((target("avx2")))
+static apn_return __apn_token_hex_decode_avx2(const char *const token, uint8_t *const binary_token) {
+    __m256i invalid = _mm256_setzero_si256();
+    __m256i v0, v1;
+
+    if (!__APN_TOKEN_LOAD_IS_SAFE(token)) {
+        return __apn_token_hex_decode_scalar(token, binary_token);
+    }
+
+    v0 = __apn_hex_values_avx2(_mm256_loadu_si256((const __m256i *) token), &invalid);
+    v1 = __apn_hex_values_avx2(_mm256_loadu_si256((const __m256i *) (token + 32)), &invalid);
+    if (0 != _mm256_movemask_epi8(invalid) || '\0' != token[APN_TOKEN_LENGTH]) {
+        return APN_ERROR;
+    }
+
+    /* packus works within 128-bit lanes, restore the order of 64-bit blocks */
+    _mm256_storeu_si256((__m256i *) binary_token,
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(__apn_hex_join_avx2(v0), __apn_hex_join_avx2(v1)),
+                                                 _MM_SHUFFLE(3, 1, 2, 0)));
+    return APN_SUCCESS;
+}
+
+__attribute__((target("avx2")))
+static void __apn_token_hex_encode_avx2(const uint8_t *const binary_token, char *const token) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *) binary_token);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+    __m256i low = _mm256_and_si256(bytes, _mm256_set1_epi8(0x0F));
+    __m256i first = _mm256_unpacklo_epi8(high, low);
+    __m256i second = _mm256_unpackhi_epi8(high, low);
+    __m256i nine = _mm256_set1_epi8(9);
+    __m256i zero = _mm256_set1_epi8('0');
+    __m256i letter = _mm256_set1_epi8('A' - '0' - 10);
+
+    first = _mm256_add_epi8(_mm256_add_epi8(first, zero), _mm256_and_si256(_mm256_cmpgt_epi8(first, nine), letter));
+    second = _mm256_add_epi8(_mm256_add_epi8(second, zero), _mm256_and_si256(_mm256_cmpgt_epi8(second, nine), letter));
+
+    /* unpack works within 128-bit lanes, restore the order of bytes */
+    _mm256_storeu_si256((__m256i *) token, _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *) (token + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    token[APN_TOKEN_LENGTH] = '\0';
+}
+
+#endif
+
+static apn_return __apn_token_hex_decode_resolve(const char *const token, uint8_t *const binary_token) {
+    __apn_tokens_resolve();
+    return __apn_token_hex_decode_impl(token, binary_token);
+}
+
+static void __apn_token_hex_encode_resolve(const uint8_t *const binary_token, char *const token) {
+    __apn_tokens_resolve();
+    __apn_token_hex_encode_impl(binary_token, token);
+}
+
+static void __apn_tokens_resolve(void) {
+    /* Racing threads store the same pointers */
+    __apn_token_hex_decode_func decode = __apn_token_hex_decode_scalar;
+    __apn_token_hex_encode_func encode = __apn_token_hex_encode_scalar;
+#ifdef APN_TOKENS_SSE2
+    decode = __apn_token_hex_decode_sse2;
+    encode = __apn_token_hex_encode_sse2;
+#endif
+#ifdef APN_TOKENS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        decode = __apn_token_hex_decode_avx2;
+        encode = __apn_token_hex_encode_avx2;
     }
-    return 1;
+#endif
+    __apn_token_hex_decode_impl = decode;
+    __apn_token_hex_encode_impl = encode;
 }
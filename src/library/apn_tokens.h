@@ -43,6 +43,57 @@ char * apn_token_binary_to_hex(const uint8_t * const binary_token)
 uint8_t apn_hex_token_is_valid(const char * const token)
         __apn_attribute_nonnull__((1));
 
+/**
+ * Validates a hex token and decodes it into `binary_token` (::APN_TOKEN_BINARY_SIZE bytes) in a single pass,
+ * without allocating memory.
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if the token is invalid, `errno` is set to ::APN_ERR_TOKEN_INVALID.
+ *      `binary_token` may be partially overwritten.
+ */
+apn_return apn_token_hex_decode(const char * const token, uint8_t * const binary_token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Decodes a hex token which may come in a non-canonical form: whitespace and `<`, `>` brackets
+ * (as in `<1d2ee2b3 a3868 ...>`) are ignored and hex digits are accepted in either case.
+ * Canonical tokens take the same vectorised path as ::apn_token_hex_decode().
+ *
+ * @return
+ *      - ::APN_SUCCESS on success.
+ *      - ::APN_ERROR if the token is invalid, `errno` is set to ::APN_ERR_TOKEN_INVALID.
+ *      `binary_token` may be partially overwritten.
+ */
+apn_return apn_token_hex_decode_normalized(const char * const token, uint8_t * const binary_token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Encodes `binary_token` as upper case hex into `token` (::APN_TOKEN_LENGTH + 1 bytes, NUL-terminated),
+ * without allocating memory.
+ */
+void apn_token_hex_encode(const uint8_t * const binary_token, char * const token)
+        __apn_attribute_nonnull__((1,2));
+
+/**
+ * Decodes `count` hex tokens into `binary_tokens` (`count` * ::APN_TOKEN_BINARY_SIZE bytes).
+ *
+ * @param[in] tokens - Array of NUL-terminated hex tokens, NULL items are invalid.
+ * @param[in] count - Number of tokens.
+ * @param[out] binary_tokens - Decoded tokens, contents for invalid tokens is undefined.
+ * @param[out] valid - Receives 1 for each valid and 0 for each invalid token. Can be NULL.
+ *
+ * @return Number of valid tokens.
+ */
+uint32_t apn_token_hex_decode_many(const char * const *tokens, uint32_t count, uint8_t *binary_tokens, uint8_t *valid)
+        __apn_attribute_nonnull__((1,3));
+
+/**
+ * Encodes `count` binary tokens into `tokens`, ::APN_TOKEN_LENGTH + 1 bytes (NUL-terminated hex) per token.
+ */
+void apn_token_hex_encode_many(const uint8_t *binary_tokens, uint32_t count, char *tokens)
+        __apn_attribute_nonnull__((1,3));
+
 #ifdef __cplusplus
 }
 #endif
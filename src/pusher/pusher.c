@@ -24,16 +24,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 #include <termios.h>
 
 #include "apn.h"
 #include "apn_array.h"
 #include "apn_payload.h"
+#include "apn_campaign.h"
+#include "apn_token_file.h"
 #include "apn_strings.h"
 #include "apn_strerror.h"
 
@@ -72,56 +72,6 @@ static apn_array_t *__apn_split_tokens(char *const tokens) {
     return NULL;
 }
 
-apn_array_t *__apn_read_tokens_from_file(const char *const path) {
-    int fd = open(path, O_RDONLY);
-    if(fd < 0) {
-        return NULL;
-    }
-    struct stat fs;
-    if (-1 == fstat(fd, &fs)) {
-        close(fd);
-        return NULL;
-    }
-    char *buffer = mmap(0, fs.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    if ((void*) -1 == buffer) {
-        close(fd);
-        return NULL;
-    }
-
-    char *buffer_end = buffer + fs.st_size;
-    char *p_start = buffer;
-    char *p_end = buffer;
-
-    apn_array_t *tokens = apn_array_init(20, __apn_token_free, NULL);
-    if(!tokens) {
-        close(fd);
-        return NULL;
-    }
-
-    for(;;) {
-        if(*p_end != '\n') {
-            if (++p_end < buffer_end) {
-                continue;
-            }
-        }
-        size_t token_size = (p_end - p_start) + 1;
-        char *token = malloc(token_size);
-        if(!token) {
-            apn_array_free(tokens);
-            return NULL;
-        }
-        memset(token, 0, token_size);
-        apn_substr(token, p_start, token_size, 0, token_size - 1);
-        apn_array_insert(tokens, token);
-        if ((p_start = ++p_end) >= buffer_end) {
-            break;
-        }
-    }
-    munmap(buffer, fs.st_size);
-    close(fd);
-    return tokens;
-}
-
 static ssize_t __apn_getpass(char **password, size_t *n) {
     struct termios old_termios;
     struct termios new_termios;
@@ -138,6 +88,55 @@ static ssize_t __apn_getpass(char **password, size_t *n) {
     return read;
 }
 
+static char *__apn_pusher_read_file(const char *const file) {
+    char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t read = 0;
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    do {
+        if (size + 1 >= capacity) {
+            char *new_data = realloc(data, capacity + 4096);
+            if (!new_data) {
+                free(data);
+                fclose(fp);
+                errno = ENOMEM;
+                return NULL;
+            }
+            data = new_data;
+            capacity += 4096;
+        }
+        read = fread(data + size, 1, capacity - size - 1, fp);
+        size += read;
+    } while (read > 0);
+    if (ferror(fp)) {
+        free(data);
+        fclose(fp);
+        errno = EIO;
+        return NULL;
+    }
+    fclose(fp);
+    /* editors end files with a newline, which should not go into the payload */
+    while (size > 0 && isspace((unsigned char) data[size - 1])) {
+        size--;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+static void __apn_pusher_print_invalid_tokens(apn_array_t *invalid_tokens) {
+    uint32_t i = 0;
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Invalid tokens:\n");
+    for (; i < apn_array_count(invalid_tokens); i++) {
+        fprintf(stderr, "    %u. %s\n", i, (const char *)apn_array_item_at_index(invalid_tokens, i));
+    }
+    fprintf(stderr, "\n");
+}
+
 static void __apn_pusher_usage(void) {
     fprintf(stderr, "apn-pusher - simple tool to send push notifications to iOS and OS X devices\n");
     fprintf(stderr, "\n");
@@ -152,8 +151,14 @@ static void __apn_pusher_usage(void) {
     fprintf(stderr, "    -s Name of a sound file in the app bundle\n");
     fprintf(stderr, "    -i Name of an image file in the app bundle\n");
     fprintf(stderr, "    -y Category name of notification\n");
+    fprintf(stderr, "    -P Path to file with JSON payload to send as it is, replaces -m, -a, -b, -s, -i and -y\n");
     fprintf(stderr, "    -t Tokens, separated with ':' (required)\n");
     fprintf(stderr, "    -T Path to file with tokens\n");
+    fprintf(stderr, "    -B Path to binary token file\n");
+    fprintf(stderr, "    -X Convert the tokens into a binary token file instead of sending notification\n");
+    fprintf(stderr, "    -C Compile the notification for the tokens into a campaign file instead of sending it\n");
+    fprintf(stderr, "    -R Send a campaign file compiled with -C\n");
+    fprintf(stderr, "    -f Identifier of the first frame to send from the campaign file\n");
     fprintf(stderr, "    -v Make the operation more talkative\n");
 }
 
@@ -185,12 +190,20 @@ int main(int argc, char **argv) {
     apn_set_behavior(apn_ctx, APN_OPTION_RECONNECT);
 
     apn_array_t *tokens = NULL;
+    apn_token_source_t token_source;
+    apn_campaign_t *campaign = NULL;
+    const char *campaign_output = NULL;
+    apn_token_file_t *token_file = NULL;
+    const char *token_file_output = NULL;
+    uint32_t campaign_first_id = 0;
     char *p12_pass = NULL;
     char *p12 = NULL;
     uint8_t ret = 0;
     uint8_t rpassword = 0;
 
-    const char *const opts = "ahc:pdm:b:s:i:e:y:t:T:v";
+    memset(&token_source, 0, sizeof(apn_token_source_t));
+
+    const char *const opts = "ahc:pdm:b:s:i:e:y:P:t:T:B:X:C:R:f:v";
     int c = -1;
     while ((c = getopt(argc, argv, opts)) != -1) {
         switch (c) {
@@ -221,18 +234,60 @@ int main(int argc, char **argv) {
             case 'y':
                 apn_payload_set_category(payload, optarg);
                 break;
+            case 'P': {
+                char *json = __apn_pusher_read_file(optarg);
+                if (!json || APN_ERROR == apn_payload_set_raw_json(payload, json)) {
+                    char *error = apn_error_string(errno);
+                    fprintf(stderr, "Unable to use payload file %s: %s (errno: %d).\n", optarg, error, errno);
+                    free(error);
+                    free(json);
+                    ret = 1;
+                    goto finish;
+                }
+                free(json);
+                break;
+            }
             case 't':
                 tokens = __apn_split_tokens(optarg);
                 break;
             case 'T':
-                tokens = __apn_read_tokens_from_file(optarg);
-                if(!tokens) {
+                apn_token_source_free(&token_source);
+                if (APN_ERROR == apn_token_source_file(&token_source, optarg)) {
                     char error[250] = {0};
                     apn_strerror(errno, error, sizeof(error) - 1);
                     fprintf(stderr, "Unable to parse file %s: %s (errno: %d).\n", optarg, error, errno);
                     goto finish;
                 }
                 break;
+            case 'B':
+                apn_token_file_close(token_file);
+                if (NULL == (token_file = apn_token_file_open(optarg))) {
+                    char *error = apn_error_string(errno);
+                    fprintf(stderr, "Unable to open token file %s: %s (errno: %d).\n", optarg, error, errno);
+                    free(error);
+                    ret = 1;
+                    goto finish;
+                }
+                break;
+            case 'X':
+                token_file_output = optarg;
+                break;
+            case 'C':
+                campaign_output = optarg;
+                break;
+            case 'R':
+                apn_campaign_close(campaign);
+                if (NULL == (campaign = apn_campaign_open(optarg))) {
+                    char *error = apn_error_string(errno);
+                    fprintf(stderr, "Unable to open campaign file %s: %s (errno: %d).\n", optarg, error, errno);
+                    free(error);
+                    ret = 1;
+                    goto finish;
+                }
+                break;
+            case 'f':
+                campaign_first_id = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
             case 'a':
                 apn_payload_set_content_available(payload, 1);
                 break;
@@ -252,6 +307,74 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (token_file_output) {
+        uint32_t token_count = 0;
+        uint32_t invalid_count = 0;
+
+        if (!token_source.next && tokens && apn_array_count(tokens) > 0) {
+            if (APN_ERROR == apn_token_source_array(&token_source, tokens)) {
+                ret = 1;
+                goto finish;
+            }
+        }
+        if (!token_source.next) {
+            fprintf(stderr, "Missing device token\n");
+            ret = 1;
+            goto finish;
+        }
+
+        apn_return convert_ret = apn_token_file_convert(token_file_output, &token_source, &token_count, &invalid_count);
+        /* token source is freed by apn_token_file_convert() */
+        memset(&token_source, 0, sizeof(apn_token_source_t));
+        if (APN_ERROR == convert_ret) {
+            char *error = apn_error_string(errno);
+            fprintf(stderr, "Could not convert tokens to %s: %s (errno: %d)\n", token_file_output, error, errno);
+            free(error);
+            ret = 1;
+        } else {
+            fprintf(stderr, "Token file %s was sucessfully written: %u token(s), %u invalid token(s)\n",
+                    token_file_output, token_count, invalid_count);
+        }
+        goto finish;
+    }
+
+    if (campaign_output) {
+        uint32_t frame_count = 0;
+        uint32_t invalid_count = 0;
+
+        if (!token_source.next && tokens && apn_array_count(tokens) > 0) {
+            if (APN_ERROR == apn_token_source_array(&token_source, tokens)) {
+                ret = 1;
+                goto finish;
+            }
+        }
+        if (!token_source.next && token_file) {
+            if (APN_ERROR == apn_token_source_token_set(&token_source, apn_token_file_tokens(token_file))) {
+                ret = 1;
+                goto finish;
+            }
+        }
+        if (!token_source.next) {
+            fprintf(stderr, "Missing device token\n");
+            ret = 1;
+            goto finish;
+        }
+
+        apn_return compile_ret = apn_campaign_compile(campaign_output, payload, &token_source, &frame_count, &invalid_count);
+        /* token source is freed by apn_campaign_compile() */
+        memset(&token_source, 0, sizeof(apn_token_source_t));
+        if (APN_ERROR == compile_ret) {
+            char *error = apn_error_string(errno);
+            fprintf(stderr, "Could not compile campaign %s: %s (errno: %d)\n", campaign_output, error, errno);
+            free(error);
+            ret = 1;
+        } else {
+            fprintf(stderr, "Campaign %s was sucessfully compiled: %u frame(s), %u invalid token(s)\n",
+                    campaign_output, frame_count, invalid_count);
+        }
+        goto finish;
+    }
+
     if (p12) {
         if(rpassword) {
             printf("Enter .p12 file password: ");
@@ -284,7 +407,14 @@ int main(int argc, char **argv) {
         goto finish;
     }
 
-    if (!tokens || apn_array_count(tokens) == 0) {
+    if (!token_source.next && tokens && apn_array_count(tokens) > 0) {
+        if (APN_ERROR == apn_token_source_array(&token_source, tokens)) {
+            ret = 1;
+            goto finish;
+        }
+    }
+
+    if (!token_source.next && !campaign && !token_file) {
         fprintf(stderr, "Missing device token\n");
         ret = 1;
         goto finish;
@@ -295,26 +425,59 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Could not connected to Apple Push Notification Service: %s (errno: %d)\n", error, errno);
         ret = 1;
         free(error);
-    } else {
+    } else if (campaign) {
         apn_array_t *invalid_tokens = NULL;
-        if (APN_ERROR == apn_send(apn_ctx, payload, tokens, &invalid_tokens)) {
+        if (APN_ERROR == apn_campaign_send(apn_ctx, campaign, campaign_first_id, &invalid_tokens)) {
+            ret = 1;
+            char *error = apn_error_string(errno);
+            fprintf(stderr, "Could not send campaign: %s (errno: %d)\n", error, errno);
+            free(error);
+        } else {
+            fprintf(stderr, "Campaign was sucessfully sent (%u invalid token(s))\n",
+                    (invalid_tokens) ? apn_array_count(invalid_tokens) : 0);
+        }
+
+        if (invalid_tokens) {
+            __apn_pusher_print_invalid_tokens(invalid_tokens);
+            apn_array_free(invalid_tokens);
+        }
+    } else if (!token_source.next && token_file) {
+        apn_token_set_t *invalid_tokens = NULL;
+        if (APN_ERROR == apn_send_token_set(apn_ctx, payload, apn_token_file_tokens(token_file), &invalid_tokens)) {
             ret = 1;
             char *error = apn_error_string(errno);
             fprintf(stderr, "Could not send push: %s (errno: %d)\n", error, errno);
             free(error);
         } else {
-            fprintf(stderr, "Notification was sucessfully sent to %u device(s)\n",
-                    apn_array_count(tokens) - ((invalid_tokens) ? apn_array_count(invalid_tokens) : 0));
+            fprintf(stderr, "Notification was sucessfully sent (%u invalid token(s))\n",
+                    (invalid_tokens) ? apn_token_set_count(invalid_tokens) : 0);
         }
 
         if (invalid_tokens) {
-            fprintf(stderr, "\n");
-            fprintf(stderr, "Invalid tokens:\n");
-            uint32_t i = 0;
-            for (; i < apn_array_count(invalid_tokens); i++) {
-                fprintf(stderr, "    %u. %s\n", i, (const char *)apn_array_item_at_index(invalid_tokens, i));
+            apn_array_t *invalid_tokens_array = apn_token_set_to_array(invalid_tokens);
+            if (invalid_tokens_array) {
+                __apn_pusher_print_invalid_tokens(invalid_tokens_array);
+                apn_array_free(invalid_tokens_array);
             }
-            fprintf(stderr, "\n");
+            apn_token_set_free(invalid_tokens);
+        }
+    } else {
+        apn_array_t *invalid_tokens = NULL;
+        apn_return send_ret = apn_send_source(apn_ctx, payload, &token_source, &invalid_tokens);
+        /* token source is freed by apn_send_source() */
+        memset(&token_source, 0, sizeof(apn_token_source_t));
+        if (APN_ERROR == send_ret) {
+            ret = 1;
+            char *error = apn_error_string(errno);
+            fprintf(stderr, "Could not send push: %s (errno: %d)\n", error, errno);
+            free(error);
+        } else {
+            fprintf(stderr, "Notification was sucessfully sent (%u invalid token(s))\n",
+                    (invalid_tokens) ? apn_array_count(invalid_tokens) : 0);
+        }
+
+        if (invalid_tokens) {
+            __apn_pusher_print_invalid_tokens(invalid_tokens);
             apn_array_free(invalid_tokens);
         }
     }
@@ -325,6 +488,9 @@ int main(int argc, char **argv) {
 
     apn_free(apn_ctx);
     apn_payload_free(payload);
+    apn_token_source_free(&token_source);
+    apn_campaign_close(campaign);
+    apn_token_file_close(token_file);
     apn_array_free(tokens);
     apn_library_free();
 